@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <execution>
 #include <filesystem>
 
@@ -20,8 +21,10 @@
 #include "gui/selection_overlay.h"
 
 #include "renderer/raytrace_renderer.h"
+#include "renderer/ray_benchmark.h"
 #include "world.h"
 #include "geometry/box.h"
+#include "geometry/instance.h"
 
 #include "materials/dieletric_material.h"
 #include "materials/image_texture.h"
@@ -168,6 +171,51 @@ camera make_sphere_scene(world& world, object_store<material>& materials)
 	return camera;
 }
 
+camera make_instanced_scene(world& world, object_store<material>& materials)
+{
+	materials.add<metal_material>("Shiny chrome metal", color(0.8f, 0.8f, 0.8f), 0.05f);
+	materials.add<metal_material>("Gold Rough metal", color(0.8f, 0.6f, 0.2f), 0.6f);
+	materials.add<lambertian_material>("Diffuse blue", color(0.2f, 1.0f, 0.0f));
+	materials.add<lambertian_material>("Diffuse mauve", color(0.9f, 0.69f, 1.0f));
+
+	world.add<sphere>("Ground", point3(0.0f, -0.25f - 1000.0f, 0.0f), 1000.0f);
+
+	// the sphere grid of make_sphere_scene is built once and shared by all the instances
+	auto grid = std::make_shared<geometry_group>();
+	const int x_span = 6, z_span = 10;
+	for (int z = 0; z < z_span; z++)
+	{
+		for (int x = 0; x < x_span; x++)
+		{
+			auto& obj = grid->add<sphere>("Sphere", point3(static_cast<float>(x), 0.2f, static_cast<float>(z)), 0.3f);
+			obj.material = materials[random::get<size_t>(1, materials.size()) - 1];
+		}
+	}
+	grid->build();
+
+	const int instance_count = 1000, instances_per_row = 40;
+	for (int i = 0; i < instance_count; i++)
+	{
+		const point3 position((i % instances_per_row - instances_per_row * 0.5f) * (x_span + 1.0f),
+		                      0.0f,
+		                      static_cast<float>(i / instances_per_row) * (z_span + 1.0f));
+		world.add<instance>(("Grid " + std::to_string(i)).c_str(), grid, position);
+	}
+
+	auto& light_material = materials.add<lambertian_material>("Light", *solid_color::white());
+	light_material.emission = solid_color::white();
+	light_material.emission_strength = 1.0f;
+	auto& light = world.add<sphere>("Light", point3(0.0f, 60.0f, 100.0f), 30.0f);
+	light.material = &light_material;
+	light.update();
+
+	::camera camera{16.0f / 9.0f};
+	camera.origin = point3(0.0f, 12.0f, -10.0f);
+	camera.target = point3(0.0f, 0.0f, 40.0f);
+	camera.vertical_fov = 60.0f;
+	return camera;
+}
+
 camera make_simple_scene(world& world, object_store<material>& materials)
 {
 	auto& earth_material = materials.add<lambertian_material>(
@@ -232,14 +280,14 @@ int main()
 			return make_simple_scene(world, materials);
 		case 3:
 			return make_box_scene(world, materials);
+		case 4:
+			return make_instanced_scene(world, materials);
 		}
 		return make_simple_scene(world, materials);
 	}();
 
 	camera.update();
 
-	world.signal_scene_change();
-
 	gui::initialize_opengl();
 
 	// output settings
@@ -250,6 +298,10 @@ int main()
 	raytrace_renderer.current_render.settings.background_top_color = color(0.2f);
 	raytrace_renderer.current_render.settings.background_strength = 0.05f;
 
+	// restarting on an unchanged scene loads its bvh instead of building it
+	const std::string bvh_cache_path = "rtracer_bvh.cache";
+	world.signal_scene_load(bvh_cache_path, &raytrace_renderer.thread.pool);
+
 	hit_info ahit{&lambertian_material::default_material()};
 	world.hit(ray(point3(0.0f), direction3(0.0f, 0.0f, 1.0f)), 0.001f, constants::infinity, ahit);
 
@@ -268,6 +320,18 @@ int main()
 
 	bool mouse_over_hierarchy = false, prev_mouse_over_hierarchy = false;
 	bool is_hierarchy_focused;
+	ray_benchmark bvh_benchmark;
+	float bvh_throughput[4]{};
+	size_t bvh_memory[4]{};
+	// traversal of the binary bvh with its nodes in their current order, and in treelet order
+	bvh_traversal_stats bvh_stats, treelet_bvh_stats;
+	float bvh_order_throughput[2]{};
+	float primary_throughput[2]{};
+	float occluded_throughput{0.0f};
+	kernel_throughput kernel_throughputs;
+	ray_query_throughput query_throughputs;
+	std::vector<sampler_convergence> sampler_convergences;
+	std::vector<sampling_statistics> sampling_checks;
 	vec3 viewer_mouse_pos{-1.0f, -1.0f, -1.0f};
 
 	while (!gui::close_requested())
@@ -276,6 +340,11 @@ int main()
 		gui::start_frame();
 
 		bool scene_changed = false;
+		// the bvh only needs to be updated when objects are edited or when its build settings change
+		bool rebuild_bvh = false;
+		::hittable* edited_object = nullptr;
+		// what the edits changed in the world, so that the render only updates that (see compiled_scene::update)
+		scene_changes changes;
 		if (ImGui::Begin("Render"))
 		{			
 			auto target_iteration = static_cast<int>(raytrace_renderer.current_render.target_iteration);
@@ -306,7 +375,177 @@ int main()
 			                                 raytrace_renderer.current_render.settings.background_top_color);
 			scene_changed |= gui::draw_color("Background bottom",
 			                                 raytrace_renderer.current_render.settings.background_bottom_color);
-			ImGui::Checkbox("Use BVH", &world.use_bvh);
+			scene_changed |= ImGui::Checkbox("Use BVH", &world.use_bvh);
+			scene_changed |= ImGui::Checkbox("Trace primary rays in packets",
+			                                 &raytrace_renderer.current_render.settings.use_ray_packets);
+			auto integrator = static_cast<int>(raytrace_renderer.current_render.settings.integrator);
+			if (ImGui::Combo("Integrator", &integrator, "Path (one path at a time)\0Wavefront (one bounce at a time)\0"))
+			{
+				raytrace_renderer.current_render.settings.integrator = static_cast<raytrace_integrator>(integrator);
+				scene_changed = true;
+			}
+			auto light_sampling = static_cast<int>(raytrace_renderer.current_render.settings.light_sampling);
+			if (ImGui::Combo("Light sampling", &light_sampling,
+			                 "None (scattered rays only)\0Lights only\0MIS (balance heuristic)\0MIS (power heuristic)\0"))
+			{
+				raytrace_renderer.current_render.settings.light_sampling = static_cast<raytrace_light_sampling>(light_sampling);
+				scene_changed = true;
+			}
+			auto sampling = static_cast<int>(raytrace_renderer.current_render.settings.sampling);
+			if (ImGui::Combo("Sampler", &sampling, "Independent\0Stratified\0Sobol (scrambled)\0Blue-noise dithered Sobol\0"))
+			{
+				raytrace_renderer.current_render.settings.sampling = static_cast<sampler_type>(sampling);
+				scene_changed = true;
+			}
+			if (raytrace_renderer.current_render.settings.sampling == sampler_type::stratified)
+			{
+				scene_changed |= ImGui::DragInt("Stratified samples per pixel",
+				                                &raytrace_renderer.current_render.settings.stratified_sample_count, 1.0f, 1,
+				                                1 << 20);
+			}
+			ImGui::Text("Scene compiled for rendering in %.2fms", raytrace_renderer.current_render.scene.last_compile_duration);
+			if (raytrace_renderer.current_render.settings.integrator == raytrace_integrator::wavefront)
+			{
+				const wavefront_timings& timings = raytrace_renderer.current_render.last_wavefront_timings;
+				ImGui::Text("Wavefront: %d bounces, %zu rays in %.2fms", timings.bounces, timings.rays, timings.total());
+				ImGui::Text("generate %.2fms, intersect %.2fms, sort %.2fms, shade %.2fms, compact %.2fms",
+				            timings.generate, timings.intersect, timings.sort, timings.shade, timings.compact);
+			}
+			auto layout = static_cast<int>(world.get_bvh_layout());
+			if (ImGui::Combo("BVH layout", &layout, "Binary\0Wide 4 (SSE)\0Wide 8 (AVX)\0Compressed 4 (8-bit)\0"))
+			{
+				world.set_bvh_layout(static_cast<bvh_layout>(layout));
+				scene_changed = true;
+			}
+			auto build_method = static_cast<int>(world.build_method);
+			if (ImGui::Combo("BVH builder", &build_method, "Median split\0Binned SAH\0Spatial splits (SBVH)\0"))
+			{
+				world.build_method = static_cast<bvh_build_method>(build_method);
+				rebuild_bvh = true;
+			}
+			if (ImGui::SliderInt("BVH build threads", &world.build_thread_count, 1,
+			                     static_cast<int>(raytrace_render_thread::thread_count)))
+			{
+				rebuild_bvh = true;
+			}
+			rebuild_bvh |= ImGui::Checkbox("Lazy BVH build", &world.lazy_build);
+			rebuild_bvh |= ImGui::Checkbox("Reorder BVH nodes in treelets", &world.reorder_nodes);
+			if (world.lazy_build)
+			{
+				ImGui::Text("Lazy BVH: %zu / %zu nodes built", world.get_lazy_bvh().node_count(),
+				            world.get_lazy_bvh().node_capacity());
+			}
+			ImGui::Checkbox("Refit BVH on object edits", &world.use_refit);
+			ImGui::DragFloat("BVH refit threshold", &world.refit_threshold, 0.01f, 1.0f, 10.0f);
+			ImGui::Text("BVH update: %.2fms%s (%d rebuilds, %d refits)", world.last_build_duration,
+			            world.last_build_cached ? " from cache" : "", world.rebuild_count, world.refit_count);
+			ImGui::Text("BVH: %zu nodes, %zu references to %zu objects (%zu spatial splits), SAH cost %.2f",
+			            world.get_bvh().nodes().size(), world.get_bvh().primitives().size(),
+			            world.get_bvh().object_count(), world.get_bvh().spatial_split_count(),
+			            world.get_bvh().sah_cost());
+			if (ImGui::Button("Save BVH to cache"))
+			{
+				world.save_bvh_cache(bvh_cache_path);
+			}
+			scene_changed |= rebuild_bvh;
+			if (ImGui::Button("Benchmark BVH layouts"))
+			{
+				// the render is stopped so that it does not compete with the benchmark
+				raytrace_renderer.signal_scene_change(scene_changes{});
+				bvh_benchmark.record(camera, world, image_width / 4, image_height / 4,
+				                     raytrace_renderer.current_render.settings.bounce_depth);
+				for (int i = 0; i < 4; i++)
+				{
+					world.set_bvh_layout(static_cast<bvh_layout>(i));
+					bvh_throughput[i] = bvh_benchmark.measure(world);
+					bvh_memory[i] = world.bvh_memory_usage();
+				}
+				world.set_bvh_layout(static_cast<bvh_layout>(layout));
+				occluded_throughput = bvh_benchmark.measure_occluded(world);
+				query_throughputs = bvh_benchmark.measure_queries(world, raytrace_renderer.thread.pool);
+				kernel_throughputs = bvh_benchmark.measure_kernels(world.get_bvh());
+				bvh_stats = bvh_benchmark.traversal_stats(world.get_bvh());
+				bvh treelet_bvh = world.get_bvh();
+				treelet_bvh.reorder_treelets();
+				treelet_bvh_stats = bvh_benchmark.traversal_stats(treelet_bvh);
+				bvh_order_throughput[0] = bvh_benchmark.measure(world.get_bvh());
+				bvh_order_throughput[1] = bvh_benchmark.measure(treelet_bvh);
+				for (int i = 0; i < 2; i++)
+				{
+					primary_throughput[i] = ray_benchmark::measure_primary(camera, world, image_width, image_height, i == 1);
+				}
+				scene_changed = true;
+			}
+			if (bvh_benchmark.ray_count() > 0)
+			{
+				ImGui::Text("%zu rays: binary %.2f, wide 4 %.2f, wide 8 %.2f, compressed %.2f Mrays/s",
+				            bvh_benchmark.ray_count(), bvh_throughput[0], bvh_throughput[1], bvh_throughput[2],
+				            bvh_throughput[3]);
+				ImGui::Text("BVH nodes: binary %zu KB, wide 4 %zu KB, wide 8 %zu KB, compressed %zu KB",
+				            bvh_memory[0] / 1024, bvh_memory[1] / 1024, bvh_memory[2] / 1024, bvh_memory[3] / 1024);
+				ImGui::Text("Binary BVH: %.1f nodes, %.1f primitives per ray", bvh_stats.nodes_per_ray(),
+				            bvh_stats.primitives_per_ray());
+				ImGui::Text("Node order: current %.2f Mrays/s %.2f misses/ray, treelets %.2f Mrays/s %.2f misses/ray",
+				            bvh_order_throughput[0], bvh_stats.cache_misses_per_ray(), bvh_order_throughput[1],
+				            treelet_bvh_stats.cache_misses_per_ray());
+				ImGui::Text("Primary rays: single %.2f Mrays/s, packets %.2f Mrays/s", primary_throughput[0],
+				            primary_throughput[1]);
+				ImGui::Text("Occlusion only (any hit): %.2f Mrays/s", occluded_throughput);
+				ImGui::Text("Batched queries: hit %.2f Mrays/s (%zu mismatches), occluded %.2f Mrays/s (%zu mismatches)",
+				            query_throughputs.hit, query_throughputs.hit_mismatches, query_throughputs.occluded,
+				            query_throughputs.occluded_mismatches);
+				ImGui::Text("Kernels (Mcalls/s): box pair scalar %.1f, SIMD %.1f - packet box 4 lanes %.1f, 8 lanes %.1f",
+				            kernel_throughputs.box_pair_scalar, kernel_throughputs.box_pair_simd,
+				            kernel_throughputs.packet_box_4, kernel_throughputs.packet_box_8);
+				ImGui::Text("Pixel resolve (Mpixels/s): glm %.1f, float4 %.1f", kernel_throughputs.resolve_scalar,
+				            kernel_throughputs.resolve_simd);
+				ImGui::Text("Cosine-weighted directions (M/s): single %.1f, batches %.1f",
+				            kernel_throughputs.cosine_sample_scalar, kernel_throughputs.cosine_sample_simd);
+			}
+			if (ImGui::Button("Measure sampler convergence"))
+			{
+				raytrace_renderer.signal_scene_change(scene_changes{});
+				sampler_convergences = ray_benchmark::measure_convergence(camera, world,
+				                                                          raytrace_renderer.current_render.settings);
+				scene_changed = true;
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Measure light sampling"))
+			{
+				raytrace_renderer.signal_scene_change(scene_changes{});
+				sampler_convergences = ray_benchmark::measure_light_sampling(camera, world,
+				                                                             raytrace_renderer.current_render.settings);
+				scene_changed = true;
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Check sampling distributions"))
+			{
+				raytrace_renderer.signal_scene_change(scene_changes{});
+				sampling_checks = ray_benchmark::measure_sampling();
+				scene_changed = true;
+			}
+			for (const sampling_statistics& check : sampling_checks)
+			{
+				ImGui::Text("%s (%s): E[z] %.4f (%.4f), E[z^2] %.4f (%.4f), E[r^2] %.4f (%.4f), chi^2 %.1f (%d dof)",
+				            check.name, check.is_batch ? "batch" : "scalar", check.mean_z, check.expected_z,
+				            check.mean_square_z, check.expected_square_z, check.mean_square_radius,
+				            check.expected_square_radius, check.chi_square, check.degrees_of_freedom);
+			}
+			for (const sampler_convergence& convergence : sampler_convergences)
+			{
+				constexpr const char* names[] = {"Independent", "Stratified", "Sobol", "Blue noise"};
+				constexpr const char* light_names[] = {"", ", lights sampled", ", MIS balance", ", MIS power"};
+				std::string text = std::string(names[static_cast<int>(convergence.type)])
+					+ light_names[static_cast<int>(convergence.light_sampling)] + " RMSE:";
+				char sample_text[64];
+				for (size_t i = 0; i < convergence.errors.size(); i++)
+				{
+					std::snprintf(sample_text, sizeof(sample_text), " %zuspp %.4f (%.0fms)", size_t{1} << i,
+					              convergence.errors[i], convergence.durations[i]);
+					text += sample_text;
+				}
+				ImGui::TextUnformatted(text.c_str());
+			}
 			if (ImGui::Button("Save to image"))
 			{
 				std::string filename = "rtracer_" + std::to_string(average_render_time) + "ms_" + std::to_string(
@@ -345,7 +584,15 @@ int main()
 
 		if (ImGui::Begin("Inspector"))
 		{
-			scene_changed |= draw_inspector(camera, &selection);
+			if (draw_inspector(camera, &selection))
+			{
+				scene_changed = true;
+				if (selection != &camera)
+				{
+					edited_object = static_cast<::hittable*>(selection);
+					changes.geometry = true;
+				}
+			}
 
 			material* mat = nullptr;
 			if (material_selection != nullptr && !is_hierarchy_focused)
@@ -370,10 +617,12 @@ int main()
 					{
 						static_cast<::hittable*>(selection)->material = static_cast<material*>(material_selection);
 						scene_changed = true;
+						changes.structure = true;
 					}
 				}
 
-				scene_changed |= inspector.serialize_root(mat->serialize().get());
+				changes.materials |= inspector.serialize_root(mat->serialize().get());
+				scene_changed |= changes.materials;
 			}
 		}
 		ImGui::End();
@@ -382,8 +631,12 @@ int main()
 		bool has_selection = selection != nullptr && selection != &camera;
 		if (scene_changed)
 		{
-			raytrace_renderer.signal_scene_change();
-			world.signal_scene_change();
+			// a rebuilt bvh is noticed by the compiled scene on its own
+			raytrace_renderer.signal_scene_change(changes);
+			if (rebuild_bvh)
+				world.signal_scene_change(&raytrace_renderer.thread.pool);
+			else if (edited_object != nullptr)
+				world.signal_object_change(edited_object, &raytrace_renderer.thread.pool);
 
 			raytrace_renderer.render(camera, world);
 			if (has_selection)
@@ -416,7 +669,8 @@ int main()
 				if (is_window_focused && ImGui::IsMouseClicked(ImGuiMouseButton_Left))
 				{
 					hit_info hit{&lambertian_material::default_material()};
-					if (world.hit(camera.compute_ray_to(viewer_mouse_pos.x, viewer_mouse_pos.y), 0.001f,
+					sampler rng(sampler_type::independent, 0, 0, 0);
+					if (world.hit(camera.compute_ray_to(viewer_mouse_pos.x, viewer_mouse_pos.y, rng), 0.001f,
 					              constants::infinity, hit))
 					{
 						selection = hit.object;
@@ -2,8 +2,10 @@
 
 #include "serializable.h"
 #include "serializable_node.h"
-#include "core/vec3.h"
+#include "core/sampler.h"
+#include "core/sampling.h"
 #include "core/ray.h"
+#include "core/vec3.h"
 
 class camera : public serializable
 {
@@ -20,12 +22,24 @@ public:
 		return m_aspect_ratio;
 	}
 
-	ray compute_ray_to(float x_pixel, float y_pixel) const
+	/// <summary>
+	/// returns true if all the rays start from the origin (no depth of field): rays to neighboring pixels are then coherent
+	/// </summary>
+	bool is_pinhole() const
+	{
+		return aperture <= constants::epsilon;
+	}
+
+	/// <summary>
+	/// returns the ray through the given point of the viewport (from 0 to 1 on each axis)
+	/// the point of the lens it starts from is drawn from rng (unless the camera is a pinhole)
+	/// </summary>
+	ray compute_ray_to(float x_pixel, float y_pixel, sampler& rng) const
 	{
 		vec3 offset{0.0f};
-		if (aperture > constants::epsilon)
+		if (!is_pinhole())
 		{
-			const vec3 disk = aperture * 2.0f * vector3::random_in_unit_disk();
+			const vec2 disk = aperture * 2.0f * sampling::concentric_disk(rng);
 			offset = m_u * disk.x + m_v * disk.y;
 		}
 		return ray(point3(origin + offset), direction3(
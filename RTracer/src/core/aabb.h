@@ -1,7 +1,10 @@
 ﻿#pragma once
 
+#include <algorithm>
+
 #include "hit_info.h"
 #include "ray.h"
+#include "simd.h"
 #include "vec3.h"
 
 /// <summary>
@@ -33,15 +36,15 @@ public:
 	/// construct an aabb that surrounds two other aabb
 	/// </summary>
 	/// <returns></returns>
-	static aabb surrounding(aabb box0, aabb box1)
+	static aabb surrounding(const aabb& box0, const aabb& box1)
 	{
-		const point3 small(fmin(box0.minimum.x, box1.minimum.x),
-		                   fmin(box0.minimum.y, box1.minimum.y),
-		                   fmin(box0.minimum.z, box1.minimum.z));
+		const point3 small(std::min(box0.minimum.x, box1.minimum.x),
+		                   std::min(box0.minimum.y, box1.minimum.y),
+		                   std::min(box0.minimum.z, box1.minimum.z));
 
-		const point3 big(fmax(box0.maximum.x, box1.maximum.x),
-		                 fmax(box0.maximum.y, box1.maximum.y),
-		                 fmax(box0.maximum.z, box1.maximum.z));
+		const point3 big(std::max(box0.maximum.x, box1.maximum.x),
+		                 std::max(box0.maximum.y, box1.maximum.y),
+		                 std::max(box0.maximum.z, box1.maximum.z));
 
 		return aabb(small, big);
 	}
@@ -51,12 +54,12 @@ public:
 	/// </summary>
 	void encapsulate(const point3& p)
 	{
-		minimum = point3(fmin(minimum.x, p.x),
-		                 fmin(minimum.y, p.y),
-		                 fmin(minimum.z, p.z));
-		maximum = point3(fmax(maximum.x, p.x),
-		                 fmax(maximum.y, p.y),
-		                 fmax(maximum.z, p.z));
+		minimum = point3(std::min(minimum.x, p.x),
+		                 std::min(minimum.y, p.y),
+		                 std::min(minimum.z, p.z));
+		maximum = point3(std::max(maximum.x, p.x),
+		                 std::max(maximum.y, p.y),
+		                 std::max(maximum.z, p.z));
 	}
 
 	/// <summary>
@@ -115,6 +118,63 @@ public:
 		return std::tuple{true, axis, t_min};
 	}
 	
+	/// <summary>
+	/// returns the distance at which the given ray enters the aabb
+	/// or infinity if it does not hit it at a distance comprised between t_min and t_max
+	/// </summary>
+	[[nodiscard]] float entry_distance(const ray& r, float t_min, float t_max) const
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			const float t0 = (minimum[i] - r.origin[i]) * r.inv_direction[i];
+			const float t1 = (maximum[i] - r.origin[i]) * r.inv_direction[i];
+			const bool swap = t1 < t0;
+			t_min = std::max(t_min, swap ? t1 : t0);
+			t_max = std::min(t_max, swap ? t0 : t1);
+		}
+
+		return t_min <= t_max ? t_min : constants::infinity;
+	}
+
+	/// <summary>
+	/// ray prepared for entry_distances: its origin and inverse direction are repeated in both halves of a float8
+	/// </summary>
+	struct simd_ray
+	{
+		explicit simd_ray(const ray& r)
+			: origin(float8::combine(float4::from_vec3(r.origin), float4::from_vec3(r.origin))),
+			  inv_direction(float8::combine(float4::from_vec3(r.inv_direction), float4::from_vec3(r.inv_direction)))
+		{
+		}
+
+		float8 origin;
+		float8 inv_direction;
+	};
+
+	/// <summary>
+	/// same as entry_distance for two boxes at once (e.g. the two children of a bvh node):
+	/// the boxes are the two halves of a float8, and all their slabs are tested at once
+	/// </summary>
+	static void entry_distances(const aabb& first, const aabb& second, const simd_ray& r, float t_min, float t_max,
+	                            float& first_distance, float& second_distance)
+	{
+		const float8 t0 = (float8::combine(float4::from_vec3(first.minimum), float4::from_vec3(second.minimum))
+			- r.origin) * r.inv_direction;
+		const float8 t1 = (float8::combine(float4::from_vec3(first.maximum), float4::from_vec3(second.maximum))
+			- r.origin) * r.inv_direction;
+		// operands are ordered so that a NaN (0 * infinity) is ignored, as in entry_distance
+		const float8 t_enter = max(min(t1, t0), float8(t_min));
+		const float8 t_exit = min(max(t0, t1), float8(t_max));
+
+		const auto distance = [](const float4& enter, const float4& exit)
+		{
+			const float entry = enter.horizontal_max();
+			return entry <= exit.horizontal_min() ? entry : constants::infinity;
+		};
+		first_distance = distance(t_enter.low(), t_exit.low());
+		second_distance = distance(t_enter.high(), t_exit.high());
+	}
+
 	/// <summary>
 	/// returns true if the given ray hits the aabb at a distance comprised between t_min and t_max
 	/// </summary>
@@ -139,6 +199,17 @@ public:
 		return size() * 0.5f;
 	}
 
+	/// <summary>
+	/// returns the surface area of the aabb (0 for an empty aabb)
+	/// </summary>
+	[[nodiscard]] float surface_area() const
+	{
+		const vec3 s = size();
+		if (s.x < 0.0f || s.y < 0.0f || s.z < 0.0f)
+			return 0.0f;
+		return 2.0f * (s.x * s.y + s.y * s.z + s.z * s.x);
+	}
+
 	point3 minimum;
 	point3 maximum;
 };
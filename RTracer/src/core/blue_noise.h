@@ -0,0 +1,135 @@
+﻿#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "random.h"
+#include "utility.h"
+
+/// <summary>
+/// tile of blue noise: its values are uniformly distributed and neighboring cells get values as different as possible
+/// (the noise has no low frequencies, so its error is hard to see once filtered by the eye).
+/// The tile is generated once, the first time it is used, by the void-and-cluster method (see Ulichney 1993)
+/// </summary>
+class blue_noise
+{
+public:
+	static constexpr uint32_t size = 64;
+	static constexpr uint32_t cell_count = size * size;
+
+	/// <summary>
+	/// returns the value of the tile repeated over the image at the given pixel, as a 32-bit fixed-point number from 0 to 1
+	/// each dimension reads the tile shifted by a different offset (along the R2 sequence), so that the values
+	/// of the dimensions of a pixel are not correlated
+	/// </summary>
+	[[nodiscard]] static uint32_t get(uint32_t x, uint32_t y, uint32_t dimension)
+	{
+		static const blue_noise tile;
+		const uint32_t shift_x = (dimension * 0xC13FA9A9u) >> 26;
+		const uint32_t shift_y = (dimension * 0x91E10DA6u) >> 26;
+		return tile.m_values[(y + shift_y) % size * size + (x + shift_x) % size];
+	}
+
+private:
+	blue_noise()
+	{
+		// gaussian energy of a point on the cells around it (sigma of 1.5 cells)
+		constexpr int radius = 8;
+		constexpr int kernel_size = 2 * radius + 1;
+		std::array<float, kernel_size * kernel_size> kernel{};
+		for (int y = -radius; y <= radius; y++)
+		{
+			for (int x = -radius; x <= radius; x++)
+			{
+				kernel[(y + radius) * kernel_size + x + radius] = std::exp(-static_cast<float>(x * x + y * y) / 4.5f);
+			}
+		}
+
+		std::vector<float> energy(cell_count, 0.0f);
+		std::vector<uint8_t> points(cell_count, 0);
+		const auto toggle = [&](uint32_t cell, bool is_point)
+		{
+			points[cell] = is_point;
+			const float sign = is_point ? 1.0f : -1.0f;
+			const int cell_x = static_cast<int>(cell % size);
+			const int cell_y = static_cast<int>(cell / size);
+			for (int y = -radius; y <= radius; y++)
+			{
+				const uint32_t row = static_cast<uint32_t>(cell_y + y + size) % size * size;
+				for (int x = -radius; x <= radius; x++)
+				{
+					energy[row + static_cast<uint32_t>(cell_x + x + size) % size]
+						+= sign * kernel[(y + radius) * kernel_size + x + radius];
+				}
+			}
+		};
+		// the point with the most energy (the tightest cluster), or the empty cell with the least (the largest void)
+		const auto find = [&](bool is_point)
+		{
+			uint32_t best = 0;
+			float best_energy = is_point ? -constants::infinity : constants::infinity;
+			for (uint32_t cell = 0; cell < cell_count; cell++)
+			{
+				if (points[cell] == is_point && (is_point ? energy[cell] > best_energy : energy[cell] < best_energy))
+				{
+					best = cell;
+					best_energy = energy[cell];
+				}
+			}
+			return best;
+		};
+
+		// initial pattern: a tenth of the cells taken at random, then spread evenly by moving
+		// the tightest cluster to the largest void until it is already there
+		constexpr uint32_t initial_count = cell_count / 10;
+		for (uint64_t key = 0, count = 0; count < initial_count; key++)
+		{
+			const uint32_t cell = static_cast<uint32_t>(random::hash(key) % cell_count);
+			if (points[cell])
+				continue;
+			toggle(cell, true);
+			count++;
+		}
+		for (uint32_t i = 0; i < cell_count; i++)
+		{
+			const uint32_t cluster = find(true);
+			toggle(cluster, false);
+			const uint32_t largest_void = find(false);
+			toggle(largest_void, true);
+			if (largest_void == cluster)
+				break;
+		}
+		const std::vector<uint8_t> initial_points = points;
+		const std::vector<float> initial_energy = energy;
+
+		// the points of the initial pattern are ranked by removing the tightest clusters one after the other,
+		// the other cells by filling the largest voids (once half of the cells are points, filling the largest void
+		// is also removing the tightest cluster of the empty cells, since the energy of all the cells sums to a constant)
+		std::vector<uint32_t> ranks(cell_count);
+		for (uint32_t rank = initial_count; rank-- > 0;)
+		{
+			const uint32_t cluster = find(true);
+			toggle(cluster, false);
+			ranks[cluster] = rank;
+		}
+		points = initial_points;
+		energy = initial_energy;
+		for (uint32_t rank = initial_count; rank < cell_count; rank++)
+		{
+			const uint32_t largest_void = find(false);
+			toggle(largest_void, true);
+			ranks[largest_void] = rank;
+		}
+
+		// the rank of a cell is mapped to the middle of its share of [0, 1)
+		constexpr uint64_t step = (1ull << 32) / cell_count;
+		for (uint32_t cell = 0; cell < cell_count; cell++)
+		{
+			m_values[cell] = static_cast<uint32_t>(ranks[cell] * step + step / 2);
+		}
+	}
+
+	std::array<uint32_t, cell_count> m_values{};
+};
@@ -1,5 +1,7 @@
 ﻿#pragma once
 
+#include <cstdint>
+
 #include "vec3.h"
 
 class material;
@@ -7,6 +9,8 @@ class hittable;
 
 /// <summary>
 /// contains information of how the light hits an hittable object
+/// while looking for the closest hit, only the distance and what identifies the hit primitive are recorded:
+/// the surface (point, normal, uv, material) is evaluated once, for the closest hit only (see hittable::base_evaluate)
 /// </summary>
 struct hit_info
 {
@@ -26,6 +30,16 @@ struct hit_info
 	material* material = nullptr;
 	// the hit object
 	hittable* object = nullptr;
+	// the object whose surface was hit: the same as object, except for instances where it is an object of the group
+	hittable* primitive = nullptr;
+	// data recorded by the hit of the primitive for the evaluation of its surface (e.g. the axis of a face of a box)
+	uint32_t local_data = 0;
+
+	// index of the material of the hit object in the compiled_scene (set by compiled_scene::hit instead of material)
+	uint32_t material_index = 0;
+	// references to the hit object and primitive in the compiled_scene (set by compiled_scene::hit)
+	uint32_t object_index = 0;
+	uint32_t primitive_index = 0;
 
 	explicit hit_info(::material* material)
 		: material(material)
@@ -0,0 +1,58 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string>
+
+/// <summary>
+/// read-only view of a whole file mapped in memory:
+/// pages are only read from disk when they are accessed, and are shared with the system file cache
+/// </summary>
+class mapped_file
+{
+public:
+	mapped_file() = default;
+
+	explicit mapped_file(const std::string& path)
+	{
+		open(path);
+	}
+
+	~mapped_file()
+	{
+		close();
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	/// <summary>
+	/// map the file of the given path (the previously mapped file is released)
+	/// returns false if the file does not exist, is empty or cannot be mapped
+	/// </summary>
+	bool open(const std::string& path);
+
+	void close();
+
+	[[nodiscard]] bool is_open() const
+	{
+		return m_data != nullptr;
+	}
+
+	[[nodiscard]] const std::byte* data() const
+	{
+		return m_data;
+	}
+
+	[[nodiscard]] size_t size() const
+	{
+		return m_size;
+	}
+
+private:
+	const std::byte* m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
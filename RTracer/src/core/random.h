@@ -1,10 +1,12 @@
 ﻿#pragma once
 
+#include <cstdint>
 #include <random>
 
 namespace random
 {
 	// return a random float from min to max
+	// it is not thread-safe: it is meant for the setup of scenes, the render uses sampler
 	template <typename T>
 	inline T get(T min = 0, T max = 1)
 	{
@@ -21,26 +23,15 @@ namespace random
 		}
 	}
 
-	template <int N, typename T>
-	struct static_random_generator
+	/// <summary>
+	/// finalizer of splitmix64: a bijection of 64-bit values whose outputs pass the statistical tests of random numbers
+	/// it turns keys (e.g. a pixel and the index of a sample) into random numbers without any state (see sampler)
+	/// </summary>
+	inline uint64_t hash(uint64_t value)
 	{
-		static_random_generator() : arr()
-		{
-			for (auto i = 0; i != N; ++i)
-				arr[i] = random::get<T>();
-		}
-
-		T get()
-		{
-			if (index >= N)
-				index = 0;
-			return arr[index++];
-		}
-
-		T arr[N];
-		int index = 0;
-	};
-
-	inline static_random_generator<8192, float> static_float;
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+		return value ^ (value >> 31);
+	}
 
 }
@@ -14,7 +14,7 @@ public:
 	ray(const point3& origin, const direction3& direction)
 		: origin(origin),
 		  direction(normalize(direction)),
-		  inv_direction(glm::one<vec3>() / direction)
+		  inv_direction(glm::one<vec3>() / this->direction)
 	{
 	}
 
@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include <cstdint>
+
+#include "ray.h"
+#include "simd.h"
+#include "vec3.h"
+
+/// <summary>
+/// group of coherent rays (e.g. the primary rays of a tile of pixels) intersected together (see world::hit)
+/// the rays are also stored as a structure of arrays, so that a box is tested against lane_count of them at once
+/// (bundles of 8 rays with AVX, of 4 rays otherwise: see float4 and float8)
+/// </summary>
+struct ray_packet
+{
+	// number of rays tested at once by a box test
+	static constexpr uint32_t lane_count = simd::lane_count;
+	// maximum number of rays of a packet (a tile of 4x4 pixels)
+	static constexpr uint32_t max_size = 16;
+	static constexpr uint32_t tile_size = 4;
+
+	void clear()
+	{
+		count = 0;
+	}
+
+	void add(const ray& r)
+	{
+		rays[count] = r;
+		origin_x[count] = r.origin.x;
+		origin_y[count] = r.origin.y;
+		origin_z[count] = r.origin.z;
+		inv_direction_x[count] = r.inv_direction.x;
+		inv_direction_y[count] = r.inv_direction.y;
+		inv_direction_z[count] = r.inv_direction.z;
+		count++;
+	}
+
+	/// <summary>
+	/// returns the mask of the rays of the packet (bit i for rays[i])
+	/// </summary>
+	[[nodiscard]] uint32_t mask() const
+	{
+		return (1u << count) - 1u;
+	}
+
+	ray rays[max_size];
+	alignas(32) float origin_x[max_size]{};
+	alignas(32) float origin_y[max_size]{};
+	alignas(32) float origin_z[max_size]{};
+	alignas(32) float inv_direction_x[max_size]{};
+	alignas(32) float inv_direction_y[max_size]{};
+	alignas(32) float inv_direction_z[max_size]{};
+	uint32_t count = 0;
+};
@@ -0,0 +1,322 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#include "blue_noise.h"
+#include "random.h"
+
+/// <summary>
+/// the way a sampler draws the numbers of the samples of a pixel
+/// </summary>
+enum class sampler_type
+{
+	// independent uniform random numbers
+	independent,
+	// for each pair of dimensions, the samples of a pixel fall in different cells of a grid of sample_count cells,
+	// and in different rows and columns of it (correlated multi-jittered sampling, see Kensler 2013)
+	stratified,
+	// the Sobol sequence with nested uniform (Owen) scrambling, in independent groups of 4 dimensions (see Burley 2020)
+	sobol,
+	// the same scrambled Sobol sequence for all the pixels, offset by a tile of blue noise: the samples of a pixel
+	// keep the distribution of the sequence, and the error of neighboring pixels is decorrelated into high frequencies
+	// (blue-noise dithered sampling, see Georgiev and Fajardo 2016)
+	blue_noise
+};
+
+namespace sobol
+{
+	/// <summary>
+	/// generator matrices of the first 4 dimensions of the Sobol sequence, as their 32 direction numbers
+	/// from the primitive polynomials and initial direction numbers of Joe and Kuo (2008)
+	/// the numbers of the 4 dimensions for a bit of the index are contiguous, so that they are applied together
+	/// </summary>
+	constexpr std::array<std::array<uint32_t, 4>, 32> generator_matrices()
+	{
+		constexpr uint32_t degrees[3] = {1, 2, 3};
+		constexpr uint32_t coefficients[3] = {0, 1, 1};
+		constexpr uint32_t initial_numbers[3][3] = {{1, 0, 0}, {1, 3, 0}, {1, 3, 1}};
+
+		std::array<std::array<uint32_t, 4>, 32> matrices{};
+		for (uint32_t bit = 0; bit < 32; bit++)
+		{
+			matrices[bit][0] = 1u << (31 - bit);
+		}
+		for (uint32_t d = 1; d < 4; d++)
+		{
+			const uint32_t degree = degrees[d - 1];
+			const uint32_t coefficient = coefficients[d - 1];
+			for (uint32_t bit = 0; bit < 32; bit++)
+			{
+				if (bit < degree)
+				{
+					matrices[bit][d] = initial_numbers[d - 1][bit] << (31 - bit);
+					continue;
+				}
+
+				uint32_t number = matrices[bit - degree][d] ^ (matrices[bit - degree][d] >> degree);
+				for (uint32_t k = 1; k < degree; k++)
+				{
+					if ((coefficient >> (degree - 1 - k)) & 1u)
+						number ^= matrices[bit - k][d];
+				}
+				matrices[bit][d] = number;
+			}
+		}
+		return matrices;
+	}
+
+	inline constexpr std::array<std::array<uint32_t, 4>, 32> matrices = generator_matrices();
+
+	/// <summary>
+	/// returns the first 4 dimensions of the point of the given index of the Sobol sequence, as 32-bit fixed-point numbers
+	/// </summary>
+	inline std::array<uint32_t, 4> sample(uint32_t index)
+	{
+		std::array<uint32_t, 4> values{};
+		for (uint32_t bit = 0; index != 0; bit++, index >>= 1)
+		{
+			// without a branch, the 4 dimensions are one vector operation
+			const uint32_t mask = 0u - (index & 1u);
+			for (uint32_t d = 0; d < 4; d++)
+				values[d] ^= matrices[bit][d] & mask;
+		}
+		return values;
+	}
+}
+
+/// <summary>
+/// numbers of a sample of a pixel, from 0 (included) to 1 (excluded).
+/// A number only depends on the pixel, the index of the sample and its dimension, so there is no shared state:
+/// each sample owns its sampler, threads never contend for a generator,
+/// and a render is the same whatever the number of threads and the order in which the pixels are processed.
+/// The dimensions are allocated by use: the first camera_dimensions ones to the camera ray,
+/// then bounce_dimensions ones to each bounce (see start_bounce and start_light), so that the same dimension always serves
+/// the same purpose in all the samples, which the low-discrepancy samplers rely on.
+/// The numbers drawn past the dimensions of their bounce are independent random numbers
+/// </summary>
+class sampler
+{
+public:
+	// the jitter of the pixel (2) and the point of the lens (2)
+	static constexpr uint32_t camera_dimensions = 4;
+	// the scattering off a material (up to 3, see metal_material)
+	static constexpr uint32_t scatter_dimensions = 4;
+	// the sampling of a light (the light and a point on it, see light_list::sample)
+	static constexpr uint32_t light_dimensions = 4;
+	static constexpr uint32_t bounce_dimensions = scatter_dimensions + light_dimensions;
+
+	/// <summary>
+	/// sampler of the given sample of the pixel (x, y)
+	/// sample_count is the number of samples per pixel the stratified sampler divides its grid for
+	/// </summary>
+	sampler(sampler_type type, uint32_t x, uint32_t y, uint32_t sample, uint32_t sample_count = 1)
+		: m_type(type), m_x(x), m_y(y), m_sample(sample), m_sample_count(sample_count > 0 ? sample_count : 1),
+		  m_pixel_seed(static_cast<uint32_t>(random::hash(static_cast<uint64_t>(x) << 32 | y))),
+		  m_key(random::hash(static_cast<uint64_t>(m_pixel_seed) << 32 | sample))
+	{
+	}
+
+	/// <summary>
+	/// returns the number of the next dimension
+	/// </summary>
+	float get()
+	{
+		const uint32_t dimension = m_dimension++;
+		if (dimension >= m_end_dimension)
+			return to_float(independent(dimension | 0x80000000u));
+
+		switch (m_type)
+		{
+		case sampler_type::stratified:
+			return stratified(dimension);
+		case sampler_type::sobol:
+			return to_float(scrambled_sobol(dimension, m_pixel_seed));
+		case sampler_type::blue_noise:
+			// the offset wraps around, as does the sum of the two fixed-point numbers
+			return to_float(scrambled_sobol(dimension, 0) + blue_noise::get(m_x, m_y, dimension));
+		default:
+			return to_float(independent(dimension));
+		}
+	}
+
+	/// <summary>
+	/// the next numbers are drawn from the dimensions of the given bounce (0 for the scattering off the first hit)
+	/// </summary>
+	void start_bounce(int bounce)
+	{
+		m_dimension = camera_dimensions + static_cast<uint32_t>(bounce) * bounce_dimensions;
+		m_end_dimension = m_dimension + scatter_dimensions;
+	}
+
+	/// <summary>
+	/// the next numbers are drawn from the dimensions of the light sampled at the given bounce
+	/// </summary>
+	void start_light(int bounce)
+	{
+		m_dimension = camera_dimensions + static_cast<uint32_t>(bounce) * bounce_dimensions + scatter_dimensions;
+		m_end_dimension = m_dimension + light_dimensions;
+	}
+
+	/// <summary>
+	/// returns the dimension of the next number
+	/// </summary>
+	[[nodiscard]] uint32_t dimension() const
+	{
+		return m_dimension;
+	}
+
+private:
+	[[nodiscard]] uint32_t independent(uint32_t dimension) const
+	{
+		return static_cast<uint32_t>(random::hash(m_key + dimension * 0x9E3779B97F4A7C15ull) >> 32);
+	}
+
+	/// <summary>
+	/// correlated multi-jittered sample of the pair of dimensions the given one belongs to:
+	/// the grid of sample_count cells is shuffled for each pair and each pixel, and a new grid is used
+	/// for each run of sample_count samples
+	/// </summary>
+	[[nodiscard]] float stratified(uint32_t dimension) const
+	{
+		const uint32_t count = m_sample_count;
+		const uint32_t pattern = hash(m_pixel_seed, (dimension / 2) ^ (m_sample / count) << 16);
+		const uint32_t sample = permute(m_sample % count, count, pattern * 0x51633e2du);
+		const auto columns = static_cast<uint32_t>(std::sqrt(static_cast<float>(count)));
+		const uint32_t rows = (count + columns - 1) / columns;
+		const uint32_t column = sample % columns;
+		const uint32_t row = sample / columns;
+		// the first dimension of the pair is the column of the cell, jittered by the row of its sample within the column
+		float value;
+		if (dimension % 2 == 0)
+		{
+			const uint32_t sub_row = permute(row, rows, pattern * 0x63d83595u);
+			const float jitter = to_float(hash(sample, pattern * 0xa399d265u));
+			value = (static_cast<float>(column) + (static_cast<float>(sub_row) + jitter) / static_cast<float>(rows))
+				/ static_cast<float>(columns);
+		}
+		else
+		{
+			const uint32_t sub_column = permute(column, columns, pattern * 0xa511e9b3u);
+			const float jitter = to_float(hash(sample, pattern * 0x711ad6a5u));
+			value = (static_cast<float>(row) + (static_cast<float>(sub_column) + jitter) / static_cast<float>(columns))
+				/ static_cast<float>(rows);
+		}
+		// the division may round up to 1
+		return std::min(value, 0.99999994f);
+	}
+
+	/// <summary>
+	/// scrambled Sobol number of the given dimension, as a 32-bit fixed-point number:
+	/// the dimensions are grouped by 4, each group being the first 4 dimensions of the Sobol sequence
+	/// with the index of the sample shuffled differently (padding), then each number is scrambled
+	/// shuffling and scrambling are nested uniform scramblings, which keep the stratification of the sequence
+	/// for any power of two of samples
+	/// the numbers of a group are computed together and kept until a number of another group is drawn
+	/// </summary>
+	uint32_t scrambled_sobol(uint32_t dimension, uint32_t seed)
+	{
+		const uint32_t group = dimension / 4;
+		if (group != m_sobol_group)
+		{
+			const uint32_t group_seed = hash(seed, group);
+			m_sobol_group = group;
+			m_sobol_numbers = sobol::sample(nested_uniform_scramble(m_sample, group_seed));
+			for (uint32_t d = 0; d < 4; d++)
+				m_sobol_numbers[d] = nested_uniform_scramble(m_sobol_numbers[d], hash(group_seed, d + 1));
+		}
+		return m_sobol_numbers[dimension % 4];
+	}
+
+	/// <summary>
+	/// random permutation of the binary tree of the bits of value, from the most significant one (Owen scrambling)
+	/// made of a hash of the reversed bits whose lower bits only depend on the lower bits (see Laine and Karras 2011)
+	/// </summary>
+	static uint32_t nested_uniform_scramble(uint32_t value, uint32_t seed)
+	{
+		value = reverse_bits(value);
+		value += seed;
+		value ^= value * 0x6c50b47cu;
+		value ^= value * 0xb82f1e52u;
+		value ^= value * 0xc7afe638u;
+		value ^= value * 0x8d22f6e6u;
+		return reverse_bits(value);
+	}
+
+	static uint32_t reverse_bits(uint32_t value)
+	{
+		value = (value << 16) | (value >> 16);
+		value = ((value & 0x00ff00ffu) << 8) | ((value & 0xff00ff00u) >> 8);
+		value = ((value & 0x0f0f0f0fu) << 4) | ((value & 0xf0f0f0f0u) >> 4);
+		value = ((value & 0x33333333u) << 2) | ((value & 0xccccccccu) >> 2);
+		return ((value & 0x55555555u) << 1) | ((value & 0xaaaaaaaau) >> 1);
+	}
+
+	/// <summary>
+	/// returns the image of index by a random permutation of [0, count) selected by seed (see Kensler 2013)
+	/// </summary>
+	static uint32_t permute(uint32_t index, uint32_t count, uint32_t seed)
+	{
+		uint32_t mask = count - 1;
+		mask |= mask >> 1;
+		mask |= mask >> 2;
+		mask |= mask >> 4;
+		mask |= mask >> 8;
+		mask |= mask >> 16;
+		// the permutation of the next power of two is applied again until the index falls in [0, count)
+		do
+		{
+			index ^= seed;
+			index *= 0xe170893du;
+			index ^= seed >> 16;
+			index ^= (index & mask) >> 4;
+			index ^= seed >> 8;
+			index *= 0x0929eb3fu;
+			index ^= seed >> 23;
+			index ^= (index & mask) >> 1;
+			index *= 1u | seed >> 27;
+			index *= 0x6935fa69u;
+			index ^= (index & mask) >> 11;
+			index *= 0x74dcb303u;
+			index ^= (index & mask) >> 2;
+			index *= 0x9e501cc3u;
+			index ^= (index & mask) >> 2;
+			index *= 0xc860a3dfu;
+			index &= mask;
+			index ^= index >> 5;
+		}
+		while (index >= count);
+		return (index + seed) % count;
+	}
+
+	static uint32_t hash(uint32_t value, uint32_t seed)
+	{
+		return static_cast<uint32_t>(random::hash(static_cast<uint64_t>(seed) << 32 | value) >> 32);
+	}
+
+	/// <summary>
+	/// returns the 32-bit fixed-point number as a float (its 24 highest bits fill the mantissa)
+	/// </summary>
+	static float to_float(uint32_t value)
+	{
+		return static_cast<float>(value >> 8) * (1.0f / 16777216.0f);
+	}
+
+	sampler_type m_type;
+	uint32_t m_x;
+	uint32_t m_y;
+	uint32_t m_sample;
+	uint32_t m_sample_count;
+	// hash of the pixel, seeding its scrambling and its shuffling of the strata
+	uint32_t m_pixel_seed;
+	// hash of the pixel and the sample, the key of its independent numbers
+	uint64_t m_key;
+	uint32_t m_dimension = 0;
+	// the dimensions from m_end_dimension on are past the dimensions allocated to the current bounce
+	uint32_t m_end_dimension = camera_dimensions;
+	// the group of 4 dimensions whose scrambled Sobol numbers were computed last (see scrambled_sobol)
+	uint32_t m_sobol_group = ~0u;
+	std::array<uint32_t, 4> m_sobol_numbers{};
+};
@@ -0,0 +1,289 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "sampler.h"
+#include "simd.h"
+#include "utility.h"
+#include "vec3.h"
+
+/// <summary>
+/// mappings of uniform numbers (from 0 to 1) to directions and points, without inverse trigonometry:
+/// the angles of the concentric mapping stay within [-pi/4, pi/4], where short polynomials give their sine and cosine,
+/// and the other mappings are built on it.
+/// The kernels are written once for float and for the SIMD vectors (float4, float8): the batch versions
+/// map arrays of numbers simd::lane_count at a time
+/// </summary>
+namespace sampling
+{
+	// scalar version of the select of the SIMD vectors, so that the kernels compile for float
+	inline float select(bool mask, float a, float b)
+	{
+		return mask ? a : b;
+	}
+
+	/// <summary>
+	/// sine of an angle from -pi/4 to pi/4 (Taylor polynomial: the error is below 4e-7)
+	/// </summary>
+	template <typename T>
+	T sin_quarter(const T& angle)
+	{
+		const T square = angle * angle;
+		return angle * (T(1.0f) + square * (T(-1.0f / 6.0f) + square * (T(1.0f / 120.0f) + square * T(-1.0f / 5040.0f))));
+	}
+
+	/// <summary>
+	/// cosine of an angle from -pi/4 to pi/4 (Taylor polynomial: the error is below 3e-8)
+	/// </summary>
+	template <typename T>
+	T cos_quarter(const T& angle)
+	{
+		const T square = angle * angle;
+		return T(1.0f) + square * (T(-0.5f) + square * (T(1.0f / 24.0f) + square * (T(-1.0f / 720.0f)
+			+ square * T(1.0f / 40320.0f))));
+	}
+
+	/// <summary>
+	/// map the square [0, 1]^2 to the unit disk, preserving areas and keeping adjacent points adjacent
+	/// (concentric mapping, see Shirley and Chiu 1997)
+	/// </summary>
+	template <typename T>
+	void concentric_disk(const T& u1, const T& u2, T& x, T& y)
+	{
+		using std::abs;
+		const T a = T(2.0f) * u1 - T(1.0f);
+		const T b = T(2.0f) * u2 - T(1.0f);
+		// the diagonals split the square in 4 triangles: the coordinate along the axis of the triangle of the point
+		// is its radius, the other one its angle from the axis (from -pi/4 to pi/4)
+		const auto is_horizontal = abs(b) <= abs(a);
+		const T radius = select(is_horizontal, a, b);
+		const T other = select(is_horizontal, b, a);
+		// the center has no angle (the radius is 0 only if both coordinates are)
+		const T angle = T(constants::pi / 4.0f) * other / select(T(0.0f) < abs(radius), radius, T(1.0f));
+		const T cos_angle = cos_quarter(angle);
+		const T sin_angle = sin_quarter(angle);
+		x = radius * select(is_horizontal, cos_angle, sin_angle);
+		y = radius * select(is_horizontal, sin_angle, cos_angle);
+	}
+
+	/// <summary>
+	/// map the square [0, 1]^2 to a direction of the hemisphere around z, with a density proportional to its cosine
+	/// with z (the distribution of the light scattered by a lambertian surface): the point of the disk is projected
+	/// up onto the hemisphere (Malley's method)
+	/// </summary>
+	template <typename T>
+	void cosine_hemisphere(const T& u1, const T& u2, T& x, T& y, T& z)
+	{
+		using std::max;
+		using std::sqrt;
+		concentric_disk(u1, u2, x, y);
+		z = sqrt(max(T(1.0f) - x * x - y * y, T(0.0f)));
+	}
+
+	/// <summary>
+	/// map the square [0, 1]^2 to a direction of the unit sphere, uniformly
+	/// the disk is mapped to the sphere preserving areas: the disk of radius r to the cap of height 2r^2 around z
+	/// </summary>
+	template <typename T>
+	void uniform_sphere(const T& u1, const T& u2, T& x, T& y, T& z)
+	{
+		using std::max;
+		using std::sqrt;
+		concentric_disk(u1, u2, x, y);
+		const T square_radius = x * x + y * y;
+		const T scale = T(2.0f) * sqrt(max(T(1.0f) - square_radius, T(0.0f)));
+		x = x * scale;
+		y = y * scale;
+		z = T(1.0f) - T(2.0f) * square_radius;
+	}
+
+	inline vec2 concentric_disk(float u1, float u2)
+	{
+		vec2 point;
+		concentric_disk(u1, u2, point.x, point.y);
+		return point;
+	}
+
+	inline direction3 cosine_hemisphere(float u1, float u2)
+	{
+		direction3 direction;
+		cosine_hemisphere(u1, u2, direction.x, direction.y, direction.z);
+		return direction;
+	}
+
+	inline direction3 uniform_sphere(float u1, float u2)
+	{
+		direction3 direction;
+		uniform_sphere(u1, u2, direction.x, direction.y, direction.z);
+		return direction;
+	}
+
+	/// <summary>
+	/// map the square [0, 1]^2 to a direction of the cone around z whose cosine of the half angle is 1 - height,
+	/// uniformly (as uniform_sphere, on the cap of the given height instead of the whole sphere)
+	/// the height is given rather than the cosine so that it keeps its precision for narrow cones
+	/// </summary>
+	inline direction3 uniform_cone(float u1, float u2, float height)
+	{
+		direction3 direction;
+		concentric_disk(u1, u2, direction.x, direction.y);
+		const float cap_height = (direction.x * direction.x + direction.y * direction.y) * height;
+		const float scale = std::sqrt(std::max(height * (2.0f - cap_height), 0.0f));
+		direction.x *= scale;
+		direction.y *= scale;
+		direction.z = 1.0f - cap_height;
+		return direction;
+	}
+
+	/// <summary>
+	/// map the cube [0, 1]^3 to a point of the unit ball, uniformly
+	/// </summary>
+	inline vec3 uniform_ball(float u1, float u2, float u3)
+	{
+		return uniform_sphere(u1, u2) * std::cbrt(u3);
+	}
+
+	// the same mappings, drawing their numbers from a sampler (one after the other, in the order of the arguments)
+
+	inline vec2 concentric_disk(sampler& rng)
+	{
+		const float u1 = rng.get();
+		const float u2 = rng.get();
+		return concentric_disk(u1, u2);
+	}
+
+	inline direction3 cosine_hemisphere(sampler& rng)
+	{
+		const float u1 = rng.get();
+		const float u2 = rng.get();
+		return cosine_hemisphere(u1, u2);
+	}
+
+	inline vec3 uniform_ball(sampler& rng)
+	{
+		const float u1 = rng.get();
+		const float u2 = rng.get();
+		const float u3 = rng.get();
+		return uniform_ball(u1, u2, u3);
+	}
+
+	/// <summary>
+	/// weight of a sample drawn with the density pdf when the same value is also sampled by a second strategy,
+	/// with the density other_pdf (multiple importance sampling, see Veach 1997): the balance heuristic, pdf > 0
+	/// </summary>
+	inline float balance_heuristic(float pdf, float other_pdf)
+	{
+		return 1.0f / (1.0f + other_pdf / pdf);
+	}
+
+	/// <summary>
+	/// same as balance_heuristic with the squares of the densities (the power heuristic): the weights favour
+	/// the strategy with the higher density further, which removes more of the noise of the peaked densities
+	/// </summary>
+	inline float power_heuristic(float pdf, float other_pdf)
+	{
+		const float ratio = other_pdf / pdf;
+		return 1.0f / (1.0f + ratio * ratio);
+	}
+
+	/// <summary>
+	/// orthonormal basis around a unit normal (the z axis of the local directions), built without branches
+	/// and continuous everywhere but at -z (see Duff et al. 2017)
+	/// </summary>
+	struct frame
+	{
+		explicit frame(const direction3& normal)
+			: normal(normal)
+		{
+			const float sign = std::copysign(1.0f, normal.z);
+			const float a = -1.0f / (sign + normal.z);
+			const float b = normal.x * normal.y * a;
+			tangent = direction3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+			bitangent = direction3(b, sign + normal.y * normal.y * a, -normal.y);
+		}
+
+		[[nodiscard]] direction3 to_world(const direction3& local) const
+		{
+			return tangent * local.x + bitangent * local.y + normal * local.z;
+		}
+
+		direction3 tangent;
+		direction3 bitangent;
+		direction3 normal;
+	};
+
+	/// <summary>
+	/// run the kernel of a direction on the count pairs of numbers of u1 and u2, simd::lane_count at a time,
+	/// then one at a time for the remaining ones: the kernel writes the coordinates of the directions to x, y and z
+	/// </summary>
+	template <typename Kernel>
+	void for_each_batch(const float* u1, const float* u2, size_t count, float* x, float* y, float* z,
+	                    const Kernel& kernel)
+	{
+		using vector = simd_float<simd::lane_count>;
+		size_t i = 0;
+		for (; i + simd::lane_count <= count; i += simd::lane_count)
+		{
+			vector vector_x, vector_y, vector_z;
+			kernel(vector::load_unaligned(u1 + i), vector::load_unaligned(u2 + i), vector_x, vector_y, vector_z);
+			vector_x.store_unaligned(x + i);
+			vector_y.store_unaligned(y + i);
+			vector_z.store_unaligned(z + i);
+		}
+		for (; i < count; i++)
+		{
+			kernel(u1[i], u2[i], x[i], y[i], z[i]);
+		}
+	}
+
+	// batch versions of the mappings, for arrays of numbers
+
+	inline void concentric_disk(const float* u1, const float* u2, size_t count, float* x, float* y)
+	{
+		using vector = simd_float<simd::lane_count>;
+		size_t i = 0;
+		for (; i + simd::lane_count <= count; i += simd::lane_count)
+		{
+			vector vector_x, vector_y;
+			concentric_disk(vector::load_unaligned(u1 + i), vector::load_unaligned(u2 + i), vector_x, vector_y);
+			vector_x.store_unaligned(x + i);
+			vector_y.store_unaligned(y + i);
+		}
+		for (; i < count; i++)
+		{
+			concentric_disk(u1[i], u2[i], x[i], y[i]);
+		}
+	}
+
+	inline void cosine_hemisphere(const float* u1, const float* u2, size_t count, float* x, float* y, float* z)
+	{
+		for_each_batch(u1, u2, count, x, y, z, [](const auto& a, const auto& b, auto& out_x, auto& out_y, auto& out_z)
+		{
+			cosine_hemisphere(a, b, out_x, out_y, out_z);
+		});
+	}
+
+	inline void uniform_sphere(const float* u1, const float* u2, size_t count, float* x, float* y, float* z)
+	{
+		for_each_batch(u1, u2, count, x, y, z, [](const auto& a, const auto& b, auto& out_x, auto& out_y, auto& out_z)
+		{
+			uniform_sphere(a, b, out_x, out_y, out_z);
+		});
+	}
+
+	inline void uniform_ball(const float* u1, const float* u2, const float* u3, size_t count, float* x, float* y,
+	                         float* z)
+	{
+		uniform_sphere(u1, u2, count, x, y, z);
+		// the cube root has no SIMD version: the radii are applied one at a time
+		for (size_t i = 0; i < count; i++)
+		{
+			const float radius = std::cbrt(u3[i]);
+			x[i] *= radius;
+			y[i] *= radius;
+			z[i] *= radius;
+		}
+	}
+}
@@ -0,0 +1,490 @@
+﻿#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "vec3.h"
+
+// SSE is always available on x64, AVX is enabled by /arch:AVX2 (see the project settings)
+// defining RTRACER_SCALAR_SIMD compiles the scalar fallback instead (e.g. to compare the kernels or to port them)
+#if !defined(RTRACER_SCALAR_SIMD) && (defined(_M_X64) || defined(__SSE2__))
+#define RTRACER_SSE 1
+#if defined(__AVX__)
+#define RTRACER_AVX 1
+#endif
+#endif
+
+#ifdef RTRACER_SSE
+#include <immintrin.h>
+#endif
+
+/// <summary>
+/// aligned vector of 4 floats, used by the hot kernels instead of glm (box and primitive tests, pixel resolve...):
+/// each kernel is written once with these operators, which map to SSE instructions (or to a scalar loop without SSE).
+/// comparisons return masks (all the bits of a lane are set if the comparison is true), used by select and movemask.
+/// min and max return b for the lanes where a or b is NaN, as the SSE instructions: the order of the operands matters
+/// </summary>
+struct alignas(16) float4
+{
+	static constexpr int width = 4;
+
+	float4() = default;
+
+	explicit float4(float value)
+	{
+#ifdef RTRACER_SSE
+		m_value = _mm_set1_ps(value);
+#else
+		for (float& lane : m_value)
+			lane = value;
+#endif
+	}
+
+	float4(float x, float y, float z, float w)
+	{
+#ifdef RTRACER_SSE
+		m_value = _mm_setr_ps(x, y, z, w);
+#else
+		m_value[0] = x;
+		m_value[1] = y;
+		m_value[2] = z;
+		m_value[3] = w;
+#endif
+	}
+
+	/// <summary>
+	/// load 4 floats from an address aligned on 16 bytes
+	/// </summary>
+	static float4 load(const float* values)
+	{
+#ifdef RTRACER_SSE
+		return float4(_mm_load_ps(values));
+#else
+		return load_unaligned(values);
+#endif
+	}
+
+	static float4 load_unaligned(const float* values)
+	{
+#ifdef RTRACER_SSE
+		return float4(_mm_loadu_ps(values));
+#else
+		float4 result;
+		std::memcpy(result.m_value, values, sizeof(result.m_value));
+		return result;
+#endif
+	}
+
+	/// <summary>
+	/// load 4 bytes, each one converted to a float (e.g. quantized coordinates)
+	/// </summary>
+	static float4 load_bytes(const uint8_t* values)
+	{
+#ifdef RTRACER_SSE
+		int32_t packed;
+		std::memcpy(&packed, values, sizeof(packed));
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i bytes = _mm_cvtsi32_si128(packed);
+		return float4(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero)));
+#else
+		return float4(values[0], values[1], values[2], values[3]);
+#endif
+	}
+
+	/// <summary>
+	/// returns (x, y, z, z): the last lane repeats z so that horizontal_min and horizontal_max can use all the lanes
+	/// </summary>
+	static float4 from_vec3(const vec3& v)
+	{
+		return float4(v.x, v.y, v.z, v.z);
+	}
+
+	/// <summary>
+	/// returns the mask of the lanes whose bit is set in bits (bit i for lane i)
+	/// </summary>
+	static float4 lanes(uint32_t bits)
+	{
+#ifdef RTRACER_SSE
+		return float4(_mm_castsi128_ps(_mm_cmpgt_epi32(
+			_mm_and_si128(_mm_set1_epi32(static_cast<int>(bits)), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128())));
+#else
+		float4 result;
+		for (int i = 0; i < width; i++)
+			result.m_value[i] = from_bits((bits >> i) & 1u ? ~0u : 0u);
+		return result;
+#endif
+	}
+
+	/// <summary>
+	/// store the 4 floats to an address aligned on 16 bytes
+	/// </summary>
+	void store(float* values) const
+	{
+#ifdef RTRACER_SSE
+		_mm_store_ps(values, m_value);
+#else
+		std::memcpy(values, m_value, sizeof(m_value));
+#endif
+	}
+
+	void store_unaligned(float* values) const
+	{
+#ifdef RTRACER_SSE
+		_mm_storeu_ps(values, m_value);
+#else
+		std::memcpy(values, m_value, sizeof(m_value));
+#endif
+	}
+
+	[[nodiscard]] vec3 to_vec3() const
+	{
+		alignas(16) float values[width];
+		store(values);
+		return vec3(values[0], values[1], values[2]);
+	}
+
+	/// <summary>
+	/// returns the bits of the sign of the lanes (bit i for lane i), i.e. the lanes set in a mask
+	/// </summary>
+	[[nodiscard]] int movemask() const
+	{
+#ifdef RTRACER_SSE
+		return _mm_movemask_ps(m_value);
+#else
+		int mask = 0;
+		for (int i = 0; i < width; i++)
+			mask |= static_cast<int>(to_bits(m_value[i]) >> 31) << i;
+		return mask;
+#endif
+	}
+
+	[[nodiscard]] float horizontal_min() const
+	{
+#ifdef RTRACER_SSE
+		const __m128 pairs = _mm_min_ps(m_value, _mm_shuffle_ps(m_value, m_value, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(_mm_min_ps(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(2, 3, 0, 1))));
+#else
+		const float low = m_value[0] < m_value[1] ? m_value[0] : m_value[1];
+		const float high = m_value[2] < m_value[3] ? m_value[2] : m_value[3];
+		return low < high ? low : high;
+#endif
+	}
+
+	[[nodiscard]] float horizontal_max() const
+	{
+#ifdef RTRACER_SSE
+		const __m128 pairs = _mm_max_ps(m_value, _mm_shuffle_ps(m_value, m_value, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(_mm_max_ps(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(2, 3, 0, 1))));
+#else
+		const float low = m_value[0] > m_value[1] ? m_value[0] : m_value[1];
+		const float high = m_value[2] > m_value[3] ? m_value[2] : m_value[3];
+		return low > high ? low : high;
+#endif
+	}
+
+	[[nodiscard]] float operator[](int i) const
+	{
+		alignas(16) float values[width];
+		store(values);
+		return values[i];
+	}
+
+#ifdef RTRACER_SSE
+	friend float4 operator+(const float4& a, const float4& b) { return float4(_mm_add_ps(a.m_value, b.m_value)); }
+	friend float4 operator-(const float4& a, const float4& b) { return float4(_mm_sub_ps(a.m_value, b.m_value)); }
+	friend float4 operator*(const float4& a, const float4& b) { return float4(_mm_mul_ps(a.m_value, b.m_value)); }
+	friend float4 operator/(const float4& a, const float4& b) { return float4(_mm_div_ps(a.m_value, b.m_value)); }
+	friend float4 operator<(const float4& a, const float4& b) { return float4(_mm_cmplt_ps(a.m_value, b.m_value)); }
+	friend float4 operator<=(const float4& a, const float4& b) { return float4(_mm_cmple_ps(a.m_value, b.m_value)); }
+	friend float4 operator>=(const float4& a, const float4& b) { return float4(_mm_cmpge_ps(a.m_value, b.m_value)); }
+	friend float4 operator&(const float4& a, const float4& b) { return float4(_mm_and_ps(a.m_value, b.m_value)); }
+	friend float4 operator|(const float4& a, const float4& b) { return float4(_mm_or_ps(a.m_value, b.m_value)); }
+	friend float4 min(const float4& a, const float4& b) { return float4(_mm_min_ps(a.m_value, b.m_value)); }
+	friend float4 max(const float4& a, const float4& b) { return float4(_mm_max_ps(a.m_value, b.m_value)); }
+	friend float4 sqrt(const float4& a) { return float4(_mm_sqrt_ps(a.m_value)); }
+	friend float4 abs(const float4& a) { return float4(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.m_value)); }
+
+	/// <summary>
+	/// returns a for the lanes set in mask, b for the others
+	/// </summary>
+	friend float4 select(const float4& mask, const float4& a, const float4& b)
+	{
+		return float4(_mm_or_ps(_mm_and_ps(mask.m_value, a.m_value), _mm_andnot_ps(mask.m_value, b.m_value)));
+	}
+#else
+	friend float4 operator+(const float4& a, const float4& b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+	friend float4 operator-(const float4& a, const float4& b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+	friend float4 operator*(const float4& a, const float4& b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+	friend float4 operator/(const float4& a, const float4& b) { return apply(a, b, [](float x, float y) { return x / y; }); }
+	friend float4 operator<(const float4& a, const float4& b) { return compare(a, b, [](float x, float y) { return x < y; }); }
+	friend float4 operator<=(const float4& a, const float4& b) { return compare(a, b, [](float x, float y) { return x <= y; }); }
+	friend float4 operator>=(const float4& a, const float4& b) { return compare(a, b, [](float x, float y) { return x >= y; }); }
+	friend float4 operator&(const float4& a, const float4& b) { return apply_bits(a, b, [](uint32_t x, uint32_t y) { return x & y; }); }
+	friend float4 operator|(const float4& a, const float4& b) { return apply_bits(a, b, [](uint32_t x, uint32_t y) { return x | y; }); }
+	friend float4 min(const float4& a, const float4& b) { return apply(a, b, [](float x, float y) { return x < y ? x : y; }); }
+	friend float4 max(const float4& a, const float4& b) { return apply(a, b, [](float x, float y) { return x > y ? x : y; }); }
+	friend float4 sqrt(const float4& a) { return apply(a, a, [](float x, float) { return std::sqrt(x); }); }
+	friend float4 abs(const float4& a) { return apply(a, a, [](float x, float) { return std::abs(x); }); }
+
+	friend float4 select(const float4& mask, const float4& a, const float4& b)
+	{
+		float4 result;
+		for (int i = 0; i < width; i++)
+			result.m_value[i] = to_bits(mask.m_value[i]) >> 31 ? a.m_value[i] : b.m_value[i];
+		return result;
+	}
+#endif
+
+private:
+#ifdef RTRACER_SSE
+	explicit float4(__m128 value) : m_value(value)
+	{
+	}
+
+	friend struct float8;
+
+	__m128 m_value;
+#else
+	static uint32_t to_bits(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	static float from_bits(uint32_t bits)
+	{
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	template <typename Operation>
+	static float4 apply(const float4& a, const float4& b, const Operation& operation)
+	{
+		float4 result;
+		for (int i = 0; i < width; i++)
+			result.m_value[i] = operation(a.m_value[i], b.m_value[i]);
+		return result;
+	}
+
+	template <typename Comparison>
+	static float4 compare(const float4& a, const float4& b, const Comparison& comparison)
+	{
+		float4 result;
+		for (int i = 0; i < width; i++)
+			result.m_value[i] = from_bits(comparison(a.m_value[i], b.m_value[i]) ? ~0u : 0u);
+		return result;
+	}
+
+	template <typename Operation>
+	static float4 apply_bits(const float4& a, const float4& b, const Operation& operation)
+	{
+		float4 result;
+		for (int i = 0; i < width; i++)
+			result.m_value[i] = from_bits(operation(to_bits(a.m_value[i]), to_bits(b.m_value[i])));
+		return result;
+	}
+
+	float m_value[width];
+#endif
+};
+
+/// <summary>
+/// aligned vector of 8 floats with the same interface as float4 (AVX instructions, or a pair of float4 without AVX)
+/// used for 8-wide bundles: 8 rays of a packet, or the 8 children of a wide bvh node
+/// </summary>
+struct alignas(32) float8
+{
+	static constexpr int width = 8;
+
+	float8() = default;
+
+	explicit float8(float value)
+	{
+#ifdef RTRACER_AVX
+		m_value = _mm256_set1_ps(value);
+#else
+		m_low = float4(value);
+		m_high = float4(value);
+#endif
+	}
+
+	/// <summary>
+	/// returns the vector made of the lanes of low (lanes 0 to 3) then of high (lanes 4 to 7)
+	/// </summary>
+	static float8 combine(const float4& low, const float4& high)
+	{
+#ifdef RTRACER_AVX
+		return float8(_mm256_insertf128_ps(_mm256_castps128_ps256(low.m_value), high.m_value, 1));
+#else
+		return float8(low, high);
+#endif
+	}
+
+	/// <summary>
+	/// load 8 floats from an address aligned on 32 bytes
+	/// </summary>
+	static float8 load(const float* values)
+	{
+#ifdef RTRACER_AVX
+		return float8(_mm256_load_ps(values));
+#else
+		return float8(float4::load(values), float4::load(values + 4));
+#endif
+	}
+
+	static float8 load_unaligned(const float* values)
+	{
+#ifdef RTRACER_AVX
+		return float8(_mm256_loadu_ps(values));
+#else
+		return float8(float4::load_unaligned(values), float4::load_unaligned(values + 4));
+#endif
+	}
+
+	static float8 lanes(uint32_t bits)
+	{
+		return combine(float4::lanes(bits), float4::lanes(bits >> 4));
+	}
+
+	void store(float* values) const
+	{
+#ifdef RTRACER_AVX
+		_mm256_store_ps(values, m_value);
+#else
+		m_low.store(values);
+		m_high.store(values + 4);
+#endif
+	}
+
+	void store_unaligned(float* values) const
+	{
+#ifdef RTRACER_AVX
+		_mm256_storeu_ps(values, m_value);
+#else
+		m_low.store_unaligned(values);
+		m_high.store_unaligned(values + 4);
+#endif
+	}
+
+	[[nodiscard]] float4 low() const
+	{
+#ifdef RTRACER_AVX
+		return float4(_mm256_castps256_ps128(m_value));
+#else
+		return m_low;
+#endif
+	}
+
+	[[nodiscard]] float4 high() const
+	{
+#ifdef RTRACER_AVX
+		return float4(_mm256_extractf128_ps(m_value, 1));
+#else
+		return m_high;
+#endif
+	}
+
+	[[nodiscard]] int movemask() const
+	{
+#ifdef RTRACER_AVX
+		return _mm256_movemask_ps(m_value);
+#else
+		return m_low.movemask() | m_high.movemask() << 4;
+#endif
+	}
+
+	[[nodiscard]] float horizontal_min() const
+	{
+		const float low_min = low().horizontal_min();
+		const float high_min = high().horizontal_min();
+		return low_min < high_min ? low_min : high_min;
+	}
+
+	[[nodiscard]] float horizontal_max() const
+	{
+		const float low_max = low().horizontal_max();
+		const float high_max = high().horizontal_max();
+		return low_max > high_max ? low_max : high_max;
+	}
+
+	[[nodiscard]] float operator[](int i) const
+	{
+		return i < 4 ? low()[i] : high()[i - 4];
+	}
+
+#ifdef RTRACER_AVX
+	friend float8 operator+(const float8& a, const float8& b) { return float8(_mm256_add_ps(a.m_value, b.m_value)); }
+	friend float8 operator-(const float8& a, const float8& b) { return float8(_mm256_sub_ps(a.m_value, b.m_value)); }
+	friend float8 operator*(const float8& a, const float8& b) { return float8(_mm256_mul_ps(a.m_value, b.m_value)); }
+	friend float8 operator/(const float8& a, const float8& b) { return float8(_mm256_div_ps(a.m_value, b.m_value)); }
+	friend float8 operator<(const float8& a, const float8& b) { return float8(_mm256_cmp_ps(a.m_value, b.m_value, _CMP_LT_OQ)); }
+	friend float8 operator<=(const float8& a, const float8& b) { return float8(_mm256_cmp_ps(a.m_value, b.m_value, _CMP_LE_OQ)); }
+	friend float8 operator>=(const float8& a, const float8& b) { return float8(_mm256_cmp_ps(a.m_value, b.m_value, _CMP_GE_OQ)); }
+	friend float8 operator&(const float8& a, const float8& b) { return float8(_mm256_and_ps(a.m_value, b.m_value)); }
+	friend float8 operator|(const float8& a, const float8& b) { return float8(_mm256_or_ps(a.m_value, b.m_value)); }
+	friend float8 min(const float8& a, const float8& b) { return float8(_mm256_min_ps(a.m_value, b.m_value)); }
+	friend float8 max(const float8& a, const float8& b) { return float8(_mm256_max_ps(a.m_value, b.m_value)); }
+	friend float8 sqrt(const float8& a) { return float8(_mm256_sqrt_ps(a.m_value)); }
+	friend float8 abs(const float8& a) { return float8(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.m_value)); }
+
+	friend float8 select(const float8& mask, const float8& a, const float8& b)
+	{
+		return float8(_mm256_blendv_ps(b.m_value, a.m_value, mask.m_value));
+	}
+#else
+	friend float8 operator+(const float8& a, const float8& b) { return float8(a.m_low + b.m_low, a.m_high + b.m_high); }
+	friend float8 operator-(const float8& a, const float8& b) { return float8(a.m_low - b.m_low, a.m_high - b.m_high); }
+	friend float8 operator*(const float8& a, const float8& b) { return float8(a.m_low * b.m_low, a.m_high * b.m_high); }
+	friend float8 operator/(const float8& a, const float8& b) { return float8(a.m_low / b.m_low, a.m_high / b.m_high); }
+	friend float8 operator<(const float8& a, const float8& b) { return float8(a.m_low < b.m_low, a.m_high < b.m_high); }
+	friend float8 operator<=(const float8& a, const float8& b) { return float8(a.m_low <= b.m_low, a.m_high <= b.m_high); }
+	friend float8 operator>=(const float8& a, const float8& b) { return float8(a.m_low >= b.m_low, a.m_high >= b.m_high); }
+	friend float8 operator&(const float8& a, const float8& b) { return float8(a.m_low & b.m_low, a.m_high & b.m_high); }
+	friend float8 operator|(const float8& a, const float8& b) { return float8(a.m_low | b.m_low, a.m_high | b.m_high); }
+	friend float8 min(const float8& a, const float8& b) { return float8(min(a.m_low, b.m_low), min(a.m_high, b.m_high)); }
+	friend float8 max(const float8& a, const float8& b) { return float8(max(a.m_low, b.m_low), max(a.m_high, b.m_high)); }
+	friend float8 sqrt(const float8& a) { return float8(sqrt(a.m_low), sqrt(a.m_high)); }
+	friend float8 abs(const float8& a) { return float8(abs(a.m_low), abs(a.m_high)); }
+
+	friend float8 select(const float8& mask, const float8& a, const float8& b)
+	{
+		return float8(select(mask.m_low, a.m_low, b.m_low), select(mask.m_high, a.m_high, b.m_high));
+	}
+#endif
+
+private:
+#ifdef RTRACER_AVX
+	explicit float8(__m256 value) : m_value(value)
+	{
+	}
+
+	__m256 m_value;
+#else
+	float8(const float4& low, const float4& high) : m_low(low), m_high(high)
+	{
+	}
+
+	float4 m_low;
+	float4 m_high;
+#endif
+};
+
+/// <summary>
+/// vector of Width floats (4 or 8), for the kernels written for both widths (e.g. wide_bvh)
+/// </summary>
+template <int Width>
+using simd_float = std::conditional_t<Width == 8, float8, float4>;
+
+namespace simd
+{
+	// number of lanes of the widest vector supported by the target (used for the bundles of rays of a packet)
+#ifdef RTRACER_AVX
+	constexpr uint32_t lane_count = 8;
+#else
+	constexpr uint32_t lane_count = 4;
+#endif
+}
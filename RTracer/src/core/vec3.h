@@ -49,12 +49,6 @@ namespace vector3
 {
 	// transform the given point by the given matrix and return the result
 	glm::vec3 multiply_point_fast(const glm::vec3& v, const glm::mat4& m);
-	// return a random vec3 contained in a sphere placed at the origin and of a radius of 1
-	vec3 random_in_unit_sphere(float sphere_angle = 2 * constants::pi);
-	// return a random vec3 contained in a disk placed at the origin and of a radius of 1
-	vec3 random_in_unit_disk();
-	// return a random vec3 contained in a hemisphere placed at the origin and of a radius of 1
-	vec3 random_in_hemisphere(const vec3& normal);
 	
 	inline vec3 zero() { return vec3(0.0f, 0.0f, 0.0f); }
 	inline vec3 up() { return vec3(0.0f, 1.0f, 0.0f); }
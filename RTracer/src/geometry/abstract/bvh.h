@@ -1,147 +1,941 @@
 ﻿#pragma once
 
-#include <functional>
-#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "core/aabb.h"
-#include "core/random.h"
+#include "core/ray_packet.h"
 
 #include "hittable.h"
+#include "primitive_batch.h"
 
-inline bool box_compare(const hittable* a, const hittable* b, int axis)
+/// <summary>
+/// node of the flattened bounding volume hierarchy (see bvh)
+/// It is 32 bytes wide so that two nodes (e.g. two siblings) fit in a single cache line
+/// </summary>
+struct alignas(32) bvh_node
 {
-	return a->bbox.minimum[axis] < b->bbox.maximum[axis] && a->bbox.minimum[axis] < b->bbox.minimum[axis];
-}
+	aabb bbox;
+	// inner node: index of the left child (the right child is always stored right after it)
+	// leaf: index of the first primitive in bvh::primitives
+	uint32_t offset = 0;
+	// number of primitives of the leaf (0 for inner nodes)
+	uint16_t count = 0;
+	// leaf: kind and number of the primitives at the start of the leaf that are intersected as a batch
+	// (see primitive_batches)
+	batch_kind batch = batch_kind::none;
+	uint8_t batch_count = 0;
 
-bool box_x_compare(const hittable* a, const hittable* b) { return box_compare(a, b, 0); }
-bool box_y_compare(const hittable* a, const hittable* b) { return box_compare(a, b, 1); }
-bool box_z_compare(const hittable* a, const hittable* b) { return box_compare(a, b, 2); }
+	[[nodiscard]] bool is_leaf() const
+	{
+		return count > 0;
+	}
+};
+
+static_assert(sizeof(bvh_node) == 32, "bvh_node is expected to be 32 bytes wide");
 
-class bvh_empty_leaf : public hittable
+/// <summary>
+/// model of a set-associative cache with least recently used replacement (32 KB, as a typical L1 data cache)
+/// used to compare the memory layouts of hierarchies without relying on hardware counters
+/// </summary>
+class cache_model
 {
-protected:
-	void internal_update() override
+public:
+	static constexpr size_t line_size = 64;
+	static constexpr size_t set_count = 64;
+	static constexpr size_t way_count = 8;
+
+	/// <summary>
+	/// access the cache line of the given address. returns true if it was not in the cache
+	/// </summary>
+	bool access(const void* address)
 	{
+		// tags are stored + 1 so that 0 marks an empty way
+		const uint64_t line = reinterpret_cast<uintptr_t>(address) / line_size;
+		const uint64_t tag = line + 1;
+		const size_t set = line % set_count;
+		m_time++;
+
+		size_t oldest = 0;
+		for (size_t way = 0; way < way_count; way++)
+		{
+			if (m_tags[set][way] == tag)
+			{
+				m_last_use[set][way] = m_time;
+				return false;
+			}
+			if (m_last_use[set][way] < m_last_use[set][oldest])
+				oldest = way;
+		}
+
+		m_tags[set][oldest] = tag;
+		m_last_use[set][oldest] = m_time;
+		return true;
 	}
 
-	explicit bvh_empty_leaf()
-		: hittable("")
+private:
+	uint64_t m_tags[set_count][way_count]{};
+	uint64_t m_last_use[set_count][way_count]{};
+	uint64_t m_time = 0;
+};
+
+/// <summary>
+/// counters accumulated by bvh::hit when given one, to compare hierarchies on the same rays
+/// </summary>
+struct bvh_traversal_stats
+{
+	uint64_t rays = 0;
+	// nodes whose content was tested (inner nodes test their two children boxes)
+	uint64_t nodes = 0;
+	// primitives intersected, batched or not
+	uint64_t primitives = 0;
+	// node accesses missing the cache model (kept from one ray to the next, as in a real cache)
+	uint64_t cache_misses = 0;
+	cache_model cache;
+
+	void access(const void* address)
 	{
+		cache_misses += cache.access(address);
 	}
 
-public:
-	bool base_hit(const ray&, float, float, hit_info&) override
+	[[nodiscard]] float cache_misses_per_ray() const
 	{
-		return false;
+		return rays == 0 ? 0.0f : static_cast<float>(cache_misses) / static_cast<float>(rays);
 	}
 
-	bool hit(const ray&, float, float, hit_info&) override
+	[[nodiscard]] float nodes_per_ray() const
 	{
-		return false;
+		return rays == 0 ? 0.0f : static_cast<float>(nodes) / static_cast<float>(rays);
 	}
 
-	static bvh_empty_leaf* instance()
+	[[nodiscard]] float primitives_per_ray() const
 	{
-		static bvh_empty_leaf node;
-		return &node;
+		return rays == 0 ? 0.0f : static_cast<float>(primitives) / static_cast<float>(rays);
 	}
 };
 
 /// <summary>
 /// bounding volume hierarchy:
 /// Used to speed up rendering
-/// We recursively divide the objects into a hierarchy of group objects - intermediary nodes are bvh_nodes while leaves are single hittable objects
-/// For each bvh_node we compute its bounding box:
-/// This allows us to raycast only a sub-group of the objects
+/// We recursively divide the objects into a hierarchy of nodes, each one with the bounding box of its content (see bvh_builder)
+/// The hierarchy is stored as one contiguous array of nodes: the root is the first node, siblings are stored side by side
+/// and leaves reference a range of the primitives array.
+/// This allows us to raycast only a sub-group of the objects, without any pointer chasing nor virtual call per node
 /// </summary>
-class bvh_node final : public hittable
+class bvh
 {
 public:
-	bvh_node(std::vector<hittable*> objects, size_t start, size_t end) : hittable("BVH Node")
+	// maximum depth of a hierarchy (see bvh_builder::max_sah_depth)
+	static constexpr int max_depth = 64;
+	// estimated cost of visiting a bvh_node (relative to intersection_cost)
+	static constexpr float traversal_cost = 1.0f;
+	// estimated cost of intersecting an object: includes the ray transformation of hittable::base_hit
+	static constexpr float intersection_cost = 2.0f;
+	// estimated cost of intersecting primitive_batches::batch_width batched primitives at once
+	static constexpr float batch_intersection_cost = 1.5f;
+	// size of the treelets of reorder_treelets (a memory page)
+	static constexpr size_t treelet_bytes = 4096;
+
+	/// <summary>
+	/// returns the estimated cost of intersecting count objects, of which batch_count are batched
+	/// </summary>
+	static float leaf_cost(size_t count, size_t batch_count)
 	{
-		// choose a comparison axis
-		const int axis = random::get<int>(0, 2);
+		const size_t batches = (batch_count + primitive_batches::batch_width - 1) / primitive_batches::batch_width;
+		return batch_intersection_cost * static_cast<float>(batches)
+			+ intersection_cost * static_cast<float>(count - batch_count);
+	}
+
+	/// <summary>
+	/// returns true if the given ray hits one of the primitives at a distance comprised between t_min and t_max
+	/// info records the closest hit (see world::hit). info.distance is expected to be initialized to t_max
+	/// </summary>
+	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) const
+	{
+		return traverse(m_nodes, ray, t_min, t_max, info, leaf_function{this});
+	}
+
+	/// <summary>
+	/// same as hit, but accumulate the work done in stats
+	/// </summary>
+	bool hit(const ray& ray, float t_min, float t_max, hit_info& info, bvh_traversal_stats& stats) const
+	{
+		stats.rays++;
+		return traverse<true>(m_nodes, ray, t_min, t_max, info, leaf_function{this}, &stats);
+	}
 
-		// if the list only has two elements, put one in each subtree and stop there
-		const size_t count = end - start;
-		if (count == 1)
+	/// <summary>
+	/// intersect all the rays of the packet, traversing the hierarchy once for the whole packet:
+	/// each node is tested against the rays that hit its parent, lane_count rays at a time,
+	/// and is visited as long as one of them hits it. Leaves are intersected by these rays one by one.
+	/// infos[i] records the closest hit of packet.rays[i], infos[i].distance is expected to be initialized to t_max.
+	/// returns the mask of the rays that hit a primitive (bit i for packet.rays[i])
+	/// </summary>
+	uint32_t hit(const ray_packet& packet, float t_min, hit_info* infos) const
+	{
+		return traverse(m_nodes, packet, t_min, infos, leaf_function{this});
+	}
+
+	/// <summary>
+	/// returns true if the given ray hits any of the primitives at a distance comprised between t_min and t_max
+	/// the traversal stops at the first hit found, and nothing is recorded about it (see traverse_any)
+	/// </summary>
+	bool occluded(const ray& ray, float t_min, float t_max) const
+	{
+		return traverse_any(m_nodes, ray, t_min, t_max, occluded_leaf_function{this});
+	}
+
+	/// <summary>
+	/// same as occluded, for all the rays of a packet traversing the hierarchy together (see hit)
+	/// returns the mask of the occluded rays (bit i for packet.rays[i])
+	/// </summary>
+	uint32_t occluded(const ray_packet& packet, float t_min, float t_max) const
+	{
+		return traverse_any(m_nodes, packet, t_min, t_max, occluded_leaf_function{this});
+	}
+
+	/// <summary>
+	/// intersect the primitives of the leaf of the given index (see nodes)
+	/// used by the other layouts, which share the leaves of the bvh and their batches
+	/// </summary>
+	bool hit_leaf(uint32_t index, const ray& ray, float t_min, hit_info& info) const
+	{
+		return hit_leaf(m_nodes[index], ray, t_min, info);
+	}
+
+	/// <summary>
+	/// traverse the given nodes front to back, and intersect the ray with the leaves it reaches
+	/// through hit_leaf(const bvh_node& leaf, const ray& ray, float t_min, hit_info& info)
+	/// it lets structures sharing the layout of the nodes store their primitives their own way (see compiled_scene)
+	/// </summary>
+	template <bool CollectStats = false, typename LeafFunction>
+	static bool traverse(const std::vector<bvh_node>& nodes, const ray& ray, float t_min, float t_max, hit_info& info,
+	                     const LeafFunction& hit_leaf, bvh_traversal_stats* stats = nullptr)
+	{
+		if (nodes.empty())
+			return false;
+
+		struct stack_entry
 		{
-			m_left = objects[start];
-			m_right = bvh_empty_leaf::instance();
+			uint32_t index;
+			float distance;
+		};
+
+		stack_entry stack[max_depth];
+		int stack_size = 0;
+
+		bool has_hit = false;
+		const aabb::simd_ray box_ray(ray);
+		float distance = nodes[0].bbox.entry_distance(ray, t_min, t_max);
+		uint32_t index = 0;
+		while (true)
+		{
+			// the distance is tested again since a closer hit may have been found after the node was pushed
+			if (distance < info.distance)
+			{
+				const bvh_node& node = nodes[index];
+				if constexpr (CollectStats)
+				{
+					stats->nodes++;
+					stats->primitives += node.count;
+					stats->access(&node);
+					if (!node.is_leaf())
+					{
+						stats->access(&nodes[node.offset]);
+						stats->access(&nodes[node.offset + 1]);
+					}
+				}
+
+				if (node.is_leaf())
+				{
+					has_hit |= hit_leaf(node, ray, t_min, info);
+				}
+				else
+				{
+					// visit the closest child first and keep the other one for later
+					float left, right;
+					aabb::entry_distances(nodes[node.offset].bbox, nodes[node.offset + 1].bbox, box_ray, t_min,
+					                      info.distance, left, right);
+					uint32_t near_index = node.offset;
+					uint32_t far_index = node.offset + 1;
+					if (right < left)
+					{
+						std::swap(left, right);
+						std::swap(near_index, far_index);
+					}
+
+					if (left != constants::infinity)
+					{
+						if (right != constants::infinity)
+						{
+							stack[stack_size++] = {far_index, right};
+						}
+
+						index = near_index;
+						distance = left;
+						continue;
+					}
+				}
+			}
+
+			if (stack_size == 0)
+				return has_hit;
+
+			index = stack[--stack_size].index;
+			distance = stack[stack_size].distance;
 		}
-		else if (count == 2)
+	}
+
+	/// <summary>
+	/// traverse the given nodes until the ray hits a primitive of a leaf it reaches, tested through
+	/// occluded_leaf(const bvh_node& leaf, const ray& ray, float t_min, float t_max)
+	/// any hit will do (e.g. for shadow rays): the children are not sorted by distance as in traverse,
+	/// they are visited in the order they are stored (visiting the child with the largest area first was slower)
+	/// </summary>
+	template <typename LeafFunction>
+	static bool traverse_any(const std::vector<bvh_node>& nodes, const ray& ray, float t_min, float t_max,
+	                         const LeafFunction& occluded_leaf)
+	{
+		if (nodes.empty() || nodes[0].bbox.entry_distance(ray, t_min, t_max) == constants::infinity)
+			return false;
+
+		const aabb::simd_ray box_ray(ray);
+		uint32_t stack[max_depth];
+		int stack_size = 0;
+
+		uint32_t index = 0;
+		while (true)
 		{
-			if (box_compare(objects[start], objects[start + 1], axis))
+			const bvh_node& node = nodes[index];
+			if (node.is_leaf())
 			{
-				m_left = objects[start];
-				m_right = objects[start + 1];
+				if (occluded_leaf(node, ray, t_min, t_max))
+					return true;
 			}
 			else
 			{
-				m_left = objects[start + 1];
-				m_right = objects[start];
+				const uint32_t left = node.offset;
+				const uint32_t right = node.offset + 1;
+				float left_distance, right_distance;
+				aabb::entry_distances(nodes[left].bbox, nodes[right].bbox, box_ray, t_min, t_max, left_distance,
+				                      right_distance);
+				const bool enters_left = left_distance != constants::infinity;
+				const bool enters_right = right_distance != constants::infinity;
+				if (enters_left || enters_right)
+				{
+					if (enters_left && enters_right)
+						stack[stack_size++] = right;
+					index = enters_left ? left : right;
+					continue;
+				}
 			}
+
+			if (stack_size == 0)
+				return false;
+
+			index = stack[--stack_size];
 		}
-		else // sort the primitives along the axis
+	}
+
+	/// <summary>
+	/// same as traverse_any, for all the rays of a packet (see hit)
+	/// the rays found occluded are removed from the packet, and the traversal stops once they all are
+	/// </summary>
+	template <typename LeafFunction>
+	static uint32_t traverse_any(const std::vector<bvh_node>& nodes, const ray_packet& packet, float t_min,
+	                             float t_max, const LeafFunction& occluded_leaf)
+	{
+		if (nodes.empty() || packet.count == 0)
+			return 0;
+
+		// the rays out of the packet, or already occluded, can never enter a box
+		alignas(32) float t_max_lanes[ray_packet::max_size];
+		for (uint32_t i = 0; i < ray_packet::max_size; i++)
+		{
+			t_max_lanes[i] = i < packet.count ? t_max : -constants::infinity;
+		}
+
+		struct stack_entry
+		{
+			uint32_t index;
+			uint32_t mask;
+		};
+
+		stack_entry stack[max_depth];
+		int stack_size = 0;
+
+		const uint32_t packet_rays = packet.mask();
+		uint32_t occluded_mask = 0;
+		float distance;
+		uint32_t index = 0;
+		uint32_t mask = packet_mask(nodes[0].bbox, packet, packet_rays, t_min, t_max_lanes, distance);
+		while (true)
 		{
-			std::sort(objects.begin() + start, objects.begin() + end, [axis](const hittable* a, const hittable* b)
+			mask &= ~occluded_mask;
+			if (mask != 0)
 			{
-				return box_compare(a, b, axis);
-			});
+				const bvh_node& node = nodes[index];
+				if (node.is_leaf())
+				{
+					for (uint32_t active = mask; active != 0; active &= active - 1)
+					{
+						const uint32_t i = first_bit(active);
+						if (occluded_leaf(node, packet.rays[i], t_min, t_max))
+						{
+							occluded_mask |= 1u << i;
+							t_max_lanes[i] = -constants::infinity;
+						}
+					}
+
+					if (occluded_mask == packet_rays)
+						return occluded_mask;
+				}
+				else
+				{
+					const uint32_t left = packet_mask(nodes[node.offset].bbox, packet, mask, t_min, t_max_lanes,
+					                                  distance);
+					const uint32_t right = packet_mask(nodes[node.offset + 1].bbox, packet, mask, t_min, t_max_lanes,
+					                                   distance);
+					if (left != 0 || right != 0)
+					{
+						if (left != 0 && right != 0)
+							stack[stack_size++] = {node.offset + 1, right};
+						index = left != 0 ? node.offset : node.offset + 1;
+						mask = left != 0 ? left : right;
+						continue;
+					}
+				}
+			}
+
+			if (stack_size == 0)
+				return occluded_mask;
+
+			index = stack[--stack_size].index;
+			mask = stack[stack_size].mask;
+		}
+	}
 
-			if (count == 3)
+	/// <summary>
+	/// same as traverse, for all the rays of a packet (see hit)
+	/// </summary>
+	template <typename LeafFunction>
+	static uint32_t traverse(const std::vector<bvh_node>& nodes, const ray_packet& packet, float t_min, hit_info* infos,
+	                         const LeafFunction& hit_leaf)
+	{
+		if (nodes.empty() || packet.count == 0)
+			return 0;
+
+		// the rays out of the packet can never enter a box
+		alignas(32) float t_max[ray_packet::max_size];
+		for (uint32_t i = 0; i < ray_packet::max_size; i++)
+		{
+			t_max[i] = i < packet.count ? infos[i].distance : -constants::infinity;
+		}
+
+		struct stack_entry
+		{
+			uint32_t index;
+			uint32_t mask;
+		};
+
+		stack_entry stack[max_depth];
+		int stack_size = 0;
+
+		uint32_t hit_mask = 0;
+		float distance;
+		uint32_t index = 0;
+		uint32_t mask = packet_mask(nodes[0].bbox, packet, packet.mask(), t_min, t_max, distance);
+		while (true)
+		{
+			if (mask != 0)
+			{
+				const bvh_node& node = nodes[index];
+				if (node.is_leaf())
+				{
+					for (uint32_t active = mask; active != 0; active &= active - 1)
+					{
+						const uint32_t i = first_bit(active);
+						if (hit_leaf(node, packet.rays[i], t_min, infos[i]))
+						{
+							hit_mask |= 1u << i;
+							t_max[i] = infos[i].distance;
+						}
+					}
+				}
+				else
+				{
+					// visit first the child closest to the rays and keep the other one for later
+					float left_distance, right_distance;
+					uint32_t left = packet_mask(nodes[node.offset].bbox, packet, mask, t_min, t_max, left_distance);
+					uint32_t right = packet_mask(nodes[node.offset + 1].bbox, packet, mask, t_min, t_max,
+					                             right_distance);
+					uint32_t near_index = node.offset;
+					uint32_t far_index = node.offset + 1;
+					if (right_distance < left_distance)
+					{
+						std::swap(left, right);
+						std::swap(near_index, far_index);
+					}
+
+					if (left != 0)
+					{
+						if (right != 0)
+						{
+							stack[stack_size++] = {far_index, right};
+						}
+
+						index = near_index;
+						mask = left;
+						continue;
+					}
+				}
+			}
+
+			if (stack_size == 0)
+				return hit_mask;
+
+			index = stack[--stack_size].index;
+			mask = stack[stack_size].mask;
+		}
+	}
+
+	/// <summary>
+	/// update the bounding boxes containing the given object after its bbox changed
+	/// only the leaf of the object and its ancestors are updated: the structure of the hierarchy is kept as is.
+	/// returns false if the object is not part of the hierarchy, or if it may be referenced by several leaves
+	/// (spatial splits, see bvh_builder)
+	/// </summary>
+	bool refit(const hittable* object)
+	{
+		if (has_duplicates())
+			return false;
+
+		if (m_primitive_indices.empty())
+		{
+			for (uint32_t i = 0; i < m_primitives.size(); i++)
 			{
-				// put the first two in m_left and the last one as a leaf
-				// this avoid an uncessary bvh_node
-				m_left = new bvh_node(objects, start, start + 2);
-				m_right = objects[end - 1];
+				m_primitive_indices.emplace(m_primitives[i], i);
+			}
+		}
+
+		const auto it = m_primitive_indices.find(object);
+		if (it == m_primitive_indices.end())
+			return false;
+
+		// a batched object has to stay batchable to be refitted: its batched description is updated
+		uint32_t index = m_primitive_leaves[it->second];
+		const bvh_node& leaf = m_nodes[index];
+		if (it->second < leaf.offset + leaf.batch_count)
+		{
+			const batch_primitive primitive = object->to_batch_primitive();
+			if (primitive.kind != leaf.batch)
+				return false;
+			m_batches.set(m_batch_indices[it->second], primitive);
+		}
+
+		// walk up from the leaf and stop as soon as a box does not change anymore
+		while (true)
+		{
+			bvh_node& node = m_nodes[index];
+			aabb bbox;
+			if (node.is_leaf())
+			{
+				for (uint32_t i = node.offset, end = node.offset + node.count; i < end; i++)
+				{
+					bbox = aabb::surrounding(bbox, m_primitives[i]->bbox);
+				}
 			}
 			else
 			{
-				// put half in each subtree
-				const size_t half = start + count / 2;
-				m_left = new bvh_node(objects, start, half);
-				m_right = new bvh_node(objects, half, end);
+				bbox = aabb::surrounding(m_nodes[node.offset].bbox, m_nodes[node.offset + 1].bbox);
 			}
+
+			if (bbox.minimum == node.bbox.minimum && bbox.maximum == node.bbox.maximum)
+				break;
+
+			m_weighted_area -= weighted_area(node);
+			node.bbox = bbox;
+			m_weighted_area += weighted_area(node);
+
+			if (index == 0)
+				break;
+			index = m_parents[index];
 		}
 
-		bbox = aabb::surrounding(m_left->bbox, m_right->bbox);
+		return true;
+	}
+
+	/// <summary>
+	/// reorder the nodes so that the nodes likely to be visited one after the other are close in memory:
+	/// the hierarchy is cut into treelets of treelet_size nodes, each one stored contiguously.
+	/// A treelet grows from its root by repeatedly adding the children of its node with the largest surface area
+	/// (the most likely to be hit), and its remaining children become the roots of the next treelets.
+	/// Siblings are kept side by side, so the structure of the hierarchy does not change, only its memory layout
+	/// </summary>
+	void reorder_treelets(size_t treelet_size = treelet_bytes / sizeof(bvh_node))
+	{
+		if (m_nodes.size() <= 1)
+			return;
+
+		std::vector<bvh_node> nodes;
+		nodes.reserve(m_nodes.size());
+		nodes.push_back(m_nodes[0]);
+		// new index of each pair of siblings, by old index of the first sibling
+		std::vector<uint32_t> new_indices(m_nodes.size(), 0);
+
+		const auto largest_first = [this](uint32_t a, uint32_t b)
+		{
+			return m_nodes[a].bbox.surface_area() < m_nodes[b].bbox.surface_area();
+		};
+
+		std::deque<uint32_t> roots{0};
+		std::vector<uint32_t> candidates;
+		while (!roots.empty())
+		{
+			candidates.assign(1, roots.front());
+			roots.pop_front();
+
+			// candidates is a heap of the inner nodes whose children are not placed yet
+			for (size_t size = 0; !candidates.empty() && size + 2 <= treelet_size; size += 2)
+			{
+				std::pop_heap(candidates.begin(), candidates.end(), largest_first);
+				const uint32_t parent = candidates.back();
+				candidates.pop_back();
+
+				const uint32_t first = m_nodes[parent].offset;
+				new_indices[first] = static_cast<uint32_t>(nodes.size());
+				for (const uint32_t child : {first, first + 1})
+				{
+					nodes.push_back(m_nodes[child]);
+					if (!m_nodes[child].is_leaf())
+					{
+						candidates.push_back(child);
+						std::push_heap(candidates.begin(), candidates.end(), largest_first);
+					}
+				}
+			}
+
+			roots.insert(roots.end(), candidates.begin(), candidates.end());
+		}
+
+		for (bvh_node& node : nodes)
+		{
+			if (!node.is_leaf())
+				node.offset = new_indices[node.offset];
+		}
+
+		m_nodes = std::move(nodes);
+		// the data derived from the nodes follows the new order, and so do the batches
+		m_batches.clear();
+		finalize();
+	}
+
+	/// <summary>
+	/// returns the estimated cost of a ray traversing the hierarchy, following the surface area heuristic:
+	/// the cost of each node weighted by the probability of a ray hitting it (relative to the root)
+	/// </summary>
+	[[nodiscard]] float sah_cost() const
+	{
+		if (m_nodes.empty())
+			return 0.0f;
+		return m_weighted_area / std::max(m_nodes[0].bbox.surface_area(), constants::epsilon);
+	}
+
+	/// <summary>
+	/// returns the value of sah_cost() right after the hierarchy was built
+	/// </summary>
+	[[nodiscard]] float built_sah_cost() const
+	{
+		return m_built_sah_cost;
+	}
+
+	void clear()
+	{
+		m_nodes.clear();
+		m_primitives.clear();
+		m_parents.clear();
+		m_primitive_leaves.clear();
+		m_primitive_indices.clear();
+		m_batches.clear();
+		m_batch_indices.clear();
+		m_weighted_area = 0.0f;
+		m_built_sah_cost = 0.0f;
+		m_object_count = 0;
+		m_spatial_split_count = 0;
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return m_nodes.empty();
+	}
+
+	[[nodiscard]] const std::vector<bvh_node>& nodes() const
+	{
+		return m_nodes;
+	}
+
+	[[nodiscard]] const std::vector<hittable*>& primitives() const
+	{
+		return m_primitives;
+	}
+
+	/// <summary>
+	/// returns the number of bytes used by the nodes
+	/// </summary>
+	[[nodiscard]] size_t memory_usage() const
+	{
+		return m_nodes.size() * sizeof(bvh_node);
+	}
+
+	/// <summary>
+	/// returns the number of distinct objects in the hierarchy:
+	/// primitives() holds more references than that when spatial splits duplicated some of them
+	/// </summary>
+	[[nodiscard]] size_t object_count() const
+	{
+		return m_object_count;
+	}
+
+	[[nodiscard]] bool has_duplicates() const
+	{
+		return m_primitives.size() > m_object_count;
+	}
+
+	[[nodiscard]] size_t spatial_split_count() const
+	{
+		return m_spatial_split_count;
+	}
+
+private:
+	friend class bvh_builder;
+	friend class bvh_cache;
+	friend class ray_benchmark;
+
+	// surface area of the node multiplied by its cost (see sah_cost)
+	static float weighted_area(const bvh_node& node)
+	{
+		const float cost = node.is_leaf() ? leaf_cost(node.count, node.batch_count) : traversal_cost;
+		return node.bbox.surface_area() * cost;
 	}
 
-	void internal_update() override
+	static uint32_t first_bit(uint32_t mask)
 	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return static_cast<uint32_t>(index);
+#else
+		return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
 	}
 
-	bool base_hit(const ray& base_ray, float t_min, float t_max, hit_info& info) override
+	/// <summary>
+	/// returns the mask of the rays of the given mask that hit the box between t_min and their t_max
+	/// distance is set to the smallest entry distance of these rays (infinity if none)
+	/// the rays are tested in bundles of Lanes rays (float4 or float8), t_max is expected to be aligned on 32 bytes
+	/// the slab test is the same as aabb::entry_distance so that both agree on the rays at the edge of the box
+	/// </summary>
+	template <uint32_t Lanes = ray_packet::lane_count>
+	static uint32_t packet_mask(const aabb& bbox, const ray_packet& packet, uint32_t mask, float t_min,
+	                            const float* t_max, float& distance)
 	{
-		if (bbox.hit(base_ray, t_min, t_max))
+		using lanes_t = simd_float<Lanes>;
+		constexpr uint32_t lane_mask = (1u << Lanes) - 1u;
+
+		uint32_t result = 0;
+		lanes_t closest(constants::infinity);
+		for (uint32_t lane = 0; lane < ray_packet::max_size; lane += Lanes)
 		{
-			const bool hit_m_left = m_left->base_hit(base_ray, t_min, t_max, info);
-			const bool hit_m_right = m_right->base_hit(base_ray, t_min, info.distance, info);
-			return hit_m_left || hit_m_right;
+			const uint32_t lanes = (mask >> lane) & lane_mask;
+			if (lanes == 0)
+				continue;
+
+			lanes_t t_enter(t_min);
+			lanes_t t_exit = lanes_t::load(t_max + lane);
+			const auto slab = [&t_enter, &t_exit](float minimum, float maximum, const float* origin,
+			                                      const float* inv_direction)
+			{
+				const lanes_t o = lanes_t::load(origin);
+				const lanes_t inv = lanes_t::load(inv_direction);
+				const lanes_t t0 = (lanes_t(minimum) - o) * inv;
+				const lanes_t t1 = (lanes_t(maximum) - o) * inv;
+				// operands are ordered so that a NaN (0 * infinity) is ignored, as in aabb::entry_distance
+				t_enter = max(min(t1, t0), t_enter);
+				t_exit = min(max(t0, t1), t_exit);
+			};
+			slab(bbox.minimum.x, bbox.maximum.x, packet.origin_x + lane, packet.inv_direction_x + lane);
+			slab(bbox.minimum.y, bbox.maximum.y, packet.origin_y + lane, packet.inv_direction_y + lane);
+			slab(bbox.minimum.z, bbox.maximum.z, packet.origin_z + lane, packet.inv_direction_z + lane);
+
+			const uint32_t hits = static_cast<uint32_t>((t_enter <= t_exit).movemask()) & lanes;
+			if (hits == 0)
+				continue;
+
+			result |= hits << lane;
+			closest = min(closest, select(lanes_t::lanes(hits), t_enter, lanes_t(constants::infinity)));
 		}
-		return false;
+
+		distance = closest.horizontal_min();
+		return result;
 	}
 
-	bool hit(const ray&, float, float, hit_info&) override
+	/// <summary>
+	/// leaf function given to traverse to intersect the primitives of the bvh
+	/// </summary>
+	struct leaf_function
 	{
-		throw new std::logic_error("Not Implemented");
+		const bvh* owner;
+
+		bool operator()(const bvh_node& node, const ::ray& ray, float t_min, hit_info& info) const
+		{
+			return owner->hit_leaf(node, ray, t_min, info);
+		}
+	};
+
+	/// <summary>
+	/// leaf function given to traverse_any to test the primitives of the bvh
+	/// </summary>
+	struct occluded_leaf_function
+	{
+		const bvh* owner;
+
+		bool operator()(const bvh_node& node, const ::ray& ray, float t_min, float t_max) const
+		{
+			return owner->occluded_leaf(node, ray, t_min, t_max);
+		}
+	};
+
+	/// <summary>
+	/// returns true if the ray hits one of the primitives of the leaf, stopping at the first one found
+	/// </summary>
+	bool occluded_leaf(const bvh_node& node, const ray& ray, float t_min, float t_max) const
+	{
+		// base_hit only records the distance and the primitive of a hit, which are then ignored
+		hit_info info{nullptr};
+		info.distance = t_max;
+		uint32_t i = node.offset;
+		if (node.batch_count > 0)
+		{
+			// as in hit_leaf, the hit found by the batch is confirmed by base_hit
+			const int closest = m_batches.hit(node.batch, m_batch_indices[i], node.batch_count, ray, t_min, t_max);
+			if (closest >= 0)
+			{
+				if (m_primitives[i + closest]->base_hit(ray, t_min, t_max, info))
+					return true;
+
+				for (uint32_t j = i, end = i + node.batch_count; j < end; j++)
+				{
+					if (m_primitives[j]->base_hit(ray, t_min, t_max, info))
+						return true;
+				}
+			}
+			i += node.batch_count;
+		}
+
+		for (const uint32_t end = node.offset + node.count; i < end; i++)
+		{
+			if (m_primitives[i]->base_hit(ray, t_min, t_max, info))
+				return true;
+		}
+		return false;
 	}
 
-	~bvh_node() override
+	/// <summary>
+	/// intersect the primitives of the leaf: the batch first, then the other primitives one by one
+	/// </summary>
+	bool hit_leaf(const bvh_node& node, const ray& ray, float t_min, hit_info& info) const
 	{
-		if (dynamic_cast<const bvh_node*>(m_left) != nullptr)
+		bool has_hit = false;
+		uint32_t i = node.offset;
+		if (node.batch_count > 0)
 		{
-			delete m_left;
+			// only the closest primitive of the batch goes through base_hit to record the hit in info
+			const int closest = m_batches.hit(node.batch, m_batch_indices[i], node.batch_count, ray, t_min,
+			                                  info.distance);
+			if (closest >= 0 && !m_primitives[i + closest]->base_hit(ray, t_min, info.distance, info))
+			{
+				// the batched intersection is not exactly the same as base_hit: hits at the edge of the range may disagree
+				for (uint32_t j = i, end = i + node.batch_count; j < end; j++)
+				{
+					has_hit |= m_primitives[j]->base_hit(ray, t_min, info.distance, info);
+				}
+			}
+			else
+			{
+				has_hit = closest >= 0;
+			}
+			i += node.batch_count;
 		}
 
-		if (dynamic_cast<const bvh_node*>(m_right) != nullptr)
+		for (const uint32_t end = node.offset + node.count; i < end; i++)
 		{
-			delete m_right;
+			has_hit |= m_primitives[i]->base_hit(ray, t_min, info.distance, info);
 		}
+		return has_hit;
 	}
 
-private:
-	hittable* m_left;
-	hittable* m_right;
+	/// <summary>
+	/// compute the data needed by refit once the nodes and primitives are built
+	/// </summary>
+	void finalize()
+	{
+		m_parents.assign(m_nodes.size(), 0);
+		m_primitive_leaves.assign(m_primitives.size(), 0);
+		m_batch_indices.assign(m_primitives.size(), 0);
+		m_weighted_area = 0.0f;
+		for (uint32_t i = 0; i < m_nodes.size(); i++)
+		{
+			const bvh_node& node = m_nodes[i];
+			if (node.is_leaf())
+			{
+				for (uint32_t j = node.offset, end = node.offset + node.count; j < end; j++)
+				{
+					m_primitive_leaves[j] = i;
+				}
+
+				if (node.batch_count > 0)
+				{
+					const uint32_t first = m_batches.allocate(node.batch, node.batch_count);
+					for (uint32_t j = 0; j < node.batch_count; j++)
+					{
+						m_batch_indices[node.offset + j] = first + j;
+						m_batches.set(first + j, m_primitives[node.offset + j]->to_batch_primitive());
+					}
+				}
+			}
+			else
+			{
+				m_parents[node.offset] = i;
+				m_parents[node.offset + 1] = i;
+			}
+			m_weighted_area += weighted_area(node);
+		}
+		m_built_sah_cost = sah_cost();
+	}
+
+	std::vector<bvh_node> m_nodes;
+	// objects referenced by the leaves (raw pointers, lifetime not managed by the bvh. see world for management)
+	std::vector<hittable*> m_primitives;
+
+	// batched primitives of the leaves, and index of each primitive in m_batches (only meaningful if batched)
+	primitive_batches m_batches;
+	std::vector<uint32_t> m_batch_indices;
+
+	// used by refit: parent of each node, leaf of each primitive and index of each object in m_primitives (built on demand)
+	std::vector<uint32_t> m_parents;
+	std::vector<uint32_t> m_primitive_leaves;
+	std::unordered_map<const hittable*, uint32_t> m_primitive_indices;
+	// sum of weighted_area of all nodes, maintained by refit
+	float m_weighted_area = 0.0f;
+	float m_built_sah_cost = 0.0f;
+
+	// number of distinct objects referenced by m_primitives and number of spatial splits made by the builder
+	size_t m_object_count = 0;
+	size_t m_spatial_split_count = 0;
 };
@@ -0,0 +1,849 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "thread_pool.h"
+#include "core/aabb.h"
+#include "core/random.h"
+
+#include "bvh.h"
+#include "hittable.h"
+
+/// <summary>
+/// strategy used to split the objects when building the bounding volume hierarchy
+/// </summary>
+enum class bvh_build_method
+{
+	// sort along a random axis and cut at the median (original builder, kept for comparison)
+	median,
+	// binned surface area heuristic
+	sah,
+	// binned surface area heuristic with spatial splits (SBVH): objects overlapping the split plane
+	// may be referenced on both sides, with bounds clipped to each side
+	sbvh
+};
+
+/// <summary>
+/// builds the flattened bounding volume hierarchy (see bvh)
+/// By default, it uses a binned Surface Area Heuristic:
+/// For each node, the centroids of the objects are distributed into bins along each axis
+/// and the cost of splitting between each pair of bins is estimated from the surface area of the resulting children.
+/// The node becomes a leaf when no split is cheaper than intersecting all its objects.
+/// Objects that can be intersected as a batch (see primitive_batches) are cheaper to intersect,
+/// so leaves made of such objects grow larger than the others.
+/// The result only depends on the given objects (no randomness involved), whether it is built in parallel or not.
+///
+/// When given a thread_pool, the top of the hierarchy is built with the binning spread over the threads,
+/// then the remaining subtrees are built as independent tasks into their own node arrays and stitched together
+///
+/// With spatial splits (bvh_build_method::sbvh), a node whose best object split leaves children overlapping too much
+/// also evaluates splitting space itself: objects crossing the plane are then referenced by both children.
+/// It is built serially, and the number of duplicated references is limited by max_duplication
+/// </summary>
+class bvh_builder
+{
+public:
+	// number of bins per axis
+	static constexpr int bin_count = 16;
+	// cost model of the surface area heuristic
+	static constexpr float traversal_cost = bvh::traversal_cost;
+	// a leaf never holds more objects than this
+	static constexpr size_t max_leaf_size = 16;
+	// below this depth, nodes are split at the object median so that the depth of the bvh stays under bvh::max_depth
+	static constexpr int max_sah_depth = bvh::max_depth / 2;
+	// nodes with less objects than this are never binned in parallel
+	static constexpr size_t min_parallel_binning_size = 16384;
+	// subtrees with less objects than this are not worth a task of their own
+	static constexpr size_t min_subtree_task_size = 256;
+	// spatial splits are only evaluated when the children of the best object split overlap by more than this
+	// (relative to the surface area of the root)
+	static constexpr float spatial_split_min_overlap = 1e-5f;
+	// maximum number of duplicated references created by spatial splits, relative to the number of objects
+	static constexpr float max_duplication = 0.5f;
+
+	/// <summary>
+	/// build the hierarchy of the given objects into result, using the given method
+	/// if pool is not null and thread_count is greater than 1, up to thread_count threads of the pool are used
+	/// (the pool is expected to be idle: the call waits for its own tasks)
+	/// </summary>
+	static void build(const std::vector<hittable*>& objects, bvh_build_method method, bvh& result,
+	                  thread_pool* pool = nullptr, size_t thread_count = 1)
+	{
+		result.clear();
+		if (objects.empty())
+			return;
+
+		bvh_builder builder(objects, method);
+
+		// the median method relies on the shared random generator and spatial splits append references: both are kept serial
+		if (pool != nullptr && thread_count > 1 && method == bvh_build_method::sah)
+		{
+			builder.m_pool = pool;
+			builder.m_thread_count = thread_count;
+			builder.m_subtree_task_size = std::max(min_subtree_task_size, objects.size() / (thread_count * 8));
+		}
+
+		if (method == bvh_build_method::sbvh)
+		{
+			builder.m_root_area = std::max(compute_root_area(builder.m_references), constants::epsilon);
+			builder.m_duplication_budget = static_cast<size_t>(static_cast<float>(objects.size()) * max_duplication);
+		}
+
+		result.m_nodes.reserve(2 * objects.size());
+		result.m_nodes.emplace_back();
+		builder.build_recursive(result.m_nodes, 0, 0, builder.m_references.size(), 0, builder.m_pool != nullptr);
+		builder.build_subtrees(result.m_nodes);
+
+		result.m_primitives.reserve(builder.m_references.size());
+		if (builder.m_spatial_split_count == 0)
+		{
+			for (const reference& ref : builder.m_references)
+			{
+				result.m_primitives.push_back(ref.object);
+			}
+		}
+		else
+		{
+			// spatial splits leave unused references behind them (see apply_spatial_split):
+			// the references of the leaves are gathered leaf by leaf
+			for (bvh_node& node : result.m_nodes)
+			{
+				if (!node.is_leaf())
+					continue;
+
+				const auto offset = static_cast<uint32_t>(result.m_primitives.size());
+				for (size_t i = node.offset; i < node.offset + static_cast<size_t>(node.count); i++)
+				{
+					result.m_primitives.push_back(builder.m_references[i].object);
+				}
+				node.offset = offset;
+			}
+		}
+		result.m_object_count = objects.size();
+		result.m_spatial_split_count = builder.m_spatial_split_count;
+		result.finalize();
+	}
+
+private:
+	// builds its nodes on demand with split
+	friend class lazy_bvh;
+
+	// the bounding box is copied so that the builder never has to follow the object pointers
+	struct reference
+	{
+		hittable* object;
+		aabb bbox;
+		point3 centroid;
+		batch_kind kind;
+		// index of the object in the list given to the builder
+		uint32_t index;
+	};
+
+	/// <summary>
+	/// number of objects of a range, and how many of them can be batched with each kind
+	/// </summary>
+	struct object_counts
+	{
+		size_t count = 0;
+		size_t spheres = 0;
+		size_t rectangles = 0;
+
+		void add(batch_kind kind)
+		{
+			count++;
+			spheres += kind == batch_kind::sphere;
+			rectangles += kind == batch_kind::rectangle;
+		}
+
+		void merge(const object_counts& other)
+		{
+			count += other.count;
+			spheres += other.spheres;
+			rectangles += other.rectangles;
+		}
+
+		// a leaf only batches one kind of objects: the most common one
+		[[nodiscard]] batch_kind batch() const
+		{
+			if (spheres == 0 && rectangles == 0)
+				return batch_kind::none;
+			return spheres >= rectangles ? batch_kind::sphere : batch_kind::rectangle;
+		}
+
+		[[nodiscard]] size_t batch_count() const
+		{
+			return std::max(spheres, rectangles);
+		}
+
+		// estimated cost of intersecting all the objects (see bvh::leaf_cost)
+		[[nodiscard]] float cost() const
+		{
+			return bvh::leaf_cost(count, batch_count());
+		}
+	};
+
+	struct bin
+	{
+		aabb bbox;
+		object_counts counts;
+	};
+
+	using bins_t = std::array<std::array<bin, bin_count>, 3>;
+
+	/// <summary>
+	/// bounds of the objects of a node and of their centroids
+	/// </summary>
+	struct node_bounds
+	{
+		aabb bbox;
+		aabb centroids;
+		object_counts counts;
+
+		void merge(const node_bounds& other)
+		{
+			bbox = aabb::surrounding(bbox, other.bbox);
+			centroids = aabb::surrounding(centroids, other.centroids);
+			counts.merge(other.counts);
+		}
+	};
+
+	/// <summary>
+	/// references of the children of a split node (see split): the left child gets [start, middle)
+	/// and the right child [right_start, right_end), which follows the left one unless a spatial split
+	/// moved it to the end of the references. The right range is empty if the node should be a leaf
+	/// </summary>
+	struct split_ranges
+	{
+		size_t middle;
+		size_t right_start;
+		size_t right_end;
+
+		static split_ranges leaf(size_t end)
+		{
+			return {end, end, end};
+		}
+
+		static split_ranges at(size_t middle, size_t end)
+		{
+			return {middle, middle, end};
+		}
+
+		[[nodiscard]] bool is_leaf() const
+		{
+			return right_start == right_end;
+		}
+	};
+
+	/// <summary>
+	/// a subtree deferred to be built by its own task (see build_subtrees)
+	/// </summary>
+	struct subtree_task
+	{
+		uint32_t node_index;
+		size_t start;
+		size_t end;
+		int depth;
+		std::vector<bvh_node> nodes;
+	};
+
+	bvh_builder(const std::vector<hittable*>& objects, bvh_build_method method)
+		: m_method(method)
+	{
+		m_references.reserve(objects.size());
+		for (hittable* object : objects)
+		{
+			m_references.push_back({
+				object, object->bbox, (object->bbox.minimum + object->bbox.maximum) * 0.5f,
+				object->to_batch_primitive().kind, static_cast<uint32_t>(m_references.size())
+			});
+		}
+	}
+
+	static float compute_root_area(const std::vector<reference>& references)
+	{
+		aabb bbox;
+		for (const reference& ref : references)
+		{
+			bbox = aabb::surrounding(bbox, ref.bbox);
+		}
+		return bbox.surface_area();
+	}
+
+	/// <summary>
+	/// build the node of the given index in nodes and all its descendants
+	/// if defer is true, big enough subtrees are only reserved and registered to be built by build_subtrees
+	/// </summary>
+	void build_recursive(std::vector<bvh_node>& nodes, uint32_t node_index, size_t start, size_t end, int depth,
+	                     bool defer)
+	{
+		const size_t count = end - start;
+		if (defer && count <= m_subtree_task_size)
+		{
+			m_subtree_tasks.push_back({node_index, start, end, depth, {}});
+			return;
+		}
+
+		// only the top of the hierarchy spreads its work over the pool: subtrees are already built in parallel
+		const node_bounds bounds = compute_bounds(start, end, defer);
+
+		bvh_node& node = nodes[node_index];
+		node.bbox = bounds.bbox;
+
+		const split_ranges children = split(start, end, bounds, depth, defer);
+		if (children.is_leaf())
+		{
+			// the batched objects are moved to the start of the leaf
+			const batch_kind batch = bounds.counts.batch();
+			if (batch != batch_kind::none)
+			{
+				std::partition(m_references.begin() + start, m_references.begin() + end,
+				               [batch](const reference& ref) { return ref.kind == batch; });
+			}
+
+			node.offset = static_cast<uint32_t>(start);
+			node.count = static_cast<uint16_t>(count);
+			node.batch = batch;
+			node.batch_count = static_cast<uint8_t>(bounds.counts.batch_count());
+			return;
+		}
+
+		const auto left = static_cast<uint32_t>(nodes.size());
+		node.offset = left;
+		// node is not used anymore from here since the vector may grow
+		nodes.emplace_back();
+		nodes.emplace_back();
+
+		build_recursive(nodes, left, start, children.middle, depth + 1, defer);
+		build_recursive(nodes, left + 1, children.right_start, children.right_end, depth + 1, defer);
+	}
+
+	/// <summary>
+	/// partition the references of a node with the build method, and return the ranges of its children
+	/// with the sah method and no parallelism, only the references of the range are accessed
+	/// </summary>
+	split_ranges split(size_t start, size_t end, const node_bounds& bounds, int depth, bool parallel)
+	{
+		int axis = 0;
+		if (end - start == 1)
+			return split_ranges::leaf(end);
+		if (m_method == bvh_build_method::median)
+			return split_ranges::at(median_split(start, end, axis), end);
+		if (depth >= max_sah_depth)
+			return split_ranges::at(object_median_split(start, end, bounds.centroids, axis), end);
+		return sah_split(start, end, bounds, parallel, depth, axis);
+	}
+
+	/// <summary>
+	/// build the deferred subtrees on the thread pool, each one in its own node array,
+	/// then append them to the given nodes
+	/// </summary>
+	void build_subtrees(std::vector<bvh_node>& nodes)
+	{
+		if (m_subtree_tasks.empty())
+			return;
+
+		// every worker picks the next subtree to build until there are none left
+		std::atomic<size_t> next_task{0};
+		const auto worker = [this, &next_task]()
+		{
+			for (size_t i = next_task++; i < m_subtree_tasks.size(); i = next_task++)
+			{
+				subtree_task& task = m_subtree_tasks[i];
+				task.nodes.reserve(2 * (task.end - task.start));
+				task.nodes.emplace_back();
+				build_recursive(task.nodes, 0, task.start, task.end, task.depth, false);
+			}
+		};
+		run_on_pool(std::min(m_thread_count, m_subtree_tasks.size()), worker);
+
+		// the root of a subtree replaces its reserved node, the other nodes are appended.
+		// subtree_task::nodes[i] for i > 0 is moved to base + i - 1
+		for (subtree_task& task : m_subtree_tasks)
+		{
+			const auto base = static_cast<uint32_t>(nodes.size());
+			for (bvh_node& node : task.nodes)
+			{
+				if (!node.is_leaf())
+					node.offset = base + node.offset - 1;
+			}
+
+			nodes[task.node_index] = task.nodes[0];
+			nodes.insert(nodes.end(), task.nodes.begin() + 1, task.nodes.end());
+		}
+		m_subtree_tasks.clear();
+	}
+
+	/// <summary>
+	/// run the given function as task_count tasks of the pool and wait for them
+	/// </summary>
+	template <typename Fn>
+	void run_on_pool(size_t task_count, const Fn& fn)
+	{
+		std::vector<std::function<void()>> waiters;
+		waiters.reserve(task_count);
+		for (size_t i = 0; i < task_count; i++)
+		{
+			waiters.emplace_back(m_pool->async(fn));
+		}
+
+		for (auto& wait : waiters)
+		{
+			wait();
+		}
+	}
+
+	/// <summary>
+	/// accumulate(result, first, last) the objects of the range into a T, then return it.
+	/// if parallel is true and the range is big enough, the range is split into chunks accumulated on the pool
+	/// and the results of the chunks are merged with merge(result, chunk_result)
+	/// </summary>
+	template <typename T, typename Accumulate, typename Merge>
+	T reduce(size_t start, size_t end, bool parallel, const Accumulate& accumulate, const Merge& merge)
+	{
+		const size_t count = end - start;
+		if (!parallel || m_pool == nullptr || count < min_parallel_binning_size)
+		{
+			T result{};
+			accumulate(result, start, end);
+			return result;
+		}
+
+		std::vector<T> chunks(m_thread_count);
+		std::atomic<size_t> next_chunk{0};
+		const size_t chunk_size = (count + m_thread_count - 1) / m_thread_count;
+		run_on_pool(m_thread_count, [&]()
+		{
+			const size_t chunk = next_chunk++;
+			const size_t chunk_start = std::min(start + chunk * chunk_size, end);
+			accumulate(chunks[chunk], chunk_start, std::min(chunk_start + chunk_size, end));
+		});
+
+		for (size_t i = 1; i < chunks.size(); i++)
+		{
+			merge(chunks[0], chunks[i]);
+		}
+		return chunks[0];
+	}
+
+	node_bounds compute_bounds(size_t start, size_t end, bool parallel)
+	{
+		return reduce<node_bounds>(start, end, parallel, [this](node_bounds& bounds, size_t first, size_t last)
+		                           {
+			                           for (size_t i = first; i < last; i++)
+			                           {
+				                           bounds.bbox = aabb::surrounding(bounds.bbox, m_references[i].bbox);
+				                           bounds.centroids.encapsulate(m_references[i].centroid);
+				                           bounds.counts.add(m_references[i].kind);
+			                           }
+		                           },
+		                           [](node_bounds& bounds, const node_bounds& other)
+		                           {
+			                           bounds.merge(other);
+		                           });
+	}
+
+	/// <summary>
+	/// distribute the objects of the range into the first used_bins bins of each axis
+	/// </summary>
+	bins_t compute_bins(size_t start, size_t end, const aabb& centroid_bounds, const vec3& bin_factors,
+	                    int used_bins, bool parallel)
+	{
+		return reduce<bins_t>(start, end, parallel, [&](bins_t& bins, size_t first, size_t last)
+		                      {
+			                      for (size_t i = first; i < last; i++)
+			                      {
+				                      const reference& ref = m_references[i];
+				                      for (int axis = 0; axis < 3; axis++)
+				                      {
+					                      const float min = centroid_bounds.minimum[axis];
+					                      const int index = bin_index(ref.centroid[axis], min, bin_factors[axis], used_bins);
+					                      bin& b = bins[axis][index];
+					                      b.bbox = aabb::surrounding(b.bbox, ref.bbox);
+					                      b.counts.add(ref.kind);
+				                      }
+			                      }
+		                      },
+		                      [used_bins](bins_t& bins, const bins_t& other)
+		                      {
+			                      for (int axis = 0; axis < 3; axis++)
+			                      {
+				                      for (int i = 0; i < used_bins; i++)
+				                      {
+					                      bins[axis][i].bbox = aabb::surrounding(bins[axis][i].bbox, other[axis][i].bbox);
+					                      bins[axis][i].counts.merge(other[axis][i].counts);
+				                      }
+			                      }
+		                      });
+	}
+
+	/// <summary>
+	/// original split: sort along a random axis and cut in the middle
+	/// </summary>
+	size_t median_split(size_t start, size_t end, int& axis)
+	{
+		axis = random::get<int>(0, 2);
+		std::sort(m_references.begin() + start, m_references.begin() + end,
+		          [axis](const reference& a, const reference& b)
+		          {
+			          return a.bbox.minimum[axis] < b.bbox.minimum[axis];
+		          });
+		return start + (end - start) / 2;
+	}
+
+	/// <summary>
+	/// split in two halves of the same size along the largest axis
+	/// </summary>
+	size_t object_median_split(size_t start, size_t end, const aabb& centroid_bounds, int& axis)
+	{
+		const vec3 size = centroid_bounds.size();
+		axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+		const size_t middle = start + (end - start) / 2;
+		std::nth_element(m_references.begin() + start, m_references.begin() + middle, m_references.begin() + end,
+		                 [axis](const reference& a, const reference& b)
+		                 {
+			                 return a.centroid[axis] < b.centroid[axis];
+		                 });
+		return middle;
+	}
+
+	/// <summary>
+	/// split where the surface area heuristic is the lowest
+	/// returns a leaf if it is cheaper to keep all the objects in a leaf
+	/// </summary>
+	split_ranges sah_split(size_t start, size_t end, const node_bounds& bounds, bool parallel, int depth,
+	                       int& best_axis)
+	{
+		const size_t count = end - start;
+		const aabb& centroid_bounds = bounds.centroids;
+
+		// small nodes do not need as many bins: it would mostly sweep over empty bins
+		const int used_bins = static_cast<int>(std::min(static_cast<size_t>(bin_count), std::max(count, size_t{4})));
+
+		vec3 bin_factors{0.0f};
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float extent = centroid_bounds.maximum[axis] - centroid_bounds.minimum[axis];
+			if (extent > constants::epsilon)
+				bin_factors[axis] = static_cast<float>(used_bins) / extent;
+		}
+		const bins_t all_bins = compute_bins(start, end, centroid_bounds, bin_factors, used_bins, parallel);
+
+		// find the cheapest split among all bins of all axes
+		const float inv_area = 1.0f / std::max(bounds.bbox.surface_area(), constants::epsilon);
+		float best_cost = constants::infinity;
+		int best_split = -1;
+		aabb best_left_box, best_right_box;
+		best_axis = -1;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			// all centroids are at the same place on this axis: no bin can separate them
+			if (bin_factors[axis] == 0.0f)
+				continue;
+
+			const std::array<bin, bin_count>& bins = all_bins[axis];
+
+			// sweep from the right to accumulate the area and cost of the right side of every split
+			std::array<float, bin_count> right_costs{};
+			std::array<aabb, bin_count> right_boxes{};
+			aabb right_box;
+			object_counts right_counts;
+			for (int i = used_bins - 1; i > 0; i--)
+			{
+				right_box = aabb::surrounding(right_box, bins[i].bbox);
+				right_counts.merge(bins[i].counts);
+				right_costs[i] = right_box.surface_area() * right_counts.cost();
+				right_boxes[i] = right_box;
+			}
+
+			// then sweep from the left and evaluate the cost of splitting before bin i
+			aabb left_box;
+			object_counts left_counts;
+			for (int i = 1; i < used_bins; i++)
+			{
+				left_box = aabb::surrounding(left_box, bins[i - 1].bbox);
+				left_counts.merge(bins[i - 1].counts);
+				if (left_counts.count == 0 || left_counts.count == count)
+					continue;
+
+				const float cost = traversal_cost
+					+ (left_box.surface_area() * left_counts.cost() + right_costs[i]) * inv_area;
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_split = i;
+					best_left_box = left_box;
+					best_right_box = right_boxes[i];
+				}
+			}
+		}
+
+		// spatial splits are only worth evaluating when the children of the object split overlap
+		spatial_split spatial{};
+		if (m_method == bvh_build_method::sbvh && depth < max_sah_depth && m_duplication_budget > 0)
+		{
+			const aabb overlap(glm::max(best_left_box.minimum, best_right_box.minimum),
+			                   glm::min(best_left_box.maximum, best_right_box.maximum));
+			if (best_axis == -1 || overlap.surface_area() > spatial_split_min_overlap * m_root_area)
+			{
+				spatial = find_spatial_split(start, end, bounds);
+			}
+		}
+
+		const float leaf_cost = bounds.counts.cost();
+		if (count <= max_leaf_size && leaf_cost <= std::min(best_cost, spatial.cost))
+			return split_ranges::leaf(end);
+
+		if (spatial.cost < best_cost)
+		{
+			split_ranges children;
+			if (apply_spatial_split(start, end, spatial, children))
+			{
+				best_axis = spatial.axis;
+				return children;
+			}
+
+			// a side of the plane was left empty by the clipping: fall back to the object split
+			if (count <= max_leaf_size && leaf_cost <= best_cost)
+				return split_ranges::leaf(end);
+		}
+
+		if (best_axis == -1)
+		{
+			// all centroids are at the same place: no bin can separate them, cut in the middle
+			best_axis = 0;
+			return split_ranges::at(start + count / 2, end);
+		}
+
+		const float min = centroid_bounds.minimum[best_axis];
+		const float bin_factor = bin_factors[best_axis];
+		const int axis = best_axis;
+		const auto it = std::partition(m_references.begin() + start, m_references.begin() + end,
+		                               [=](const reference& ref)
+		                               {
+			                               return bin_index(ref.centroid[axis], min, bin_factor, used_bins) < best_split;
+		                               });
+		return split_ranges::at(static_cast<size_t>(it - m_references.begin()), end);
+	}
+
+	/// <summary>
+	/// a plane splitting space (see find_spatial_split)
+	/// </summary>
+	struct spatial_split
+	{
+		float cost = constants::infinity;
+		int axis = -1;
+		float position = 0.0f;
+		// the plane is before this bin: the references are sorted by the bins of their bounds along the axis,
+		// binned from min with bin_factor (as counted by find_spatial_split)
+		int bin = 0;
+		float min = 0.0f;
+		float bin_factor = 0.0f;
+		// number of references crossing the plane
+		size_t duplicated = 0;
+	};
+
+	struct spatial_bin
+	{
+		aabb bbox;
+		// objects starting and ending in the bin
+		object_counts entries;
+		object_counts exits;
+	};
+
+	/// <summary>
+	/// find the cheapest plane splitting the node bounds, among the planes between the bins of each axis.
+	/// each object is clipped to every bin it overlaps, so the children bounds only contain their part of the objects
+	/// </summary>
+	spatial_split find_spatial_split(size_t start, size_t end, const node_bounds& bounds)
+	{
+		const aabb& node_box = bounds.bbox;
+		const float inv_area = 1.0f / std::max(node_box.surface_area(), constants::epsilon);
+		spatial_split best;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float min = node_box.minimum[axis];
+			const float extent = node_box.maximum[axis] - min;
+			if (extent <= constants::epsilon)
+				continue;
+
+			const float bin_size = extent / static_cast<float>(bin_count);
+			const float bin_factor = static_cast<float>(bin_count) / extent;
+			std::array<spatial_bin, bin_count> bins{};
+			for (size_t i = start; i < end; i++)
+			{
+				const reference& ref = m_references[i];
+				const int first = bin_index(ref.bbox.minimum[axis], min, bin_factor, bin_count);
+				const int last = bin_index(ref.bbox.maximum[axis], min, bin_factor, bin_count);
+				// only the objects crossing bins need to be clipped
+				if (first == last)
+				{
+					bins[first].bbox = aabb::surrounding(bins[first].bbox, ref.bbox);
+				}
+				else
+				{
+					for (int b = first; b <= last; b++)
+					{
+						const float bin_min = b == first ? -constants::infinity : min + bin_size * static_cast<float>(b);
+						const float bin_max = b == last ? constants::infinity : min + bin_size * static_cast<float>(b + 1);
+						bins[b].bbox = aabb::surrounding(bins[b].bbox, clip(ref, axis, bin_min, bin_max));
+					}
+				}
+				bins[first].entries.add(ref.kind);
+				bins[last].exits.add(ref.kind);
+			}
+
+			std::array<float, bin_count> right_costs{};
+			std::array<size_t, bin_count> right_counts{};
+			aabb right_box;
+			object_counts right;
+			for (int i = bin_count - 1; i > 0; i--)
+			{
+				right_box = aabb::surrounding(right_box, bins[i].bbox);
+				right.merge(bins[i].exits);
+				right_costs[i] = right_box.surface_area() * right.cost();
+				right_counts[i] = right.count;
+			}
+
+			aabb left_box;
+			object_counts left;
+			for (int i = 1; i < bin_count; i++)
+			{
+				left_box = aabb::surrounding(left_box, bins[i - 1].bbox);
+				left.merge(bins[i - 1].entries);
+				const size_t count = end - start;
+				const size_t duplicated = left.count + right_counts[i] - count;
+				if (left.count == 0 || right_counts[i] == 0 || duplicated > m_duplication_budget)
+					continue;
+
+				const float cost = traversal_cost + (left_box.surface_area() * left.cost() + right_costs[i]) * inv_area;
+				if (cost < best.cost)
+				{
+					best.cost = cost;
+					best.axis = axis;
+					best.position = min + bin_size * static_cast<float>(i);
+					best.bin = i;
+					best.min = min;
+					best.bin_factor = bin_factor;
+					best.duplicated = duplicated;
+				}
+			}
+		}
+
+		return best;
+	}
+
+	/// <summary>
+	/// split the references of the range by the given plane: references crossing it are duplicated
+	/// and each copy is clipped to its side, then children is set to the ranges of the sides.
+	/// the left side, never larger than the range, is written at its start, and the right side is appended to the end
+	/// of the references (the rest of the range is left unused): the references of the other nodes never move,
+	/// so a split only costs the size of its own range (see Stich et al. 2009)
+	/// returns false, leaving the range untouched, if one of the sides would be empty
+	/// </summary>
+	bool apply_spatial_split(size_t start, size_t end, const spatial_split& split, split_ranges& children)
+	{
+		std::vector<reference> left;
+		std::vector<reference> right;
+		left.reserve(end - start);
+		right.reserve(end - start);
+		for (size_t i = start; i < end; i++)
+		{
+			const reference& ref = m_references[i];
+			// the same bins as find_spatial_split, so that the sides get the references it counted
+			const int first = bin_index(ref.bbox.minimum[split.axis], split.min, split.bin_factor, bin_count);
+			const int last = bin_index(ref.bbox.maximum[split.axis], split.min, split.bin_factor, bin_count);
+			if (last < split.bin)
+			{
+				left.push_back(ref);
+			}
+			else if (first >= split.bin)
+			{
+				right.push_back(ref);
+			}
+			else
+			{
+				// the clipped bounds of a side can be empty (e.g. the plane only crosses the bbox of a sphere)
+				const reference left_ref = clipped(ref, split.axis, -constants::infinity, split.position);
+				const reference right_ref = clipped(ref, split.axis, split.position, constants::infinity);
+				if (is_empty(left_ref.bbox))
+				{
+					right.push_back(ref);
+				}
+				else if (is_empty(right_ref.bbox))
+				{
+					left.push_back(ref);
+				}
+				else
+				{
+					left.push_back(left_ref);
+					right.push_back(right_ref);
+				}
+			}
+		}
+
+		if (left.empty() || right.empty())
+			return false;
+
+		std::copy(left.begin(), left.end(), m_references.begin() + static_cast<std::ptrdiff_t>(start));
+		children.middle = start + left.size();
+		children.right_start = m_references.size();
+		m_references.insert(m_references.end(), right.begin(), right.end());
+		children.right_end = m_references.size();
+
+		const size_t added = left.size() + right.size() - (end - start);
+		m_duplication_budget -= std::min(added, m_duplication_budget);
+		m_spatial_split_count++;
+		return true;
+	}
+
+	/// <summary>
+	/// returns the bounds of the part of the referenced object comprised between min and max along the axis
+	/// </summary>
+	static aabb clip(const reference& ref, int axis, float min, float max)
+	{
+		aabb bbox = ref.object->clipped_bbox(axis, std::max(min, ref.bbox.minimum[axis]),
+		                                     std::min(max, ref.bbox.maximum[axis]));
+		// a reference may already be clipped by a previous split
+		bbox.minimum = glm::max(bbox.minimum, ref.bbox.minimum);
+		bbox.maximum = glm::min(bbox.maximum, ref.bbox.maximum);
+		return bbox;
+	}
+
+	static bool is_empty(const aabb& bbox)
+	{
+		return bbox.minimum.x > bbox.maximum.x || bbox.minimum.y > bbox.maximum.y || bbox.minimum.z > bbox.maximum.z;
+	}
+
+	static reference clipped(const reference& ref, int axis, float min, float max)
+	{
+		reference result = ref;
+		result.bbox = clip(ref, axis, min, max);
+		result.centroid = (result.bbox.minimum + result.bbox.maximum) * 0.5f;
+		return result;
+	}
+
+	static int bin_index(float centroid, float min, float bin_factor, int used_bins)
+	{
+		const int index = static_cast<int>((centroid - min) * bin_factor);
+		return std::clamp(index, 0, used_bins - 1);
+	}
+
+	bvh_build_method m_method;
+	std::vector<reference> m_references;
+
+	// spatial splits: surface area of the root, number of duplicated references that can still be created
+	// and number of spatial splits made
+	float m_root_area = 0.0f;
+	size_t m_duplication_budget = 0;
+	size_t m_spatial_split_count = 0;
+
+	thread_pool* m_pool = nullptr;
+	size_t m_thread_count = 1;
+	size_t m_subtree_task_size = 0;
+	std::vector<subtree_task> m_subtree_tasks;
+};
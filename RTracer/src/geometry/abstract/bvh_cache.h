@@ -0,0 +1,206 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include "core/mapped_file.h"
+
+#include "bvh.h"
+#include "bvh_builder.h"
+
+/// <summary>
+/// saves built bvh to a binary file and loads them back, so that an unchanged scene does not need to be rebuilt.
+/// A file is only loaded if it was saved by the same version of the cache, for the same content hash (see hash)
+/// The file is memory-mapped: only the nodes and the primitive indices are read, without any parsing
+/// </summary>
+class bvh_cache
+{
+public:
+	// to be increased whenever the file layout or the builders change
+	static constexpr uint32_t version = 1;
+
+	/// <summary>
+	/// returns a hash of everything the builder reads from the objects (in order):
+	/// their type, transform, bbox and batched description, along with the build method
+	/// </summary>
+	static uint64_t hash(const std::vector<hittable*>& objects, bvh_build_method method)
+	{
+		uint64_t result = fnv_offset;
+		hash_value(result, version);
+		hash_value(result, method);
+		hash_value(result, objects.size());
+		for (const hittable* object : objects)
+		{
+			const char* type = typeid(*object).name();
+			hash_bytes(result, type, std::strlen(type));
+			hash_value(result, object->transform);
+			hash_value(result, object->bbox.minimum);
+			hash_value(result, object->bbox.maximum);
+
+			const batch_primitive primitive = object->to_batch_primitive();
+			hash_value(result, primitive.kind);
+			hash_value(result, primitive.center);
+			hash_value(result, primitive.radius);
+			hash_value(result, primitive.u);
+			hash_value(result, primitive.v);
+		}
+		return result;
+	}
+
+	/// <summary>
+	/// write the bvh built from the given objects to the file of the given path
+	/// the file is written next to its destination first, so that a concurrent load never reads a partial file
+	/// returns false if the file cannot be written
+	/// </summary>
+	static bool save(const std::string& path, uint64_t hash, const bvh& bvh, const std::vector<hittable*>& objects)
+	{
+		std::unordered_map<const hittable*, uint32_t> indices;
+		indices.reserve(objects.size());
+		for (uint32_t i = 0; i < objects.size(); i++)
+		{
+			indices.emplace(objects[i], i);
+		}
+
+		std::vector<uint32_t> primitives;
+		primitives.reserve(bvh.m_primitives.size());
+		for (const hittable* primitive : bvh.m_primitives)
+		{
+			const auto it = indices.find(primitive);
+			if (it == indices.end())
+				return false;
+			primitives.push_back(it->second);
+		}
+
+		file_header header;
+		header.hash = hash;
+		header.node_count = bvh.m_nodes.size();
+		header.primitive_count = primitives.size();
+		header.object_count = bvh.m_object_count;
+		header.spatial_split_count = bvh.m_spatial_split_count;
+
+		const std::string temporary_path = path + ".tmp";
+		{
+			std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+			if (!file)
+				return false;
+
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char*>(bvh.m_nodes.data()),
+			           static_cast<std::streamsize>(bvh.m_nodes.size() * sizeof(bvh_node)));
+			file.write(reinterpret_cast<const char*>(primitives.data()),
+			           static_cast<std::streamsize>(primitives.size() * sizeof(uint32_t)));
+			if (!file)
+				return false;
+		}
+
+		// std::rename does not replace an existing file on every platform
+		std::remove(path.c_str());
+		return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+	}
+
+	/// <summary>
+	/// load the bvh of the file of the given path into result
+	/// returns false (and leaves result untouched) if there is no valid file for the given hash and objects
+	/// </summary>
+	static bool load(const std::string& path, uint64_t hash, const std::vector<hittable*>& objects, bvh& result)
+	{
+		const mapped_file file(path);
+		if (!file.is_open() || file.size() < sizeof(file_header))
+			return false;
+
+		file_header header;
+		std::memcpy(&header, file.data(), sizeof(header));
+		if (std::memcmp(header.magic, file_header{}.magic, sizeof(header.magic)) != 0 || header.version != version
+			|| header.node_size != sizeof(bvh_node) || header.hash != hash || header.object_count != objects.size()
+			|| file.size() != sizeof(file_header) + header.node_count * sizeof(bvh_node)
+			+ header.primitive_count * sizeof(uint32_t))
+			return false;
+
+		const std::byte* nodes = file.data() + sizeof(file_header);
+		const std::byte* primitives = nodes + header.node_count * sizeof(bvh_node);
+
+		// the nodes are copied out of the mapping since refit modifies them
+		// a damaged file can still have the expected size and hash: they are checked to stay within the arrays
+		// and to fit the traversal stacks (bvh::max_depth) before anything traverses them
+		std::vector<bvh_node> loaded_nodes(header.node_count);
+		std::memcpy(loaded_nodes.data(), nodes, header.node_count * sizeof(bvh_node));
+		std::vector<int> depths(header.node_count, 0);
+		for (size_t i = 0; i < loaded_nodes.size(); i++)
+		{
+			const bvh_node& node = loaded_nodes[i];
+			if (node.is_leaf())
+			{
+				if (node.offset + static_cast<uint64_t>(node.count) > header.primitive_count
+					|| node.batch_count > node.count)
+					return false;
+				continue;
+			}
+
+			// inner nodes: the right child is stored right after the left one, and the children always after
+			// their parent (see bvh_builder and bvh::reorder_treelets), so that the hierarchy cannot loop
+			// each inner node pushes at most one entry on the traversal stacks
+			if (node.offset <= i || node.offset + static_cast<uint64_t>(1) >= header.node_count
+				|| depths[i] >= bvh::max_depth)
+				return false;
+			for (uint32_t child = node.offset; child <= node.offset + 1; child++)
+				depths[child] = std::max(depths[child], depths[i] + 1);
+		}
+
+		std::vector<hittable*> loaded_primitives(header.primitive_count);
+		for (size_t i = 0; i < header.primitive_count; i++)
+		{
+			uint32_t index;
+			std::memcpy(&index, primitives + i * sizeof(uint32_t), sizeof(index));
+			if (index >= objects.size())
+				return false;
+			loaded_primitives[i] = objects[index];
+		}
+
+		result.clear();
+		result.m_nodes = std::move(loaded_nodes);
+		result.m_primitives = std::move(loaded_primitives);
+		result.m_object_count = header.object_count;
+		result.m_spatial_split_count = header.spatial_split_count;
+		result.finalize();
+		return true;
+	}
+
+private:
+	struct file_header
+	{
+		char magic[8] = {'R', 'T', 'B', 'V', 'H', '\0', '\0', '\0'};
+		uint32_t version = bvh_cache::version;
+		uint32_t node_size = sizeof(bvh_node);
+		uint64_t hash = 0;
+		uint64_t node_count = 0;
+		uint64_t primitive_count = 0;
+		uint64_t object_count = 0;
+		uint64_t spatial_split_count = 0;
+	};
+
+	// 64 bits FNV-1a
+	static constexpr uint64_t fnv_offset = 14695981039346656037ull;
+	static constexpr uint64_t fnv_prime = 1099511628211ull;
+
+	static void hash_bytes(uint64_t& hash, const void* data, size_t size)
+	{
+		const auto* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ bytes[i]) * fnv_prime;
+		}
+	}
+
+	template <typename T>
+	static void hash_value(uint64_t& hash, const T& value)
+	{
+		hash_bytes(hash, &value, sizeof(value));
+	}
+};
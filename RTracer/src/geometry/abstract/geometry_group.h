@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include <vector>
+
+#include "bvh.h"
+#include "bvh_builder.h"
+#include "hittable.h"
+
+/// <summary>
+/// group of objects sharing their own bounding volume hierarchy (i.e. a bottom-level acceleration structure)
+/// a group is not rendered directly but through instances (see instance) that can all share the same group:
+/// the objects and the bvh are then stored only once no matter how many instances reference them.
+/// objects are expressed in the local space of the group.
+/// </summary>
+class geometry_group
+{
+public:
+	geometry_group() = default;
+	geometry_group(const geometry_group&) = delete;
+	geometry_group& operator=(const geometry_group&) = delete;
+
+	~geometry_group()
+	{
+		for (hittable* obj : m_list)
+		{
+			delete obj;
+		}
+	}
+
+	template <typename T, class... Args>
+	T& add(Args&&... args)
+	{
+		auto* added = new T(std::forward<Args>(args)...);
+		m_list.push_back(added);
+		added->update();
+		return *added;
+	}
+
+	/// <summary>
+	/// build the bvh of the group and compute its bounding box
+	/// must be called once all objects are added (and again if one of them changes)
+	/// </summary>
+	void build(bvh_build_method method = bvh_build_method::sah)
+	{
+		bbox = aabb();
+		for (const hittable* obj : m_list)
+		{
+			bbox = aabb::surrounding(bbox, obj->bbox);
+		}
+
+		bvh_builder::build(m_list, method, m_bvh);
+	}
+
+	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) const
+	{
+		if (!m_bvh.empty())
+		{
+			return m_bvh.hit(ray, t_min, t_max, info);
+		}
+
+		bool has_hit = false;
+		for (const auto& hittable : m_list)
+		{
+			has_hit |= (hittable->base_hit(ray, t_min, info.distance, info));
+		}
+
+		return has_hit;
+	}
+
+	[[nodiscard]] const std::vector<hittable*>& hittables() const
+	{
+		return m_list;
+	}
+
+	[[nodiscard]] const bvh& get_bvh() const
+	{
+		return m_bvh;
+	}
+
+	// bounding box of all the objects of the group, in the local space of the group
+	aabb bbox;
+
+private:
+	bvh m_bvh;
+	std::vector<hittable*> m_list;
+};
@@ -9,23 +9,50 @@ hittable::hittable(const char* name)
 
 bool hittable::base_hit(const ray& base_ray, float t_min, float t_max, hit_info& info)
 {
-	const auto origin = vector3::multiply_point_fast(base_ray.origin, inv_transform);
-	const auto direction = glm::mat3(inv_transform) * base_ray.direction;
-	const auto inv_direction = glm::one<vec3>() / direction;
-	const auto transformed_ray = ::ray(origin, direction, inv_direction);
+	// the direction is not normalized by the transform: the distance is the same in both spaces
+	return hit(to_local_space(base_ray, transform_type, transform, inv_transform), t_min, t_max, info);
+}
 
-	if (!hit(transformed_ray, t_min, t_max, info))
-		return false;
+void hittable::base_evaluate(const ray& base_ray, hit_info& info)
+{
+	evaluate(to_local_space(base_ray, transform_type, transform, inv_transform), info);
+	to_world_space(info, transform_type, transform);
+}
 
-	info.normal = glm::mat3(transform) * info.normal;
-	info.point = vector3::multiply_point_fast(info.point, transform);
+transform_kind hittable::classify(const glm::mat4& matrix)
+{
+	// transforms edited from the ui go through a decomposition: tiny rotations are considered as none
+	const glm::mat3 linear(matrix);
+	const float scale = linear[0][0];
+	const float tolerance = 1e-6f * std::abs(scale);
+	for (int column = 0; column < 3; column++)
+	{
+		for (int row = 0; row < 3; row++)
+		{
+			const float expected = column == row ? scale : 0.0f;
+			if (std::abs(linear[column][row] - expected) > tolerance)
+				return transform_kind::general;
+		}
+	}
 
-	return true;
+	const bool is_translated = matrix[3][0] != 0.0f || matrix[3][1] != 0.0f || matrix[3][2] != 0.0f;
+	if (std::abs(scale - 1.0f) > tolerance)
+		return transform_kind::uniform_scale;
+	return is_translated ? transform_kind::translation : transform_kind::identity;
+}
+
+aabb hittable::clipped_bbox(int axis, float min, float max) const
+{
+	aabb result = bbox;
+	result.minimum[axis] = std::max(result.minimum[axis], min);
+	result.maximum[axis] = std::min(result.maximum[axis], max);
+	return result;
 }
 
 void hittable::update()
 {
 	inv_transform = inverse(transform);
+	transform_type = classify(transform);
 	internal_update();
 	bbox.transform(transform);
 }
@@ -11,6 +11,23 @@
 #include "serializable.h"
 #include "serializable_node.h"
 
+#include "primitive_batch.h"
+
+/// <summary>
+/// kind of the transform of a hittable, from the cheapest to the most expensive to apply to a ray
+/// classified by hittable::update so that base_hit only does the matrix work the transform requires
+/// </summary>
+enum class transform_kind : uint8_t
+{
+	identity,
+	// translation only
+	translation,
+	// translation and the same scale along all axes, without rotation
+	uniform_scale,
+	// any other affine transform (rotation, non-uniform scale, shear)
+	general
+};
+
 /// <summary>
 /// represents objects that can be hit by light (e.g. geometry)
 /// </summary>
@@ -24,10 +41,83 @@ public:
 
 	virtual bool base_hit(const ray& base_ray, float t_min, float t_max, hit_info& info);
 
+	/// <summary>
+	/// intersect the ray, expressed in the local space of the object
+	/// only records the distance, the object and the primitive of the hit in info (see evaluate)
+	/// </summary>
 	virtual bool hit(const ray& ray, float t_min, float t_max, hit_info& info) = 0;
 
+	/// <summary>
+	/// fill the surface of the hit recorded by base_hit (point, normal, uv and material), in world space
+	/// only called for the closest hit (see world::hit)
+	/// </summary>
+	virtual void base_evaluate(const ray& base_ray, hit_info& info);
+
+	/// <summary>
+	/// fill the surface of the hit recorded by hit, with the ray expressed in the local space of the object
+	/// </summary>
+	virtual void evaluate(const ray& ray, hit_info& info) = 0;
+
 	void update();
 
+	/// <summary>
+	/// returns the cheapest kind of transform that represents the given matrix
+	/// </summary>
+	static transform_kind classify(const glm::mat4& matrix);
+
+	/// <summary>
+	/// transform the ray from world space to the local space of an object (as done by base_hit)
+	/// only the work required by the kind of its transform is done
+	/// </summary>
+	static ray to_local_space(const ray& base_ray, transform_kind kind, const glm::mat4& transform,
+	                          const glm::mat4& inv_transform)
+	{
+		switch (kind)
+		{
+		case transform_kind::identity:
+			return base_ray;
+		case transform_kind::translation:
+			return ray(base_ray.origin - vec3(transform[3]), base_ray.direction, base_ray.inv_direction);
+		case transform_kind::uniform_scale:
+			{
+				// the inverse direction is scaled instead of computed again
+				const float inv_scale = inv_transform[0][0];
+				return ray((base_ray.origin - vec3(transform[3])) * inv_scale, base_ray.direction * inv_scale,
+				           base_ray.inv_direction * transform[0][0]);
+			}
+		default:
+			{
+				const auto origin = vector3::multiply_point_fast(base_ray.origin, inv_transform);
+				const auto direction = glm::mat3(inv_transform) * base_ray.direction;
+				const auto inv_direction = glm::one<vec3>() / direction;
+				return ray(origin, direction, inv_direction);
+			}
+		}
+	}
+
+	/// <summary>
+	/// transform the point and the normal of a hit from the local space of an object back to world space
+	/// </summary>
+	static void to_world_space(hit_info& info, transform_kind kind, const glm::mat4& transform)
+	{
+		switch (kind)
+		{
+		case transform_kind::identity:
+			break;
+		case transform_kind::translation:
+			info.point += vec3(transform[3]);
+			break;
+		case transform_kind::uniform_scale:
+			info.normal *= transform[0][0];
+			info.point = info.point * transform[0][0] + vec3(transform[3]);
+			break;
+		default:
+			info.normal = glm::mat3(transform) * info.normal;
+			info.point = vector3::multiply_point_fast(info.point, transform);
+			break;
+		}
+	}
+
 	std::shared_ptr<serializable_node_base> serialize() override
 	{
 		return std::make_shared<serializable_node_base>(
@@ -41,6 +131,21 @@ public:
 	{
 		return nullptr;
 	}
+
+	/// <summary>
+	/// describe the object once transformed, so that the bvh can intersect it in batches with similar objects
+	/// (see primitive_batches). objects that cannot be batched return a primitive of kind batch_kind::none
+	/// </summary>
+	[[nodiscard]] virtual batch_primitive to_batch_primitive() const
+	{
+		return {};
+	}
+
+	/// <summary>
+	/// returns the bounds of the part of the transformed object comprised between min and max along the given axis
+	/// (used by the bvh spatial splits, see bvh_builder). by default, the bbox is clipped to the slab
+	/// </summary>
+	[[nodiscard]] virtual aabb clipped_bbox(int axis, float min, float max) const;
 	
 	// name is used for ui and debug purposes
 	std::string name;
@@ -50,5 +155,7 @@ public:
 	material* material;
 	glm::mat4 transform = glm::identity<glm::mat4>();
 	glm::mat4 inv_transform = glm::identity<glm::mat4>();
+	// set from transform by update
+	transform_kind transform_type = transform_kind::general;
 	aabb bbox;
 };
\ No newline at end of file
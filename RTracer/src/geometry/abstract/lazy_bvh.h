@@ -0,0 +1,366 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "core/aabb.h"
+
+#include "bvh.h"
+#include "bvh_builder.h"
+#include "hittable.h"
+
+/// <summary>
+/// bounding volume hierarchy built on demand:
+/// build only splits the top levels, then an unexpanded node is split into its two children
+/// the first time a ray reaches it. Parts of the scene no ray reaches are never built,
+/// so the time to the first pixel depends on what is visible rather than on the size of the scene.
+///
+/// Nodes are split with the binned SAH of bvh_builder, in a node array allocated once for the whole hierarchy,
+/// so that concurrent rays can keep reading it while other threads expand nodes.
+/// A node is expanded by the first thread that claims it: the other ones wait until it is done
+/// </summary>
+class lazy_bvh
+{
+public:
+	// number of levels split by build (the root alone is level 0)
+	static constexpr int eager_depth = 6;
+
+	lazy_bvh() = default;
+	lazy_bvh(const lazy_bvh&) = delete;
+	lazy_bvh& operator=(const lazy_bvh&) = delete;
+
+	/// <summary>
+	/// prepare the hierarchy of the given objects: only the first eager_depth levels are split
+	/// </summary>
+	void build(const std::vector<hittable*>& objects)
+	{
+		clear();
+		if (objects.empty())
+			return;
+
+		m_builder.reset(new bvh_builder(objects, bvh_build_method::sah));
+		// a hierarchy of n leaves has 2n - 1 nodes: the array never has to grow while it is traversed
+		m_capacity = 2 * objects.size() - 1;
+		m_nodes.reset(new lazy_node[m_capacity]);
+		m_node_count = 1;
+		init_node(0, 0, objects.size(), 0);
+		expand_eagerly(0);
+	}
+
+	/// <summary>
+	/// returns true if the given ray hits one of the objects at a distance comprised between t_min and t_max
+	/// info records the closest hit (see world::hit). info.distance is expected to be initialized to t_max
+	/// the nodes reached for the first time are expanded, which is safe to do from several threads
+	/// </summary>
+	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) const
+	{
+		return traverse(ray, t_min, t_max, info,
+		                [](hittable& object, uint32_t, const ::ray& leaf_ray, float leaf_t_min, hit_info& leaf_info)
+		                {
+			                return object.base_hit(leaf_ray, leaf_t_min, leaf_info.distance, leaf_info);
+		                });
+	}
+
+	/// <summary>
+	/// returns true if the given ray hits any of the objects between t_min and t_max (see bvh::occluded)
+	/// </summary>
+	bool occluded(const ray& ray, float t_min, float t_max) const
+	{
+		return traverse_any(ray, t_min, t_max,
+		                    [](hittable& object, uint32_t, const ::ray& leaf_ray, float leaf_t_min, float leaf_t_max)
+		                    {
+			                    hit_info info{nullptr};
+			                    info.distance = leaf_t_max;
+			                    return object.base_hit(leaf_ray, leaf_t_min, leaf_t_max, info);
+		                    });
+	}
+
+	/// <summary>
+	/// same as hit, with the objects of the leaves intersected by the given function, called as
+	/// leaf(object, index, ray, t_min, info) with index the index of the object in the list given to build:
+	/// the hierarchy can then be traversed over another representation of the objects (see compiled_scene)
+	/// </summary>
+	template <typename LeafFunction>
+	bool traverse(const ray& ray, float t_min, float t_max, hit_info& info, const LeafFunction& leaf) const
+	{
+		if (m_node_count == 0)
+			return false;
+
+		struct stack_entry
+		{
+			uint32_t index;
+			float distance;
+		};
+
+		stack_entry stack[bvh::max_depth];
+		int stack_size = 0;
+
+		bool has_hit = false;
+		const aabb::simd_ray box_ray(ray);
+		float distance = m_nodes[0].bbox.entry_distance(ray, t_min, t_max);
+		uint32_t index = 0;
+		while (true)
+		{
+			// the distance is tested again since a closer hit may have been found after the node was pushed
+			if (distance < info.distance)
+			{
+				const lazy_node& node = expand(index);
+				if (node.state.load(std::memory_order_relaxed) == node_state::leaf)
+				{
+					for (uint32_t i = node.offset, end = node.offset + node.count; i < end; i++)
+					{
+						const bvh_builder::reference& reference = m_builder->m_references[i];
+						has_hit |= leaf(*reference.object, reference.index, ray, t_min, info);
+					}
+				}
+				else
+				{
+					// visit the closest child first and keep the other one for later
+					float left, right;
+					aabb::entry_distances(m_nodes[node.offset].bbox, m_nodes[node.offset + 1].bbox, box_ray, t_min,
+					                      info.distance, left, right);
+					uint32_t near_index = node.offset;
+					uint32_t far_index = node.offset + 1;
+					if (right < left)
+					{
+						std::swap(left, right);
+						std::swap(near_index, far_index);
+					}
+
+					if (left != constants::infinity)
+					{
+						if (right != constants::infinity)
+						{
+							stack[stack_size++] = {far_index, right};
+						}
+
+						index = near_index;
+						distance = left;
+						continue;
+					}
+				}
+			}
+
+			if (stack_size == 0)
+				return has_hit;
+
+			index = stack[--stack_size].index;
+			distance = stack[stack_size].distance;
+		}
+	}
+
+	/// <summary>
+	/// returns true as soon as the given function finds a hit, called as leaf(object, index, ray, t_min, t_max)
+	/// for the objects of the leaves reached (see traverse): the children are visited in any order
+	/// </summary>
+	template <typename LeafFunction>
+	bool traverse_any(const ray& ray, float t_min, float t_max, const LeafFunction& leaf) const
+	{
+		if (m_node_count == 0 || m_nodes[0].bbox.entry_distance(ray, t_min, t_max) == constants::infinity)
+			return false;
+
+		uint32_t stack[bvh::max_depth];
+		int stack_size = 0;
+
+		const aabb::simd_ray box_ray(ray);
+		uint32_t index = 0;
+		while (true)
+		{
+			const lazy_node& node = expand(index);
+			if (node.state.load(std::memory_order_relaxed) == node_state::leaf)
+			{
+				for (uint32_t i = node.offset, end = node.offset + node.count; i < end; i++)
+				{
+					const bvh_builder::reference& reference = m_builder->m_references[i];
+					if (leaf(*reference.object, reference.index, ray, t_min, t_max))
+						return true;
+				}
+			}
+			else
+			{
+				float left, right;
+				aabb::entry_distances(m_nodes[node.offset].bbox, m_nodes[node.offset + 1].bbox, box_ray, t_min, t_max,
+				                      left, right);
+				const bool hits_left = left != constants::infinity;
+				const bool hits_right = right != constants::infinity;
+				if (hits_left && hits_right)
+					stack[stack_size++] = node.offset + 1;
+
+				if (hits_left || hits_right)
+				{
+					index = hits_left ? node.offset : node.offset + 1;
+					continue;
+				}
+			}
+
+			if (stack_size == 0)
+				return false;
+			index = stack[--stack_size];
+		}
+	}
+
+	/// <summary>
+	/// update the nodes created so far after the bbox of the given object changed (e.g. it was moved):
+	/// its references take its new bbox and the bounds of the nodes are computed again from the bottom up.
+	/// The nodes keep their split, the unexpanded ones are split with the new bounds when rays reach them.
+	/// returns false if the object is not in the hierarchy. Not to be called while rays traverse the hierarchy
+	/// </summary>
+	bool refit(const hittable* object)
+	{
+		if (m_node_count == 0)
+			return false;
+
+		bool is_found = false;
+		for (bvh_builder::reference& reference : m_builder->m_references)
+		{
+			if (reference.object != object)
+				continue;
+
+			reference.bbox = object->bbox;
+			reference.centroid = (object->bbox.minimum + object->bbox.maximum) * 0.5f;
+			is_found = true;
+		}
+		if (!is_found)
+			return false;
+
+		// the children of a node are always created after it
+		for (uint32_t index = m_node_count.load(std::memory_order_relaxed); index-- > 0;)
+		{
+			lazy_node& node = m_nodes[index];
+			if (node.state.load(std::memory_order_relaxed) == node_state::inner)
+				node.bbox = aabb::surrounding(m_nodes[node.offset].bbox, m_nodes[node.offset + 1].bbox);
+			else
+				node.bbox = m_builder->compute_bounds(node.offset, node.offset + node.count, false).bbox;
+		}
+		return true;
+	}
+
+	void clear()
+	{
+		m_nodes.reset();
+		m_builder.reset();
+		m_node_count = 0;
+		m_capacity = 0;
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return m_node_count == 0;
+	}
+
+	/// <summary>
+	/// returns the number of nodes created so far (expanded or waiting to be)
+	/// </summary>
+	[[nodiscard]] size_t node_count() const
+	{
+		return m_node_count;
+	}
+
+	/// <summary>
+	/// returns the number of nodes of the fully expanded hierarchy at most
+	/// </summary>
+	[[nodiscard]] size_t node_capacity() const
+	{
+		return m_capacity;
+	}
+
+private:
+	enum class node_state : uint8_t
+	{
+		// the node only knows its references and bounding box
+		unexpanded,
+		// a thread is splitting the node
+		expanding,
+		inner,
+		leaf
+	};
+
+	struct lazy_node
+	{
+		aabb bbox;
+		// unexpanded node or leaf: index of the first reference in the builder, inner node: index of the left child
+		// (the right child is always stored right after it)
+		uint32_t offset;
+		// number of references of the node
+		uint32_t count;
+		int depth;
+		std::atomic<node_state> state;
+	};
+
+	void init_node(uint32_t index, size_t start, size_t end, int depth) const
+	{
+		lazy_node& node = m_nodes[index];
+		node.bbox = m_builder->compute_bounds(start, end, false).bbox;
+		node.offset = static_cast<uint32_t>(start);
+		node.count = static_cast<uint32_t>(end - start);
+		node.depth = depth;
+		node.state.store(node_state::unexpanded, std::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// returns the node of the given index once it is expanded: the calling thread either splits it
+	/// or waits for the thread that claimed it first
+	/// </summary>
+	const lazy_node& expand(uint32_t index) const
+	{
+		lazy_node& node = m_nodes[index];
+		node_state state = node.state.load(std::memory_order_acquire);
+		if (state == node_state::unexpanded
+			&& node.state.compare_exchange_strong(state, node_state::expanding, std::memory_order_acquire))
+		{
+			split(node);
+			return node;
+		}
+
+		while (state == node_state::expanding || state == node_state::unexpanded)
+		{
+			std::this_thread::yield();
+			state = node.state.load(std::memory_order_acquire);
+		}
+		return node;
+	}
+
+	/// <summary>
+	/// split the node into two unexpanded children, or make it a leaf.
+	/// the children are fully initialized before the node is published as inner
+	/// </summary>
+	void split(lazy_node& node) const
+	{
+		const size_t start = node.offset;
+		const size_t end = start + node.count;
+		// only the references of the node are accessed: other threads can split other nodes at the same time
+		const bvh_builder::node_bounds bounds = m_builder->compute_bounds(start, end, false);
+		const bvh_builder::split_ranges children = m_builder->split(start, end, bounds, node.depth, false);
+		if (children.is_leaf())
+		{
+			node.state.store(node_state::leaf, std::memory_order_release);
+			return;
+		}
+
+		const uint32_t left = m_node_count.fetch_add(2, std::memory_order_relaxed);
+		init_node(left, start, children.middle, node.depth + 1);
+		init_node(left + 1, children.right_start, children.right_end, node.depth + 1);
+		node.offset = left;
+		node.state.store(node_state::inner, std::memory_order_release);
+	}
+
+	void expand_eagerly(uint32_t index) const
+	{
+		const lazy_node& node = expand(index);
+		if (node.depth + 1 >= eager_depth || node.state.load(std::memory_order_relaxed) == node_state::leaf)
+			return;
+
+		const uint32_t left = node.offset;
+		expand_eagerly(left);
+		expand_eagerly(left + 1);
+	}
+
+	// holds the references of the objects, partitioned node by node as they are expanded
+	std::unique_ptr<bvh_builder> m_builder;
+	std::unique_ptr<lazy_node[]> m_nodes;
+	mutable std::atomic<uint32_t> m_node_count{0};
+	size_t m_capacity = 0;
+};
@@ -0,0 +1,287 @@
+﻿#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "core/ray.h"
+#include "core/simd.h"
+#include "core/vec3.h"
+
+/// <summary>
+/// kind of primitives that can be intersected together as a batch by the bvh (see primitive_batches)
+/// </summary>
+enum class batch_kind : uint8_t
+{
+	none,
+	sphere,
+	rectangle
+};
+
+/// <summary>
+/// world-space description of a primitive that can be batched (see hittable::to_batch_primitive)
+/// sphere: center and radius
+/// rectangle: center and half edges u and v (the rectangle spans center + a * u + b * v for a and b in [-1, 1])
+/// </summary>
+struct batch_primitive
+{
+	batch_kind kind = batch_kind::none;
+	point3 center{0.0f};
+	float radius = 0.0f;
+	vec3 u{0.0f};
+	vec3 v{0.0f};
+};
+
+/// <summary>
+/// stores batched primitives as structures of arrays, so that the bvh can intersect a ray with 4 of them at once (see float4)
+/// instead of going through the virtual hittable::base_hit and its ray transformation for each one of them.
+/// only the closest hit of a batch is then intersected through base_hit to record it in the hit_info.
+/// every batch starts at a multiple of batch_width, and is padded with primitives that can never be hit
+/// </summary>
+class primitive_batches
+{
+public:
+	static constexpr int batch_width = 4;
+
+	void clear()
+	{
+		m_spheres.clear();
+		m_rectangles.clear();
+	}
+
+	/// <summary>
+	/// reserve room for a batch of count primitives of the given kind and returns the index of its first primitive
+	/// </summary>
+	uint32_t allocate(batch_kind kind, size_t count)
+	{
+		const size_t padded_count = (count + batch_width - 1) / batch_width * batch_width;
+		if (kind == batch_kind::sphere)
+			return m_spheres.allocate(padded_count);
+		return m_rectangles.allocate(padded_count);
+	}
+
+	/// <summary>
+	/// set the primitive at the given index of the batches of its kind
+	/// </summary>
+	void set(uint32_t index, const batch_primitive& primitive)
+	{
+		if (primitive.kind == batch_kind::sphere)
+			m_spheres.set(index, primitive);
+		else
+			m_rectangles.set(index, primitive);
+	}
+
+	/// <summary>
+	/// intersect the ray with the count primitives of the batch starting at first
+	/// returns the position in the batch of the closest one hit at a distance comprised between t_min and t_max, or -1
+	/// </summary>
+	[[nodiscard]] int hit(batch_kind kind, uint32_t first, int count, const ray& ray, float t_min, float t_max) const
+	{
+		if (kind == batch_kind::sphere)
+			return m_spheres.hit(first, count, ray, t_min, t_max);
+		return m_rectangles.hit(first, count, ray, t_min, t_max);
+	}
+
+private:
+	/// <summary>
+	/// keep the closest of the hits of a group of batch_width primitives
+	/// </summary>
+	static void select_closest(const float4& distances, const float4& hit_mask, int group, float& closest,
+	                           int& closest_index)
+	{
+		int mask = hit_mask.movemask();
+		if (mask == 0)
+			return;
+
+		alignas(16) float values[batch_width];
+		distances.store(values);
+		while (mask != 0)
+		{
+			const int i = mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+			mask &= mask - 1;
+			if (values[i] < closest)
+			{
+				closest = values[i];
+				closest_index = group + i;
+			}
+		}
+	}
+
+	struct sphere_batches
+	{
+		void clear()
+		{
+			center_x.clear();
+			center_y.clear();
+			center_z.clear();
+			squared_radius.clear();
+		}
+
+		uint32_t allocate(size_t count)
+		{
+			const auto first = static_cast<uint32_t>(center_x.size());
+			center_x.resize(first + count, 0.0f);
+			center_y.resize(first + count, 0.0f);
+			center_z.resize(first + count, 0.0f);
+			// the padding spheres have a negative squared radius: they are never hit
+			squared_radius.resize(first + count, -1.0f);
+			return first;
+		}
+
+		void set(uint32_t index, const batch_primitive& primitive)
+		{
+			center_x[index] = primitive.center.x;
+			center_y[index] = primitive.center.y;
+			center_z[index] = primitive.center.z;
+			squared_radius[index] = primitive.radius * primitive.radius;
+		}
+
+		// same equation as sphere::hit, except that the direction of the ray is not expected to be normalized
+		int hit(uint32_t first, int count, const ray& ray, float t_min, float t_max) const
+		{
+			const float4 origin_x(ray.origin.x);
+			const float4 origin_y(ray.origin.y);
+			const float4 origin_z(ray.origin.z);
+			const float4 direction_x(ray.direction.x);
+			const float4 direction_y(ray.direction.y);
+			const float4 direction_z(ray.direction.z);
+			const float a = dot(ray.direction, ray.direction);
+			const float4 inv_a(1.0f / a);
+			const float4 a4(a);
+			const float4 t_min4(t_min);
+			const float4 zero(0.0f);
+
+			float closest = t_max;
+			int closest_index = -1;
+			for (int group = 0; group < count; group += batch_width)
+			{
+				const uint32_t i = first + group;
+				const float4 oc_x = origin_x - float4::load_unaligned(&center_x[i]);
+				const float4 oc_y = origin_y - float4::load_unaligned(&center_y[i]);
+				const float4 oc_z = origin_z - float4::load_unaligned(&center_z[i]);
+
+				const float4 half_b = oc_x * direction_x + oc_y * direction_y + oc_z * direction_z;
+				const float4 c = oc_x * oc_x + oc_y * oc_y + oc_z * oc_z - float4::load_unaligned(&squared_radius[i]);
+				const float4 squared_discriminant = half_b * half_b - a4 * c;
+				const float4 discriminant = sqrt(max(squared_discriminant, zero));
+
+				// use the closest root if it is in front of t_min, the farthest one otherwise
+				const float4 near_root = (zero - (half_b + discriminant)) * inv_a;
+				const float4 far_root = (discriminant - half_b) * inv_a;
+				const float4 root = select(near_root >= t_min4, near_root, far_root);
+
+				const float4 hit_mask = (squared_discriminant >= zero) & (root >= t_min4) & (root <= float4(closest));
+				select_closest(root, hit_mask, group, closest, closest_index);
+			}
+
+			return closest_index;
+		}
+
+		std::vector<float> center_x;
+		std::vector<float> center_y;
+		std::vector<float> center_z;
+		std::vector<float> squared_radius;
+	};
+
+	struct rectangle_batches
+	{
+		void clear()
+		{
+			for (std::vector<float>* values : all())
+			{
+				values->clear();
+			}
+		}
+
+		uint32_t allocate(size_t count)
+		{
+			const auto first = static_cast<uint32_t>(center_x.size());
+			for (std::vector<float>* values : all())
+			{
+				values->resize(first + count, 0.0f);
+			}
+			// the padding rectangles have a null normal: the distance to their plane is never a number
+			return first;
+		}
+
+		void set(uint32_t index, const batch_primitive& primitive)
+		{
+			// the coordinates of a point along u and v are computed with the dual basis of (u, v, normal),
+			// which also handles sheared rectangles
+			const vec3 normal = cross(primitive.u, primitive.v);
+			const vec3 dual_u = cross(primitive.v, normal) / dot(primitive.u, cross(primitive.v, normal));
+			const vec3 dual_v = cross(normal, primitive.u) / dot(primitive.v, cross(normal, primitive.u));
+			center_x[index] = primitive.center.x;
+			center_y[index] = primitive.center.y;
+			center_z[index] = primitive.center.z;
+			normal_x[index] = normal.x;
+			normal_y[index] = normal.y;
+			normal_z[index] = normal.z;
+			u_x[index] = dual_u.x;
+			u_y[index] = dual_u.y;
+			u_z[index] = dual_u.z;
+			v_x[index] = dual_v.x;
+			v_y[index] = dual_v.y;
+			v_z[index] = dual_v.z;
+		}
+
+		int hit(uint32_t first, int count, const ray& ray, float t_min, float t_max) const
+		{
+			const float4 origin_x(ray.origin.x);
+			const float4 origin_y(ray.origin.y);
+			const float4 origin_z(ray.origin.z);
+			const float4 direction_x(ray.direction.x);
+			const float4 direction_y(ray.direction.y);
+			const float4 direction_z(ray.direction.z);
+			const float4 one(1.0f);
+			const float4 t_min4(t_min);
+
+			float closest = t_max;
+			int closest_index = -1;
+			for (int group = 0; group < count; group += batch_width)
+			{
+				const uint32_t i = first + group;
+				const float4 n_x = float4::load_unaligned(&normal_x[i]);
+				const float4 n_y = float4::load_unaligned(&normal_y[i]);
+				const float4 n_z = float4::load_unaligned(&normal_z[i]);
+
+				// distance to the plane of the rectangle
+				const float4 to_center_x = float4::load_unaligned(&center_x[i]) - origin_x;
+				const float4 to_center_y = float4::load_unaligned(&center_y[i]) - origin_y;
+				const float4 to_center_z = float4::load_unaligned(&center_z[i]) - origin_z;
+				const float4 numerator = to_center_x * n_x + to_center_y * n_y + to_center_z * n_z;
+				const float4 denominator = direction_x * n_x + direction_y * n_y + direction_z * n_z;
+				const float4 t = numerator / denominator;
+
+				// coordinates of the hit point relative to the center, along the edges
+				const float4 p_x = direction_x * t - to_center_x;
+				const float4 p_y = direction_y * t - to_center_y;
+				const float4 p_z = direction_z * t - to_center_z;
+				const float4 a = p_x * float4::load_unaligned(&u_x[i]) + p_y * float4::load_unaligned(&u_y[i])
+					+ p_z * float4::load_unaligned(&u_z[i]);
+				const float4 b = p_x * float4::load_unaligned(&v_x[i]) + p_y * float4::load_unaligned(&v_y[i])
+					+ p_z * float4::load_unaligned(&v_z[i]);
+
+				const float4 inside = (abs(a) < one) & (abs(b) < one);
+				const float4 hit_mask = inside & (t >= t_min4) & (t <= float4(closest));
+				select_closest(t, hit_mask, group, closest, closest_index);
+			}
+
+			return closest_index;
+		}
+
+		std::array<std::vector<float>*, 12> all()
+		{
+			return {&center_x, &center_y, &center_z, &normal_x, &normal_y, &normal_z, &u_x, &u_y, &u_z, &v_x, &v_y, &v_z};
+		}
+
+		std::vector<float> center_x, center_y, center_z;
+		std::vector<float> normal_x, normal_y, normal_z;
+		// dual basis of the half edges (see set)
+		std::vector<float> u_x, u_y, u_z;
+		std::vector<float> v_x, v_y, v_z;
+	};
+
+	sphere_batches m_spheres;
+	rectangle_batches m_rectangles;
+};
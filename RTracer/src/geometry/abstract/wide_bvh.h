@@ -0,0 +1,335 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "bvh.h"
+#include "core/simd.h"
+
+/// <summary>
+/// node of a wide bounding volume hierarchy (see wide_bvh)
+/// the bounds of the children are stored as a structure of arrays so that they can be tested all at once with SIMD
+/// </summary>
+template <int Width>
+struct alignas(64) wide_bvh_node
+{
+	float min_x[Width];
+	float min_y[Width];
+	float min_z[Width];
+	float max_x[Width];
+	float max_y[Width];
+	float max_z[Width];
+	// inner child: index of the child node ; leaf child: index of the leaf in the source bvh
+	uint32_t offset[Width];
+	// number of primitives of each leaf child (0 for inner children)
+	uint16_t count[Width];
+	// number of used children: they are always the first ones
+	uint8_t child_count;
+};
+
+static_assert(sizeof(wide_bvh_node<4>) == 128, "wide_bvh_node<4> is expected to fit in two cache lines");
+static_assert(sizeof(wide_bvh_node<8>) == 256, "wide_bvh_node<8> is expected to fit in four cache lines");
+
+/// <summary>
+/// bounding volume hierarchy where each node has up to Width children (4: QBVH, 8: OBVH)
+/// It is built by collapsing a binary bvh: the tree is about log2(Width) times shallower,
+/// and a ray is tested against all the children of a node at once (as a float4 for 4-wide nodes and a float8 for 8-wide nodes)
+/// The leaves are the ones of the binary bvh, which is expected to outlive the wide one:
+/// their primitives are intersected in batches without touching the objects (see bvh::hit_leaf)
+/// </summary>
+template <int Width>
+class wide_bvh
+{
+	static_assert(Width == 4 || Width == 8, "wide_bvh only supports 4-wide and 8-wide nodes");
+
+public:
+	/// <summary>
+	/// build the hierarchy from the given binary bvh: each wide node takes the place of a binary node
+	/// and repeatedly replaces its largest inner child by its two children until it has Width children
+	/// </summary>
+	void build(const bvh& source)
+	{
+		clear();
+		if (source.empty())
+			return;
+
+		m_source = &source;
+		m_nodes.emplace_back();
+		collapse(source.nodes(), 0, 0);
+	}
+
+	/// <summary>
+	/// returns true if the given ray hits one of the primitives at a distance comprised between t_min and t_max
+	/// info records the closest hit (see world::hit). info.distance is expected to be initialized to t_max
+	/// </summary>
+	bool hit(const ray& ray, float t_min, float, hit_info& info) const
+	{
+		return traverse(ray, t_min, info, [this](uint32_t leaf, const ::ray& leaf_ray, float leaf_t_min, hit_info& leaf_info)
+		{
+			return m_source->hit_leaf(leaf, leaf_ray, leaf_t_min, leaf_info);
+		});
+	}
+
+	/// <summary>
+	/// same as hit, with the leaves intersected by the given function, called as leaf(index, ray, t_min, info)
+	/// with the index of the leaf node in the source bvh: the hierarchy can then be traversed over a copy of
+	/// the primitives of the source bvh (see compiled_scene)
+	/// </summary>
+	template <typename LeafFunction>
+	bool traverse(const ray& ray, float t_min, hit_info& info, const LeafFunction& leaf) const
+	{
+		if (m_nodes.empty())
+			return false;
+
+		struct stack_entry
+		{
+			uint32_t offset;
+			uint16_t count;
+			float distance;
+		};
+
+		// each visited node pushes at most Width entries and pops one
+		stack_entry stack[bvh::max_depth * (Width - 1) + 1];
+		int stack_size = 0;
+
+		bool has_hit = false;
+		uint32_t index = 0;
+		while (true)
+		{
+			const wide_bvh_node<Width>& node = m_nodes[index];
+			alignas(32) float distances[Width];
+			int mask = intersect_children(node, ray, t_min, info.distance, distances);
+
+			// push the hit children from the farthest to the closest, so that the closest is visited first
+			const int first = stack_size;
+			while (mask != 0)
+			{
+				const int i = first_bit(mask);
+				mask &= mask - 1;
+
+				int j = stack_size++;
+				while (j > first && stack[j - 1].distance < distances[i])
+				{
+					stack[j] = stack[j - 1];
+					j--;
+				}
+				stack[j] = {node.offset[i], node.count[i], distances[i]};
+			}
+
+			// pop until the next inner node, intersecting the leaves along the way
+			bool has_node = false;
+			while (stack_size > 0 && !has_node)
+			{
+				const stack_entry& entry = stack[--stack_size];
+				// the distance is tested again since a closer hit may have been found after the entry was pushed
+				if (entry.distance >= info.distance)
+					continue;
+
+				if (entry.count == 0)
+				{
+					index = entry.offset;
+					has_node = true;
+				}
+				else
+				{
+					has_hit |= leaf(entry.offset, ray, t_min, info);
+				}
+			}
+
+			if (!has_node)
+				return has_hit;
+		}
+	}
+
+	/// <summary>
+	/// returns true as soon as the given function finds a hit in a leaf, called as leaf(index, ray, t_min, t_max)
+	/// (see bvh::traverse_any): the children are visited in any order, since any hit stops the traversal
+	/// </summary>
+	template <typename LeafFunction>
+	bool traverse_any(const ray& ray, float t_min, float t_max, const LeafFunction& leaf) const
+	{
+		if (m_nodes.empty())
+			return false;
+
+		uint32_t stack[bvh::max_depth * (Width - 1) + 1];
+		int stack_size = 0;
+		uint32_t index = 0;
+		while (true)
+		{
+			const wide_bvh_node<Width>& node = m_nodes[index];
+			alignas(32) float distances[Width];
+			int mask = intersect_children(node, ray, t_min, t_max, distances);
+			while (mask != 0)
+			{
+				const int i = first_bit(mask);
+				mask &= mask - 1;
+
+				if (node.count[i] == 0)
+					stack[stack_size++] = node.offset[i];
+				else if (leaf(node.offset[i], ray, t_min, t_max))
+					return true;
+			}
+
+			if (stack_size == 0)
+				return false;
+			index = stack[--stack_size];
+		}
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return m_nodes.empty();
+	}
+
+	void clear()
+	{
+		m_nodes.clear();
+		m_source = nullptr;
+	}
+
+	[[nodiscard]] const std::vector<wide_bvh_node<Width>>& nodes() const
+	{
+		return m_nodes;
+	}
+
+	/// <summary>
+	/// returns the number of bytes used by the nodes
+	/// </summary>
+	[[nodiscard]] size_t memory_usage() const
+	{
+		return m_nodes.size() * sizeof(wide_bvh_node<Width>);
+	}
+
+private:
+	static int first_bit(int mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, static_cast<unsigned long>(mask));
+		return static_cast<int>(index);
+#else
+		return __builtin_ctz(static_cast<unsigned>(mask));
+#endif
+	}
+
+	/// <summary>
+	/// test the ray against the bounds of all the children of the node (see aabb::entry_distance)
+	/// returns a mask of the hit children and fills distances with the distance at which the ray enters each of them
+	/// </summary>
+	static int intersect_children(const wide_bvh_node<Width>& node, const ray& ray, float t_min, float t_max,
+	                              float* distances)
+	{
+		using children_t = simd_float<Width>;
+		const int valid_mask = (1 << node.child_count) - 1;
+
+		const children_t origin_x(ray.origin.x);
+		const children_t origin_y(ray.origin.y);
+		const children_t origin_z(ray.origin.z);
+		const children_t inv_x(ray.inv_direction.x);
+		const children_t inv_y(ray.inv_direction.y);
+		const children_t inv_z(ray.inv_direction.z);
+
+		const children_t tx0 = (children_t::load(node.min_x) - origin_x) * inv_x;
+		const children_t tx1 = (children_t::load(node.max_x) - origin_x) * inv_x;
+		const children_t ty0 = (children_t::load(node.min_y) - origin_y) * inv_y;
+		const children_t ty1 = (children_t::load(node.max_y) - origin_y) * inv_y;
+		const children_t tz0 = (children_t::load(node.min_z) - origin_z) * inv_z;
+		const children_t tz1 = (children_t::load(node.max_z) - origin_z) * inv_z;
+
+		// operands are ordered so that a NaN (0 * infinity) is ignored, as in bvh::packet_mask
+		children_t t_enter = max(min(tx1, tx0), children_t(t_min));
+		children_t t_exit = min(max(tx0, tx1), children_t(t_max));
+		t_enter = max(min(ty1, ty0), t_enter);
+		t_exit = min(max(ty0, ty1), t_exit);
+		t_enter = max(min(tz1, tz0), t_enter);
+		t_exit = min(max(tz0, tz1), t_exit);
+
+		t_enter.store(distances);
+		return (t_enter <= t_exit).movemask() & valid_mask;
+	}
+
+	void collapse(const std::vector<bvh_node>& source, uint32_t source_index, uint32_t index)
+	{
+		uint32_t children[Width];
+		int child_count = 0;
+		const bvh_node& source_node = source[source_index];
+		if (source_node.is_leaf())
+		{
+			// only happens for the root of a hierarchy made of a single leaf
+			children[child_count++] = source_index;
+		}
+		else
+		{
+			children[child_count++] = source_node.offset;
+			children[child_count++] = source_node.offset + 1;
+			while (child_count < Width)
+			{
+				int largest = -1;
+				float largest_area = -1.0f;
+				for (int i = 0; i < child_count; i++)
+				{
+					const bvh_node& child = source[children[i]];
+					const float area = child.bbox.surface_area();
+					if (!child.is_leaf() && area > largest_area)
+					{
+						largest = i;
+						largest_area = area;
+					}
+				}
+
+				if (largest < 0)
+					break;
+
+				const uint32_t offset = source[children[largest]].offset;
+				children[largest] = offset;
+				children[child_count++] = offset + 1;
+			}
+		}
+
+		wide_bvh_node<Width> node{};
+		node.child_count = static_cast<uint8_t>(child_count);
+		for (int i = 0; i < Width; i++)
+		{
+			// unused children are given empty bounds, they are masked out anyway
+			const aabb& bbox = i < child_count ? source[children[i]].bbox : aabb();
+			node.min_x[i] = bbox.minimum.x;
+			node.min_y[i] = bbox.minimum.y;
+			node.min_z[i] = bbox.minimum.z;
+			node.max_x[i] = bbox.maximum.x;
+			node.max_y[i] = bbox.maximum.y;
+			node.max_z[i] = bbox.maximum.z;
+		}
+
+		// the inner children are allocated side by side before being collapsed themselves
+		for (int i = 0; i < child_count; i++)
+		{
+			const bvh_node& child = source[children[i]];
+			if (child.is_leaf())
+			{
+				node.offset[i] = children[i];
+				node.count[i] = child.count;
+			}
+			else
+			{
+				node.offset[i] = static_cast<uint32_t>(m_nodes.size());
+				m_nodes.emplace_back();
+			}
+		}
+
+		m_nodes[index] = node;
+		for (int i = 0; i < child_count; i++)
+		{
+			if (node.count[i] == 0)
+			{
+				collapse(source, children[i], node.offset[i]);
+			}
+		}
+	}
+
+	std::vector<wide_bvh_node<Width>> m_nodes;
+	// bvh the hierarchy was collapsed from, holding the leaves
+	const bvh* m_source = nullptr;
+};
@@ -21,21 +21,35 @@ public:
 	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) override
 	{
 		const auto [has_hit, axis, distance] = m_aabb.hit_with_info(ray, t_min, t_max);
-		if (has_hit)
-		{
-			info.distance = distance;
-			info.point = ray.at(distance);
-			direction3 outward_normal(0.0f);
-			outward_normal[axis] = 1.0f;
-			info.set_face_normal(ray.direction, outward_normal);
-			const vec2 offset{size * outward_normal};
-			info.uv_coordinates = (vec2(info.point) + offset) / (offset + offset);
-			
-			info.object = this;
-			info.material = material;
-			return true;
-		}
-		return false;
+		if (!has_hit)
+			return false;
+
+		info.distance = distance;
+		// the axis of the hit face is all the evaluation of the surface needs
+		info.local_data = static_cast<uint32_t>(axis);
+		info.object = this;
+		info.primitive = this;
+		return true;
+	}
+
+	void evaluate(const ray& ray, hit_info& info) override
+	{
+		surface(ray, m_aabb, static_cast<int>(info.local_data), info);
+		info.material = material;
+	}
+
+	/// <summary>
+	/// fill the point, the normal and the uv coordinates of a hit at info.distance on the face of the box
+	/// perpendicular to the given axis (shared with compiled_scene)
+	/// </summary>
+	static void surface(const ray& ray, const aabb& bounds, int axis, hit_info& info)
+	{
+		info.point = ray.at(info.distance);
+		direction3 outward_normal(0.0f);
+		outward_normal[axis] = 1.0f;
+		info.set_face_normal(ray.direction, outward_normal);
+		const vec2 offset{(bounds.maximum - bounds.minimum) * outward_normal};
+		info.uv_coordinates = (vec2(info.point) + offset) / (offset + offset);
 	}
 
 	std::shared_ptr<serializable_node_base> serialize() override
@@ -50,6 +64,11 @@ public:
 		return new box(*this);
 	}
 
+	[[nodiscard]] const aabb& bounds() const
+	{
+		return m_aabb;
+	}
+
 	vec3 size;
 
 private:
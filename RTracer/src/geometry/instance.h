@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include <memory>
+
+#include "abstract/geometry_group.h"
+#include "abstract/hittable.h"
+
+/// <summary>
+/// represent a placement of a geometry_group in the world
+/// the group (and its bvh) is shared between all instances: an instance only stores its transform and a pointer.
+/// moving an instance only requires to refit the bvh of the world: the bvh of the group is left untouched.
+/// </summary>
+class instance : public hittable
+{
+public:
+	instance(const char* name, std::shared_ptr<const geometry_group> group, const point3& position = point3(0.0f))
+		: hittable(name), m_group(std::move(group))
+	{
+		// no material by default: the objects of the group keep their own
+		material = nullptr;
+		transform = translate(transform, position);
+		inv_transform = inverse(transform);
+	}
+
+	void internal_update() override
+	{
+		bbox = m_group->bbox;
+	}
+
+	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) override
+	{
+		if (!m_group->hit(ray, t_min, t_max, info))
+			return false;
+
+		// the closest hit of the group is another instance: its surface is evaluated right away,
+		// since the hit only records the instance and the primitive it hit, not the instances in between
+		if (info.object != info.primitive)
+		{
+			info.object->base_evaluate(ray, info);
+			info.primitive = this;
+		}
+
+		// the instance is reported as the hit object so that it can be selected and edited as a whole
+		info.object = this;
+		return true;
+	}
+
+	void evaluate(const ray& ray, hit_info& info) override
+	{
+		// otherwise the surface has already been evaluated by hit
+		if (info.primitive != this)
+			info.primitive->base_evaluate(ray, info);
+
+		if (material != nullptr)
+			info.material = material;
+	}
+
+	[[nodiscard]] hittable* clone() const override
+	{
+		return new instance(*this);
+	}
+
+	[[nodiscard]] const std::shared_ptr<const geometry_group>& group() const
+	{
+		return m_group;
+	}
+
+private:
+	std::shared_ptr<const geometry_group> m_group;
+};
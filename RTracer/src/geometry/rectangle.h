@@ -20,28 +20,68 @@ public:
 		bbox = aabb(point3(-offset), point3(offset));
 	}
 
-	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) override
+	bool base_hit(const ray& base_ray, float t_min, float t_max, hit_info& info) override
+	{
+		if (transform_type > transform_kind::translation)
+			return hittable::base_hit(base_ray, t_min, t_max, info);
+
+		// a rectangle that is only translated is intersected in world space: the ray is not transformed at all
+		return hit_at(base_ray, point3(transform[3]), t_min, t_max, info);
+	}
+
+	void base_evaluate(const ray& base_ray, hit_info& info) override
 	{
-		const float t = -ray.origin.z * ray.inv_direction.z;
-		bool is_hit = t >= t_min && t <= t_max;
-		if (is_hit)
+		if (transform_type > transform_kind::translation)
 		{
-			const vec2 offset{size.x * 0.5f, size.y * 0.5f};
-			const vec2 hitpoint = ray.origin + t * ray.direction;
-			is_hit = all(greaterThan(hitpoint, -offset)) && all(lessThan(hitpoint, offset));
-			if (is_hit)
-			{
-				info.distance = t;
-				info.point = ray.at(info.distance);
-				const direction3 outward_normal(0.0f, 0.0f, 1.0f);
-				info.set_face_normal(ray.direction, outward_normal);
-				info.material = material;
-				info.uv_coordinates = (hitpoint + offset) / (offset + offset);
-				info.object = this;
-			}
+			hittable::base_evaluate(base_ray, info);
+			return;
 		}
 
-		return is_hit;
+		surface(base_ray, point3(transform[3]), size, info);
+		info.material = material;
+	}
+
+	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) override
+	{
+		return hit_at(ray, point3(0.0f), t_min, t_max, info);
+	}
+
+	void evaluate(const ray& ray, hit_info& info) override
+	{
+		surface(ray, point3(0.0f), size, info);
+		info.material = material;
+	}
+
+	/// <summary>
+	/// intersect the ray with a rectangle of the given center and size, facing the z axis
+	/// distance is only set to the distance of the hit if there is one (shared with compiled_scene)
+	/// </summary>
+	static bool intersect(const ray& ray, const point3& center, const vec2& size, float t_min, float t_max,
+	                      float& distance)
+	{
+		const float t = (center.z - ray.origin.z) * ray.inv_direction.z;
+		if (!(t >= t_min && t <= t_max))
+			return false;
+
+		const vec2 offset{size.x * 0.5f, size.y * 0.5f};
+		const vec2 hitpoint = vec2(ray.origin - center) + t * vec2(ray.direction);
+		if (!all(greaterThan(hitpoint, -offset)) || !all(lessThan(hitpoint, offset)))
+			return false;
+
+		distance = t;
+		return true;
+	}
+
+	/// <summary>
+	/// fill the point, the normal and the uv coordinates of a hit found by intersect at info.distance
+	/// </summary>
+	static void surface(const ray& ray, const point3& center, const vec2& size, hit_info& info)
+	{
+		const vec2 offset{size.x * 0.5f, size.y * 0.5f};
+		info.point = ray.at(info.distance);
+		const direction3 outward_normal(0.0f, 0.0f, 1.0f);
+		info.set_face_normal(ray.direction, outward_normal);
+		info.uv_coordinates = (vec2(info.point - center) + offset) / (offset + offset);
 	}
 
 	std::shared_ptr<serializable_node_base> serialize() override
@@ -56,5 +96,67 @@ public:
 		return new rectangle(*this);
 	}
 
+	[[nodiscard]] batch_primitive to_batch_primitive() const override
+	{
+		const glm::mat3 linear(transform);
+		batch_primitive primitive;
+		primitive.kind = batch_kind::rectangle;
+		primitive.center = point3(transform[3]);
+		primitive.u = linear * vec3(size.x * 0.5f, 0.0f, 0.0f);
+		primitive.v = linear * vec3(0.0f, size.y * 0.5f, 0.0f);
+		return primitive;
+	}
+
+	[[nodiscard]] aabb clipped_bbox(int axis, float min, float max) const override
+	{
+		// clip the transformed rectangle (a parallelogram) to the slab, one edge at a time
+		const batch_primitive primitive = to_batch_primitive();
+		const point3 corners[4] = {
+			primitive.center - primitive.u - primitive.v, primitive.center + primitive.u - primitive.v,
+			primitive.center + primitive.u + primitive.v, primitive.center - primitive.u + primitive.v
+		};
+
+		aabb result;
+		for (int i = 0; i < 4; i++)
+		{
+			const point3& a = corners[i];
+			const point3& b = corners[(i + 1) % 4];
+			if (a[axis] >= min && a[axis] <= max)
+			{
+				result.encapsulate(a);
+			}
+
+			// add the points where the edge crosses the planes of the slab
+			for (const float plane : {min, max})
+			{
+				if ((a[axis] < plane) != (b[axis] < plane))
+				{
+					const float t = (plane - a[axis]) / (b[axis] - a[axis]);
+					point3 crossing = a + (b - a) * t;
+					crossing[axis] = plane;
+					result.encapsulate(crossing);
+				}
+			}
+		}
+
+		// keep the thickness given to the bbox by internal_update
+		result.minimum -= vec3(constants::epsilon);
+		result.maximum += vec3(constants::epsilon);
+		return result;
+	}
+
 	vec2 size;
+
+private:
+	bool hit_at(const ray& ray, const point3& center, float t_min, float t_max, hit_info& info)
+	{
+		float distance;
+		if (!intersect(ray, center, size, t_min, t_max, distance))
+			return false;
+
+		info.distance = distance;
+		info.object = this;
+		info.primitive = this;
+		return true;
+	}
 };
@@ -23,40 +23,77 @@ public:
 		bbox = aabb(point3(-size), point3(size));
 	}
 
+	bool base_hit(const ray& base_ray, float t_min, float t_max, hit_info& info) override
+	{
+		if (transform_type > transform_kind::translation)
+			return hittable::base_hit(base_ray, t_min, t_max, info);
+
+		// a sphere that is only translated is intersected in world space: the ray is not transformed at all
+		return hit_at(base_ray, point3(transform[3]), t_min, t_max, info);
+	}
+
+	void base_evaluate(const ray& base_ray, hit_info& info) override
+	{
+		if (transform_type > transform_kind::translation)
+		{
+			hittable::base_evaluate(base_ray, info);
+			return;
+		}
+
+		surface(base_ray, point3(transform[3]), radius, info);
+		info.material = material;
+	}
+
 	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) override
 	{
-		const vec3 oc = ray.origin;
+		return hit_at(ray, point3(0.0f), t_min, t_max, info);
+	}
+
+	void evaluate(const ray& ray, hit_info& info) override
+	{
+		surface(ray, point3(0.0f), radius, info);
+		info.material = material;
+	}
+
+	/// <summary>
+	/// intersect the ray with a sphere of the given center and radius
+	/// distance is only set to the distance of the closest hit if there is one (shared with compiled_scene)
+	/// </summary>
+	static bool intersect(const ray& ray, const point3& center, float radius, float t_min, float t_max,
+	                      float& distance)
+	{
+		// the direction is not normalized when the transform has a scale
+		const vec3 oc = ray.origin - center;
+		const float a = length2(ray.direction);
 		const float half_b = dot(oc, ray.direction);
 		const float c = length2(oc) - radius * radius;
-		const float squared_discriminant = half_b * half_b - c;
+		const float squared_discriminant = half_b * half_b - a * c;
+		if (squared_discriminant < 0)
+			return false;
 
-		bool is_hit = squared_discriminant >= 0;
-		if (is_hit)
+		const float discriminant = std::sqrt(squared_discriminant);
+		const float inv_a = 1.0f / a;
+		float root = (-half_b - discriminant) * inv_a;
+		if (root < t_min || root > t_max)
 		{
-			const float discriminant = std::sqrt(squared_discriminant);
-			float root = (-half_b - discriminant);
-			is_hit = root >= t_min && root <= t_max;
-			if (!is_hit)
-			{
-				root = (-half_b + discriminant);
-				is_hit = root >= t_min && root <= t_max;
-			}
-
-			if (is_hit)
-			{
-				info.distance = root;
-				info.point = ray.at(info.distance);
-				const direction3 outward_normal = info.point / radius;
-				info.set_face_normal(ray.direction, outward_normal);
-				info.material = material;
-				
-				set_uv_at(outward_normal, info.uv_coordinates);
-				info.object = this;
-
-			}
+			root = (-half_b + discriminant) * inv_a;
+			if (root < t_min || root > t_max)
+				return false;
 		}
 
-		return is_hit;
+		distance = root;
+		return true;
+	}
+
+	/// <summary>
+	/// fill the point, the normal and the uv coordinates of a hit found by intersect at info.distance
+	/// </summary>
+	static void surface(const ray& ray, const point3& center, float radius, hit_info& info)
+	{
+		info.point = ray.at(info.distance);
+		const direction3 outward_normal = (info.point - center) / radius;
+		info.set_face_normal(ray.direction, outward_normal);
+		set_uv_at(outward_normal, info.uv_coordinates);
 	}
 
 	std::shared_ptr<serializable_node_base> serialize() override
@@ -71,9 +108,60 @@ public:
 		return new sphere(*this);
 	}
 
+	[[nodiscard]] batch_primitive to_batch_primitive() const override
+	{
+		// only a transform without shear nor non-uniform scale keeps the sphere a sphere
+		const glm::mat3 linear(transform);
+		const float scale = length(linear[0]);
+		const float tolerance = constants::epsilon * scale;
+		if (std::abs(length(linear[1]) - scale) > tolerance || std::abs(length(linear[2]) - scale) > tolerance
+			|| std::abs(dot(linear[0], linear[1])) > tolerance * scale
+			|| std::abs(dot(linear[1], linear[2])) > tolerance * scale
+			|| std::abs(dot(linear[2], linear[0])) > tolerance * scale)
+			return {};
+
+		batch_primitive primitive;
+		primitive.kind = batch_kind::sphere;
+		primitive.center = point3(transform[3]);
+		primitive.radius = radius * scale;
+		return primitive;
+	}
+
+	[[nodiscard]] aabb clipped_bbox(int axis, float min, float max) const override
+	{
+		const batch_primitive primitive = to_batch_primitive();
+		if (primitive.kind != batch_kind::sphere)
+			return hittable::clipped_bbox(axis, min, max);
+
+		// the slab cuts discs out of the sphere: the widest one is the closest to the center
+		const float center = primitive.center[axis];
+		const float distance = std::max({min - center, center - max, 0.0f});
+		const float squared_radius = primitive.radius * primitive.radius - distance * distance;
+		if (squared_radius < 0.0f)
+			return {};
+
+		const vec3 extent(std::sqrt(squared_radius));
+		aabb result(primitive.center - extent, primitive.center + extent);
+		result.minimum[axis] = std::max(center - primitive.radius, min);
+		result.maximum[axis] = std::min(center + primitive.radius, max);
+		return result;
+	}
+
 	float radius;
 
 private:
+	bool hit_at(const ray& ray, const point3& center, float t_min, float t_max, hit_info& info)
+	{
+		float distance;
+		if (!intersect(ray, center, radius, t_min, t_max, distance))
+			return false;
+
+		info.distance = distance;
+		info.object = this;
+		info.primitive = this;
+		return true;
+	}
+
 	static void set_uv_at(const vec3& p, vec2& uv_coordinates)
 	{
 		// p: a given point on the sphere of radius one, centered at the origin.
@@ -18,12 +18,22 @@ public:
 		this->index_of_refraction(index_of_refraction);
 	}
 
-	bool scatter(const ray& raycast, const hit_info& hit, color& attenuation, ray& scattered) const override
+	bool scatter(const ray& raycast, const hit_info& hit, color& attenuation, ray& scattered,
+	             sampler& rng) const override
 	{
-		const float refraction_ratio = hit.front_face ? m_inv_index_of_refraction : m_index_of_refraction;
+		return scatter(raycast, hit, m_index_of_refraction, m_inv_index_of_refraction, attenuation, scattered, rng);
+	}
+
+	/// <summary>
+	/// scatter the ray through a dielectric of the given index of refraction (shared with compiled_scene)
+	/// </summary>
+	static bool scatter(const ray& raycast, const hit_info& hit, float index_of_refraction,
+	                    float inv_index_of_refraction, color& attenuation, ray& scattered, sampler& rng)
+	{
+		const float refraction_ratio = hit.front_face ? inv_index_of_refraction : index_of_refraction;
 		const float cos_theta = fmin(dot(-raycast.direction, hit.normal), 1.0f);
 		const float sin_theta = sqrt(1.0f - cos_theta * cos_theta);
-		if (refraction_ratio * sin_theta < 1.0f || reflectance(cos_theta, refraction_ratio) > random::static_float.get())
+		if (refraction_ratio * sin_theta > 1.0f || reflectance(cos_theta, refraction_ratio) > rng.get())
 		{
 			const direction3 reflected = direction3(reflect(raycast.direction, hit.normal));
 			scattered = ray(hit.point, reflected);
@@ -38,7 +48,7 @@ public:
 		return true;
 	}
 
-	float index_of_refraction()
+	float index_of_refraction() const
 	{
 		return m_index_of_refraction;
 	}
@@ -24,6 +24,14 @@ public:
 
 
 	color value_at(const vec2& uv_coordinates, const point3&) const override
+	{
+		return value_at(data, width, height, uv_coordinates);
+	}
+
+	/// <summary>
+	/// returns the color of the given image at the given uv coordinates (shared with compiled_scene)
+	/// </summary>
+	static color value_at(const stbi_uc* data, int width, int height, const vec2& uv_coordinates)
 	{
 		if (data == nullptr) return color::magenta();
 
@@ -36,7 +44,7 @@ public:
 		if (j >= height) j = height - 1;
 
 		static const float color_scale = 1.0f / 255.0f;
-		const auto pixel_data = data + j * bytes_per_scanline + i * bytes_per_pixel;
+		const auto pixel_data = data + (j * width + i) * bytes_per_pixel;
 		return color(color_scale * pixel_data[0], color_scale * pixel_data[1], color_scale * pixel_data[2]);
 	}
 
@@ -3,6 +3,7 @@
 #include "material.h"
 
 #include "core/color.h"
+#include "core/sampling.h"
 #include "geometry/abstract/hittable.h"
 
 /// <summary>
@@ -22,18 +23,48 @@ public:
 	{
 	}
 
-	bool scatter(const ray&, const hit_info& hit, color& attenuation, ray& scattered) const override
+	bool scatter(const ray&, const hit_info& hit, color& attenuation, ray& scattered,
+	             sampler& rng) const override
 	{
-		direction3 scatter_direction = hit.normal;
-		const vec3 random_unit_vector = vector3::random_in_unit_sphere();
-		if (!is_near_zero(random_unit_vector))
-			scatter_direction += normalize(random_unit_vector);
-
-		scattered = ray(hit.point, scatter_direction);
+		scattered = scattered_ray(hit, rng);
 		attenuation = albedo->value_at(hit.uv_coordinates, hit.point);
 		return true;
 	}
 
+	bool is_specular() const override
+	{
+		return false;
+	}
+
+	float pdf(const ray&, const hit_info& hit, const direction3& direction) const override
+	{
+		return pdf(hit, direction);
+	}
+
+	color eval(const ray&, const hit_info& hit, const direction3& direction) const override
+	{
+		return color(albedo->value_at(hit.uv_coordinates, hit.point) * pdf(hit, direction));
+	}
+
+	/// <summary>
+	/// returns a ray bouncing off the hit in a random direction around its normal, with a density proportional
+	/// to the cosine of the direction with the normal (shared with compiled_scene)
+	/// </summary>
+	static ray scattered_ray(const hit_info& hit, sampler& rng)
+	{
+		// the normals of scaled objects are not unit vectors
+		const sampling::frame frame(normalize(hit.normal));
+		return ray(hit.point, frame.to_world(sampling::cosine_hemisphere(rng)));
+	}
+
+	/// <summary>
+	/// returns the density of the given direction among the ones of scattered_ray (shared with compiled_scene)
+	/// </summary>
+	static float pdf(const hit_info& hit, const direction3& direction)
+	{
+		return std::max(dot(normalize(hit.normal), direction), 0.0f) * constants::inv_pi;
+	}
+
 	texture* albedo;
 
 	static lambertian_material& default_material()
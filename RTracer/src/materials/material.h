@@ -3,6 +3,7 @@
 #include "serializable.h"
 #include "texture.h"
 #include "core/color.h"
+#include "core/sampler.h"
 
 struct hit_info;
 class ray;
@@ -15,7 +16,38 @@ public:
 	{
 	}
 
-	virtual bool scatter(const ray& raycast, const hit_info& rec, color& attenuation, ray& scattered) const = 0;
+	/// <summary>
+	/// scatter the ray off the hit: the random numbers are drawn from rng, the sampler of the current sample
+	/// </summary>
+	virtual bool scatter(const ray& raycast, const hit_info& rec, color& attenuation, ray& scattered,
+	                     sampler& rng) const = 0;
+
+	/// <summary>
+	/// returns true if scatter draws its directions from a finite set (a mirror, a glass): their density cannot be
+	/// evaluated and such a material does not sample the lights (see compiled_scene::direct_light)
+	/// </summary>
+	virtual bool is_specular() const
+	{
+		return true;
+	}
+
+	/// <summary>
+	/// returns the density (per unit of solid angle) with which scatter draws the given direction,
+	/// 0 for the specular materials
+	/// </summary>
+	virtual float pdf(const ray&, const hit_info&, const direction3&) const
+	{
+		return 0.0f;
+	}
+
+	/// <summary>
+	/// returns the fraction of the light arriving from the given direction that is scattered back along the ray,
+	/// times the cosine of the direction with the normal: scatter returns this value divided by pdf as its attenuation
+	/// </summary>
+	virtual color eval(const ray&, const hit_info&, const direction3&) const
+	{
+		return color::black();
+	}
 
 	virtual color emitted(const vec2& coordinates, const point3& point)
 	{
@@ -3,6 +3,7 @@
 #include "material.h"
 
 #include "core/color.h"
+#include "core/sampling.h"
 #include "geometry/abstract/hittable.h"
 
 /// <summary>
@@ -18,14 +19,69 @@ public:
 	{
 	}
 
-	bool scatter(const ray& raycast, const hit_info& hit, color& attenuation, ray& scattered) const override
+	bool scatter(const ray& raycast, const hit_info& hit, color& attenuation, ray& scattered,
+	             sampler& rng) const override
+	{
+		return scatter(raycast, hit, albedo, roughness, attenuation, scattered, rng);
+	}
+
+	bool is_specular() const override
+	{
+		return roughness <= 0.0f;
+	}
+
+	float pdf(const ray& raycast, const hit_info& hit, const direction3& direction) const override
+	{
+		return pdf(raycast, hit, roughness, direction);
+	}
+
+	color eval(const ray& raycast, const hit_info& hit, const direction3& direction) const override
+	{
+		return color(albedo * pdf(raycast, hit, roughness, direction));
+	}
+
+	/// <summary>
+	/// scatter the ray off a metal of the given albedo and roughness (shared with compiled_scene)
+	/// </summary>
+	static bool scatter(const ray& raycast, const hit_info& hit, const color& albedo, float roughness,
+	                    color& attenuation, ray& scattered, sampler& rng)
 	{
 		const auto reflected = direction3(reflect(raycast.direction, hit.normal));
-		scattered = ray(hit.point, direction3(reflected + roughness * vector3::random_in_unit_sphere()));
+		scattered = ray(hit.point, direction3(reflected + roughness * sampling::uniform_ball(rng)));
 		attenuation = albedo;
 		return dot(reflected, hit.normal) > 0.0f;
 	}
 
+	/// <summary>
+	/// returns the density of the given direction among the ones scattered off a metal of the given roughness
+	/// (shared with compiled_scene): the directions go through the points of the ball of radius roughness
+	/// around the tip of the reflected direction, so that the density of a direction is the part of the volume
+	/// of the ball along it
+	/// </summary>
+	static float pdf(const ray& raycast, const hit_info& hit, float roughness, const direction3& direction)
+	{
+		const auto reflected = direction3(reflect(raycast.direction, hit.normal));
+		if (roughness <= 0.0f || dot(reflected, hit.normal) <= 0.0f)
+			return 0.0f;
+
+		// distances along the direction at which it enters and leaves the ball (the balls of radius above 1
+		// contain the hit, where the directions start)
+		const float middle = dot(direction, reflected);
+		const float square_half_chord = middle * middle - length2(reflected) + roughness * roughness;
+		if (!(square_half_chord > 0.0f))
+			return 0.0f;
+		const float half_chord = std::sqrt(square_half_chord);
+		const float exit = middle + half_chord;
+		const float entry = std::max(middle - half_chord, 0.0f);
+		if (exit <= entry)
+			return 0.0f;
+
+		// the part of the cone of a unit solid angle between the distances, (exit^3 - entry^3) / 3,
+		// over the volume of the ball, 4/3 pi roughness^3
+		return (exit - entry) * (exit * exit + exit * entry + entry * entry)
+			/ (4.0f * constants::pi * roughness * roughness * roughness);
+	}
+
 	color albedo;
 	float roughness;
 
@@ -66,13 +66,21 @@ public:
 
 	color value_at(const vec2& uv_coordinates, const point3& p) const override
 	{
-		const auto sines = sin(10 * p.x) * sin(10 * p.y) * sin(10 * p.z);
-		if (sines < 0)
+		if (is_odd(p))
 			return odd->value_at(uv_coordinates, p);
 		else
 			return even->value_at(uv_coordinates, p);
 	}
 
+	/// <summary>
+	/// returns true if the odd texture is the one seen at the given point (shared with compiled_scene)
+	/// </summary>
+	static bool is_odd(const point3& p)
+	{
+		const auto sines = sin(10 * p.x) * sin(10 * p.y) * sin(10 * p.z);
+		return sines < 0;
+	}
+
 	std::shared_ptr<serializable_node_base> serialize() override
 	{
 		return std::make_shared<serializable_node_base>(
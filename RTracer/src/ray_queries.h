@@ -0,0 +1,258 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <vector>
+
+#include "thread_pool.h"
+#include "world.h"
+#include "core/ray_packet.h"
+#include "materials/lambertian_material.h"
+
+/// <summary>
+/// result of a ray of a batch traced by ray_queries::hit
+/// </summary>
+struct ray_query_hit
+{
+	// distance from the origin of the ray to the hit point (infinity if the ray hit nothing)
+	float distance = constants::infinity;
+	// the hit object (nullptr if the ray hit nothing)
+	hittable* object = nullptr;
+	// point, normal and uv coordinates of the hit, in world space
+	point3 point = point3(0.0f);
+	direction3 normal = direction3(0.0f);
+	vec2 uv_coordinates = vec2(0.0f);
+};
+
+/// <summary>
+/// traces large batches of arbitrary rays against a world, for callers using the tracer as a geometry engine
+/// (visibility, line of sight, sampling...): the rays are given as arrays of origins and directions,
+/// and the results are written to an array of hits or of occlusion bits, in the same order.
+/// - the rays are sorted so that coherent rays (close origins, same direction octant) are traced together,
+///   as ray packets (see world::hit)
+/// - the packets are split in tasks run by the threads of the pool
+/// world::hit and world::occluded only read the world (the lazy bvh synchronizes the nodes it expands)
+/// and do not use any random state: batches can be traced from several threads at once, each with its own
+/// ray_queries, as long as the world is not modified meanwhile.
+/// the pool must not be interrupted while a batch is traced (the pool of the renderer is interrupted by scene changes)
+/// </summary>
+class ray_queries
+{
+public:
+	explicit ray_queries(thread_pool& pool, size_t task_count = std::thread::hardware_concurrency())
+		: m_pool(pool), m_task_count(std::max<size_t>(task_count, 1))
+	{
+	}
+
+	/// <summary>
+	/// intersect the rays with the world: hits[i] is filled with the closest hit of the ray i
+	/// at a distance comprised between t_min and t_max
+	/// </summary>
+	void hit(const world& world, const point3* origins, const direction3* directions, size_t count, float t_min,
+	         float t_max, ray_query_hit* hits)
+	{
+		trace(origins, directions, count, [&world, t_min, t_max, hits](const ray_packet& packet, size_t first,
+		                                                                const uint32_t* indices, hit_info* infos)
+		{
+			const uint32_t hit_mask = world.hit(packet, t_min, t_max, infos);
+			for (uint32_t i = 0; i < packet.count; i++)
+			{
+				ray_query_hit& result = hits[first + indices[i]];
+				if (((hit_mask >> i) & 1u) == 0)
+				{
+					result = ray_query_hit{};
+					continue;
+				}
+
+				const hit_info& info = infos[i];
+				result.distance = info.distance;
+				result.object = info.object;
+				result.point = info.point;
+				result.normal = info.normal;
+				result.uv_coordinates = info.uv_coordinates;
+			}
+		});
+	}
+
+	/// <summary>
+	/// test the rays for occlusion only, between t_min and t_max (see world::occluded)
+	/// the bit of the ray i is set in occluded_bits[i / 32] at (i % 32) if the ray is occluded
+	/// occluded_bits must hold occlusion_word_count(count) words
+	/// </summary>
+	void occluded(const world& world, const point3* origins, const direction3* directions, size_t count, float t_min,
+	              float t_max, uint32_t* occluded_bits)
+	{
+		// each task owns whole packets but not whole words: the bits are gathered as bytes first
+		m_occluded.assign(count, 0);
+		trace(origins, directions, count, [this, &world, t_min, t_max](const ray_packet& packet, size_t first,
+		                                                               const uint32_t* indices, hit_info*)
+		{
+			const uint32_t occluded_mask = world.occluded(packet, t_min, t_max);
+			for (uint32_t i = 0; i < packet.count; i++)
+			{
+				m_occluded[first + indices[i]] = static_cast<uint8_t>((occluded_mask >> i) & 1u);
+			}
+		});
+
+		std::fill_n(occluded_bits, occlusion_word_count(count), 0u);
+		for (size_t i = 0; i < count; i++)
+		{
+			occluded_bits[i / 32] |= static_cast<uint32_t>(m_occluded[i]) << (i % 32);
+		}
+	}
+
+	/// <summary>
+	/// returns the number of words written by occluded for the given number of rays
+	/// </summary>
+	[[nodiscard]] static size_t occlusion_word_count(size_t ray_count)
+	{
+		return (ray_count + 31) / 32;
+	}
+
+	// if false, the rays are traced in the order they are given (e.g. if they are already coherent)
+	bool sort_rays{true};
+
+	// the rays of a batch are sorted by sub-batches of at most this many rays: the index of a ray in its sub-batch
+	// is stored in the low 31 bits of its sort key (see sort)
+	static constexpr size_t max_sub_batch_size = size_t{1} << 31;
+
+private:
+	/// <summary>
+	/// sort the rays, group them in packets and run trace_packet on each one of them from the threads of the pool
+	/// trace_packet is given the packet, the index of the first ray of its sub-batch (see max_sub_batch_size),
+	/// the indices of its rays in the sub-batch and a hit_info for each one of them
+	/// </summary>
+	template <typename PacketFunction>
+	void trace(const point3* origins, const direction3* directions, size_t count, const PacketFunction& trace_packet)
+	{
+		for (size_t first = 0; first < count; first += max_sub_batch_size)
+		{
+			trace_sub_batch(origins + first, directions + first, std::min(count - first, max_sub_batch_size),
+			                [first, &trace_packet](const ray_packet& packet, const uint32_t* indices, hit_info* infos)
+			                {
+				                trace_packet(packet, first, indices, infos);
+			                });
+		}
+	}
+
+	/// <summary>
+	/// same as trace for at most max_sub_batch_size rays: trace_packet is given the indices of the rays of the packet
+	/// </summary>
+	template <typename PacketFunction>
+	void trace_sub_batch(const point3* origins, const direction3* directions, size_t count,
+	                     const PacketFunction& trace_packet)
+	{
+		if (count == 0)
+			return;
+
+		m_order.resize(count);
+		std::iota(m_order.begin(), m_order.end(), 0u);
+		if (sort_rays)
+			sort(origins, directions, count);
+
+		// a task traces a contiguous range of packets
+		const size_t packet_count = (count + ray_packet::max_size - 1) / ray_packet::max_size;
+		run_tasks(packet_count, [this, origins, directions, count, &trace_packet](size_t first, size_t last)
+		{
+			ray_packet packet;
+			std::vector<hit_info> infos(ray_packet::max_size, hit_info{&lambertian_material::default_material()});
+			for (size_t p = first; p < last; p++)
+			{
+				const size_t begin = p * ray_packet::max_size;
+				const size_t end = std::min(begin + ray_packet::max_size, count);
+				packet.clear();
+				for (size_t i = begin; i < end; i++)
+				{
+					packet.add(ray(origins[m_order[i]], directions[m_order[i]]));
+				}
+				trace_packet(packet, m_order.data() + begin, infos.data());
+			}
+		});
+	}
+
+	/// <summary>
+	/// split [0, item_count) in contiguous ranges and run run_range(first, last) on each one of them
+	/// from the threads of the pool, then wait for all of them
+	/// </summary>
+	template <typename RangeFunction>
+	void run_tasks(size_t item_count, const RangeFunction& run_range)
+	{
+		const size_t task_count = std::min(m_task_count, item_count);
+		const size_t items_per_task = (item_count + task_count - 1) / task_count;
+
+		// the futures returned by the pool are waited on, instead of thread_pool::wait,
+		// so that other tasks running on the pool (e.g. a render) are not waited for
+		std::vector<std::function<void()>> tasks;
+		for (size_t first = 0; first < item_count; first += items_per_task)
+		{
+			tasks.emplace_back(m_pool.async(run_range, first, std::min(first + items_per_task, item_count)));
+		}
+		for (const auto& task : tasks)
+		{
+			task();
+		}
+	}
+
+	/// <summary>
+	/// sort m_order by the octant of the direction of the rays, then along a morton curve through their origins,
+	/// so that consecutive rays traverse the same nodes of the bvh
+	/// count must not exceed max_sub_batch_size
+	/// </summary>
+	void sort(const point3* origins, const direction3* directions, size_t count)
+	{
+		aabb bounds;
+		for (size_t i = 0; i < count; i++)
+		{
+			bounds.encapsulate(origins[i]);
+		}
+		const vec3 extent = glm::max(bounds.maximum - bounds.minimum, vec3(constants::epsilon));
+		const vec3 scale = vec3(1023.0f) / extent;
+
+		// the keys are computed by the threads of the pool, split as the packets are by trace
+		m_keys.resize(count);
+		run_tasks(count, [this, origins, directions, &bounds, &scale](size_t first, size_t last)
+		{
+			for (size_t i = first; i < last; i++)
+			{
+				const vec3 cell = (origins[i] - bounds.minimum) * scale;
+				const direction3& direction = directions[i];
+				const uint64_t octant = static_cast<uint64_t>(direction.x < 0.0f)
+					| static_cast<uint64_t>(direction.y < 0.0f) << 1
+					| static_cast<uint64_t>(direction.z < 0.0f) << 2;
+				const uint64_t morton = spread_bits(static_cast<uint32_t>(cell.x))
+					| spread_bits(static_cast<uint32_t>(cell.y)) << 1
+					| spread_bits(static_cast<uint32_t>(cell.z)) << 2;
+				// the index is kept in the low bits so that the keys are unique
+				m_keys[i] = (octant << 61 | morton << 31) | i;
+			}
+		});
+
+		std::sort(m_keys.begin(), m_keys.end());
+		for (size_t i = 0; i < count; i++)
+		{
+			m_order[i] = static_cast<uint32_t>(m_keys[i] & 0x7fffffffu);
+		}
+	}
+
+	/// <summary>
+	/// insert two zeros between each of the 10 lowest bits of value (morton code of one coordinate)
+	/// </summary>
+	static uint64_t spread_bits(uint32_t value)
+	{
+		uint64_t x = std::min(value, 1023u);
+		x = (x | x << 16) & 0x030000FFu;
+		x = (x | x << 8) & 0x0300F00Fu;
+		x = (x | x << 4) & 0x030C30C3u;
+		x = (x | x << 2) & 0x09249249u;
+		return x;
+	}
+
+	thread_pool& m_pool;
+	size_t m_task_count;
+	// indices of the rays of the batch in the order they are traced
+	std::vector<uint32_t> m_order;
+	std::vector<uint64_t> m_keys;
+	std::vector<uint8_t> m_occluded;
+};
@@ -0,0 +1,1484 @@
+﻿#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "world.h"
+#include "geometry/box.h"
+#include "geometry/instance.h"
+#include "geometry/rectangle.h"
+#include "geometry/sphere.h"
+#include "materials/dieletric_material.h"
+#include "materials/image_texture.h"
+#include "materials/lambertian_material.h"
+#include "materials/metal_material.h"
+#include "materials/texture.h"
+#include "renderer/light_list.h"
+#include "renderer/raytrace_settings.h"
+
+/// <summary>
+/// what changed in a world since it was compiled (see compiled_scene::update)
+/// </summary>
+struct scene_changes
+{
+	// objects were moved or resized (see world::signal_object_change)
+	bool geometry = false;
+	// properties of materials or textures were edited, without assigning other materials to the objects
+	bool materials = false;
+	// anything else: objects added or removed, materials assigned... the scene is compiled from scratch
+	bool structure = false;
+
+	static scene_changes all()
+	{
+		return {true, true, true};
+	}
+
+	void merge(const scene_changes& other)
+	{
+		geometry |= other.geometry;
+		materials |= other.materials;
+		structure |= other.structure;
+	}
+};
+
+/// <summary>
+/// read-only representation of a world (with the materials and textures it uses) made for rendering:
+/// the editable objects, materials and textures are compiled into flat arrays, one per type, so that rendering
+/// never goes through a virtual call. Primitives are dispatched with a switch on their kind,
+/// materials and textures are tagged unions (std::variant) dispatched at compile time with std::visit.
+/// The emissive spheres and rectangles of the world are gathered in a light_list (see direct_light).
+/// The top of the world is traversed with the bvh layout selected in the world (or its lazy bvh),
+/// and its groups with binary bvhs.
+/// The scene is updated whenever the world changes (see update and raytrace_render_thread::render).
+/// Objects, materials and textures of types unknown to the compiler are kept as is and go through their virtual calls.
+/// </summary>
+class compiled_scene
+{
+public:
+	/// <summary>
+	/// kind of a primitive, i.e. the array it is stored in
+	/// </summary>
+	enum class primitive_kind : uint8_t
+	{
+		sphere,
+		rectangle,
+		box,
+		instance,
+		// spheres and rectangles that are only translated, baked into world space
+		baked_sphere,
+		baked_rectangle,
+		other
+	};
+
+	/// <summary>
+	/// compile the objects of the world, their materials and their textures
+	/// the bvh of the world is shared when it is built, and so is its lazy bvh with world::lazy_build:
+	/// the rays of the render keep expanding it as they reach its nodes, as with world::hit.
+	/// A bvh is only built for the compiled scene when the world has none
+	/// </summary>
+	void compile(const world& world)
+	{
+		const auto chrono_start = std::chrono::high_resolution_clock::now();
+
+		clear();
+		m_world = &world;
+		m_rebuild_count = world.rebuild_count;
+		m_use_bvh = world.use_bvh;
+		// the default material comes first so that it is also the material of a default hit_info
+		compile_material(&lambertian_material::default_material());
+
+		if (!world.use_bvh)
+		{
+			compile_tree(m_tree, world.hittables(), nullptr);
+		}
+		else if (world.lazy_build && !world.get_lazy_bvh().empty())
+		{
+			// the leaves of the lazy bvh give the indices of their objects in the world, i.e. of their references
+			compile_tree(m_tree, world.hittables(), nullptr);
+			m_lazy_bvh = &world.get_lazy_bvh();
+		}
+		else if (!world.get_bvh().empty())
+		{
+			compile_tree(m_tree, world.get_bvh().primitives(), &world.get_bvh());
+			m_shares_bvh = true;
+		}
+		else
+		{
+			bvh hierarchy;
+			bvh_builder::build(world.hittables(), world.build_method, hierarchy);
+			compile_tree(m_tree, hierarchy.primitives(), &hierarchy);
+		}
+		compile_layout(world);
+		compile_lights();
+
+		// the maps only serve to share what is referenced several times while compiling
+		m_primitive_references.clear();
+		m_material_indices.clear();
+		m_texture_indices.clear();
+		m_group_indices.clear();
+
+		const auto chrono_stop = std::chrono::high_resolution_clock::now();
+		last_compile_duration = std::chrono::duration<float, std::milli>(chrono_stop - chrono_start).count();
+	}
+
+	/// <summary>
+	/// bring the compiled scene up to date with the world, given what changed since it was last compiled or updated:
+	/// moved objects only update their primitives and the bounds of the nodes (refitted by the world),
+	/// edited materials only compile the materials and textures again.
+	/// The scene is compiled from scratch when the world was restructured (e.g. its bvh was rebuilt)
+	/// </summary>
+	void update(const world& world, const scene_changes& changes)
+	{
+		if (changes.structure || m_world != &world || m_rebuild_count != world.rebuild_count
+			|| m_use_bvh != world.use_bvh)
+		{
+			compile(world);
+			return;
+		}
+
+		const bool layout_changed = m_layout != world.get_bvh_layout();
+		if (!changes.geometry && !changes.materials && !layout_changed)
+			return;
+
+		const auto chrono_start = std::chrono::high_resolution_clock::now();
+
+		if (changes.geometry && !update_geometry(world))
+		{
+			compile(world);
+			return;
+		}
+		// the wide nodes are collapsed again by the world after a refit
+		if (changes.geometry || layout_changed)
+			compile_layout(world);
+		if (changes.materials)
+			update_materials();
+		if (changes.geometry || changes.materials)
+			update_lights();
+
+		const auto chrono_stop = std::chrono::high_resolution_clock::now();
+		last_compile_duration = std::chrono::duration<float, std::milli>(chrono_stop - chrono_start).count();
+	}
+
+	void clear()
+	{
+		m_world = nullptr;
+		m_rebuild_count = -1;
+		m_shares_bvh = false;
+		m_lazy_bvh = nullptr;
+		m_layout = bvh_layout::binary;
+		m_tree4.clear();
+		m_tree8.clear();
+		m_compressed_tree.clear();
+		m_tree = {};
+		m_groups.clear();
+		m_spheres.clear();
+		m_rectangles.clear();
+		m_boxes.clear();
+		m_instances.clear();
+		m_baked_spheres.clear();
+		m_baked_rectangles.clear();
+		m_others.clear();
+		m_materials.clear();
+		m_material_sources.clear();
+		m_textures.clear();
+		m_lights.clear();
+	}
+
+	/// <summary>
+	/// same as world::hit: info is filled with the closest hit, with the index of its material (see scatter)
+	/// </summary>
+	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) const
+	{
+		info.distance = t_max;
+		if (!hit_world(ray, t_min, t_max, info))
+			return false;
+
+		evaluate(unpack(info.object_index), ray, info);
+		return true;
+	}
+
+	/// <summary>
+	/// same as world::hit for a ray packet: the bvh is traversed once for the whole packet
+	/// (the binary bvh, whatever the selected layout)
+	/// </summary>
+	uint32_t hit(const ray_packet& packet, float t_min, float t_max, hit_info* infos) const
+	{
+		if (m_tree.nodes.empty())
+		{
+			uint32_t hit_mask = 0;
+			for (uint32_t i = 0; i < packet.count; i++)
+			{
+				hit_mask |= static_cast<uint32_t>(hit(packet.rays[i], t_min, t_max, infos[i])) << i;
+			}
+			return hit_mask;
+		}
+
+		for (uint32_t i = 0; i < packet.count; i++)
+		{
+			infos[i].distance = t_max;
+		}
+
+		const uint32_t hit_mask = bvh::traverse(m_tree.nodes, packet, t_min, infos, leaf_function{this, &m_tree});
+		for (uint32_t i = 0; i < packet.count; i++)
+		{
+			if ((hit_mask >> i) & 1u)
+				evaluate(unpack(infos[i].object_index), packet.rays[i], infos[i]);
+		}
+		return hit_mask;
+	}
+
+	/// <summary>
+	/// same as world::occluded: returns true if the ray hits any primitive between t_min and t_max
+	/// </summary>
+	bool occluded(const ray& ray, float t_min, float t_max) const
+	{
+		if (m_lazy_bvh != nullptr)
+		{
+			return m_lazy_bvh->traverse_any(ray, t_min, t_max,
+			                                [this](hittable&, uint32_t object, const ::ray& leaf_ray, float leaf_t_min,
+			                                       float leaf_t_max)
+			                                {
+				                                return occluded(m_tree.references[object], leaf_ray, leaf_t_min, leaf_t_max);
+			                                });
+		}
+
+		switch (m_layout)
+		{
+		case bvh_layout::wide4:
+			return m_tree4.traverse_any(ray, t_min, t_max, occluded_leaf_function{this, &m_tree});
+		case bvh_layout::wide8:
+			return m_tree8.traverse_any(ray, t_min, t_max, occluded_leaf_function{this, &m_tree});
+		case bvh_layout::compressed4:
+			return m_compressed_tree.traverse_any(ray, t_min, t_max, occluded_leaf_function{this, &m_tree});
+		default:
+			return occluded(m_tree, ray, t_min, t_max);
+		}
+	}
+
+	/// <summary>
+	/// same as world::occluded for a ray packet: returns the mask of the occluded rays
+	/// (the binary bvh is traversed once for the whole packet, whatever the selected layout)
+	/// </summary>
+	uint32_t occluded(const ray_packet& packet, float t_min, float t_max) const
+	{
+		if (m_tree.nodes.empty())
+		{
+			uint32_t occluded_mask = 0;
+			for (uint32_t i = 0; i < packet.count; i++)
+			{
+				occluded_mask |= static_cast<uint32_t>(occluded(packet.rays[i], t_min, t_max)) << i;
+			}
+			return occluded_mask;
+		}
+		return bvh::traverse_any(m_tree.nodes, packet, t_min, t_max, occluded_leaf_function{this, &m_tree});
+	}
+
+	/// <summary>
+	/// same as material::emitted, for the material of the hit
+	/// </summary>
+	[[nodiscard]] color emitted(const hit_info& hit) const
+	{
+		const compiled_material& material = m_materials[hit.material_index];
+		if (const auto* other = std::get_if<::material*>(&material.model))
+			return (*other)->emitted(hit.uv_coordinates, hit.point);
+
+		// most materials do not emit light: their emission texture is not even sampled
+		if (material.emission_strength == 0.0f)
+			return color::black();
+		return color(material.emission_strength * value_at(material.emission, hit.uv_coordinates, hit.point));
+	}
+
+	/// <summary>
+	/// same as material::scatter, for the material of the hit
+	/// </summary>
+	bool scatter(const ray& raycast, const hit_info& hit, color& attenuation, ray& scattered,
+	             sampler& rng) const
+	{
+		return std::visit([this, &raycast, &hit, &attenuation, &scattered, &rng](const auto& model)
+		{
+			return scatter(model, raycast, hit, attenuation, scattered, rng);
+		}, m_materials[hit.material_index].model);
+	}
+
+	/// <summary>
+	/// same as material::is_specular, for the material of the hit
+	/// </summary>
+	[[nodiscard]] bool is_specular(const hit_info& hit) const
+	{
+		return std::visit([](const auto& model)
+		{
+			return is_specular(model);
+		}, m_materials[hit.material_index].model);
+	}
+
+	/// <summary>
+	/// same as material::pdf, for the material of the hit
+	/// </summary>
+	[[nodiscard]] float pdf(const ray& raycast, const hit_info& hit, const direction3& direction) const
+	{
+		return std::visit([&raycast, &hit, &direction](const auto& model)
+		{
+			return pdf(model, raycast, hit, direction);
+		}, m_materials[hit.material_index].model);
+	}
+
+	/// <summary>
+	/// same as material::eval, for the material of the hit
+	/// </summary>
+	[[nodiscard]] color eval(const ray& raycast, const hit_info& hit, const direction3& direction) const
+	{
+		return std::visit([this, &raycast, &hit, &direction](const auto& model)
+		{
+			return eval(model, raycast, hit, direction);
+		}, m_materials[hit.material_index].model);
+	}
+
+	/// <summary>
+	/// light arriving directly from the lights at the hit and scattered by its material in the direction of the ray
+	/// that hit it (next-event estimation): a point of a light is sampled (see light_list::sample)
+	/// and a shadow ray is traced towards it. With multiple importance sampling, the light is weighted against
+	/// the density with which the material scatters its direction (see scattered_light_weight).
+	/// The specular materials do not sample the lights: it returns false for them, whose light only comes
+	/// from their scattered rays
+	/// </summary>
+	bool direct_light(const ray& raycast, const hit_info& hit, raytrace_light_sampling light_sampling, sampler& rng,
+	                  color& light) const
+	{
+		if (light_sampling == raytrace_light_sampling::none || m_lights.empty() || is_specular(hit))
+			return false;
+
+		light = color::black();
+		light_sample sample;
+		// the lights are convex: they do not light themselves
+		if (!m_lights.sample(hit.point, rng, sample) || sample.object_index == hit.object_index)
+			return true;
+
+		const float scatter_pdf = pdf(raycast, hit, sample.direction);
+		if (!(scatter_pdf > 0.0f))
+			return true;
+
+		// the shadow ray stops short of the light so that the light does not occlude itself
+		const ray shadow_ray(hit.point, sample.direction);
+		if (occluded(shadow_ray, 0.001f, sample.distance * 0.999f))
+			return true;
+
+		hit_info light_hit{nullptr};
+		light_hit.distance = sample.distance;
+		evaluate(unpack(sample.object_index), shadow_ray, light_hit);
+		float weight = 1.0f;
+		if (light_sampling == raytrace_light_sampling::mis_balance)
+			weight = sampling::balance_heuristic(sample.pdf, scatter_pdf);
+		else if (light_sampling == raytrace_light_sampling::mis_power)
+			weight = sampling::power_heuristic(sample.pdf, scatter_pdf);
+		light = color(emitted(light_hit) * eval(raycast, hit, sample.direction) * (weight / sample.pdf));
+		return true;
+	}
+
+	/// <summary>
+	/// returns the weight of the light emitted by the hit of a ray scattered by a hit that sampled the lights
+	/// (see direct_light), with scatter_pdf the density of its direction: the light of the lights is either
+	/// already counted by direct_light, or weighted against the density with which direct_light samples the direction.
+	/// The other emissive objects are not sampled: their light is always counted
+	/// </summary>
+	[[nodiscard]] float scattered_light_weight(const ray& raycast, const hit_info& hit, float scatter_pdf,
+	                                           raytrace_light_sampling light_sampling) const
+	{
+		const uint32_t light = light_index(hit);
+		if (light == light_list::no_light)
+			return 1.0f;
+
+		switch (light_sampling)
+		{
+		case raytrace_light_sampling::mis_balance:
+			return sampling::balance_heuristic(scatter_pdf, m_lights.pdf(light, raycast.origin, raycast.direction, hit.point));
+		case raytrace_light_sampling::mis_power:
+			return sampling::power_heuristic(scatter_pdf, m_lights.pdf(light, raycast.origin, raycast.direction, hit.point));
+		default:
+			return 0.0f;
+		}
+	}
+
+	[[nodiscard]] const light_list& lights() const
+	{
+		return m_lights;
+	}
+
+	/// <summary>
+	/// returns the type of the material of the hit (the index of its alternative in the tagged union)
+	/// used to group the hits by material type (see wavefront_integrator)
+	/// </summary>
+	[[nodiscard]] size_t material_type(const hit_info& hit) const
+	{
+		return m_materials[hit.material_index].model.index();
+	}
+
+	[[nodiscard]] size_t primitive_count(primitive_kind kind) const
+	{
+		switch (kind)
+		{
+		case primitive_kind::sphere:
+			return m_spheres.size();
+		case primitive_kind::rectangle:
+			return m_rectangles.size();
+		case primitive_kind::box:
+			return m_boxes.size();
+		case primitive_kind::instance:
+			return m_instances.size();
+		case primitive_kind::baked_sphere:
+			return m_baked_spheres.size();
+		case primitive_kind::baked_rectangle:
+			return m_baked_rectangles.size();
+		default:
+			return m_others.size();
+		}
+	}
+
+	[[nodiscard]] size_t material_count() const
+	{
+		return m_materials.size();
+	}
+
+	// duration of the last compile (in milliseconds)
+	float last_compile_duration{0.0f};
+
+private:
+	/// <summary>
+	/// reference to a primitive: the array it is stored in and its index in that array
+	/// </summary>
+	struct primitive_reference
+	{
+		primitive_kind kind = primitive_kind::other;
+		uint32_t index = 0;
+	};
+
+	/// <summary>
+	/// packs a primitive reference into the 32 bits of hit_info::object_index or hit_info::primitive_index
+	/// </summary>
+	static uint32_t pack(const primitive_reference& reference)
+	{
+		return static_cast<uint32_t>(reference.kind) << 29 | reference.index;
+	}
+
+	static primitive_reference unpack(uint32_t packed)
+	{
+		return {static_cast<primitive_kind>(packed >> 29), packed & ((1u << 29) - 1u)};
+	}
+
+	/// <summary>
+	/// primitives of the world or of a geometry_group, with the nodes of their bvh (if any)
+	/// the leaves of the nodes reference a range of references, as in bvh
+	/// </summary>
+	struct compiled_tree
+	{
+		std::vector<bvh_node> nodes;
+		std::vector<primitive_reference> references;
+		primitive_batches batches;
+		std::vector<uint32_t> batch_indices;
+	};
+
+	/// <summary>
+	/// primitive of a given shape, with what hittable::base_hit needs to intersect it in world space
+	/// </summary>
+	template <typename Shape>
+	struct compiled_primitive
+	{
+		glm::mat4 transform;
+		glm::mat4 inv_transform;
+		transform_kind transform_type;
+		Shape shape;
+		uint32_t material;
+		// reported in hit_info::object
+		hittable* object;
+		// index in the light list, if the primitive is a light (see compile_lights)
+		uint32_t light = light_list::no_light;
+	};
+
+	/// <summary>
+	/// primitive of a given shape that is intersected directly in world space, without any matrix work
+	/// </summary>
+	template <typename Shape>
+	struct baked_primitive
+	{
+		point3 center;
+		Shape shape;
+		uint32_t material;
+		hittable* object;
+		uint32_t light = light_list::no_light;
+	};
+
+	struct sphere_shape
+	{
+		float radius;
+	};
+
+	struct rectangle_shape
+	{
+		vec2 size;
+	};
+
+	struct box_shape
+	{
+		aabb bounds;
+	};
+
+	/// <summary>
+	/// placement of a compiled geometry_group (see instance)
+	/// </summary>
+	struct instance_shape
+	{
+		uint32_t group;
+		// replaces the materials of the group if set
+		bool has_material;
+	};
+
+	struct compiled_lambertian
+	{
+		uint32_t albedo;
+	};
+
+	struct compiled_metal
+	{
+		color albedo;
+		float roughness;
+	};
+
+	struct compiled_dielectric
+	{
+		float index_of_refraction;
+		float inv_index_of_refraction;
+	};
+
+	struct compiled_material
+	{
+		std::variant<compiled_lambertian, compiled_metal, compiled_dielectric, material*> model;
+		uint32_t emission = 0;
+		float emission_strength = 0.0f;
+	};
+
+	struct compiled_solid_color
+	{
+		color value;
+	};
+
+	struct compiled_checker
+	{
+		uint32_t odd;
+		uint32_t even;
+	};
+
+	struct compiled_image
+	{
+		const stbi_uc* data;
+		int width;
+		int height;
+	};
+
+	using compiled_texture = std::variant<compiled_solid_color, compiled_checker, compiled_image, const texture*>;
+
+	/// <summary>
+	/// leaf function given to bvh::traverse to intersect the references of a compiled_tree
+	/// the wide bvhs give the index of the leaf in the nodes instead (see wide_bvh::traverse)
+	/// </summary>
+	struct leaf_function
+	{
+		const compiled_scene* owner;
+		const compiled_tree* tree;
+
+		bool operator()(const bvh_node& node, const ::ray& ray, float t_min, hit_info& info) const
+		{
+			return owner->hit_leaf(*tree, node, ray, t_min, info);
+		}
+
+		bool operator()(uint32_t leaf, const ::ray& ray, float t_min, hit_info& info) const
+		{
+			return owner->hit_leaf(*tree, tree->nodes[leaf], ray, t_min, info);
+		}
+	};
+
+	/// <summary>
+	/// leaf function given to bvh::traverse_any to test the references of a compiled_tree
+	/// </summary>
+	struct occluded_leaf_function
+	{
+		const compiled_scene* owner;
+		const compiled_tree* tree;
+
+		bool operator()(const bvh_node& node, const ::ray& ray, float t_min, float t_max) const
+		{
+			return owner->occluded_leaf(*tree, node, ray, t_min, t_max);
+		}
+
+		bool operator()(uint32_t leaf, const ::ray& ray, float t_min, float t_max) const
+		{
+			return owner->occluded_leaf(*tree, tree->nodes[leaf], ray, t_min, t_max);
+		}
+	};
+
+	/// <summary>
+	/// copy the wide bvh of the layout selected in the world: its leaves are the ones of the world bvh,
+	/// i.e. the leaves of m_tree.nodes. Only the binary layout is available when the world bvh is not shared
+	/// </summary>
+	void compile_layout(const world& world)
+	{
+		m_layout = m_shares_bvh ? world.get_bvh_layout() : bvh_layout::binary;
+		m_tree4.clear();
+		m_tree8.clear();
+		m_compressed_tree.clear();
+		switch (m_layout)
+		{
+		case bvh_layout::wide4:
+			m_tree4 = world.get_wide_bvh4();
+			break;
+		case bvh_layout::wide8:
+			m_tree8 = world.get_wide_bvh8();
+			break;
+		case bvh_layout::compressed4:
+			m_compressed_tree = world.get_compressed_bvh();
+			break;
+		default:
+			break;
+		}
+	}
+
+	/// <summary>
+	/// update the primitives after objects of the world were moved or resized, and the nodes after the world bvh
+	/// was refitted: the bvh keeps its topology and the batched primitives their kind (see bvh::refit),
+	/// so the nodes are copied again and the batches refilled in place.
+	/// returns false if the scene has to be compiled again (e.g. a baked primitive is not only translated anymore)
+	/// </summary>
+	bool update_geometry(const world& world)
+	{
+		// the lazy bvh is refitted by the world itself (see lazy_bvh::refit)
+		if (m_use_bvh && !m_shares_bvh && m_lazy_bvh == nullptr)
+			return false;
+
+		for (compiled_primitive<sphere_shape>& primitive : m_spheres)
+		{
+			update(primitive, sphere_shape{static_cast<const sphere*>(primitive.object)->radius});
+		}
+		for (compiled_primitive<rectangle_shape>& primitive : m_rectangles)
+		{
+			update(primitive, rectangle_shape{static_cast<const rectangle*>(primitive.object)->size});
+		}
+		for (compiled_primitive<box_shape>& primitive : m_boxes)
+		{
+			update(primitive, box_shape{static_cast<const box*>(primitive.object)->bounds()});
+		}
+		for (compiled_primitive<instance_shape>& primitive : m_instances)
+		{
+			update(primitive, primitive.shape);
+		}
+		for (baked_primitive<sphere_shape>& primitive : m_baked_spheres)
+		{
+			if (!update(primitive, sphere_shape{static_cast<const sphere*>(primitive.object)->radius}))
+				return false;
+		}
+		for (baked_primitive<rectangle_shape>& primitive : m_baked_rectangles)
+		{
+			if (!update(primitive, rectangle_shape{static_cast<const rectangle*>(primitive.object)->size}))
+				return false;
+		}
+
+		if (!m_shares_bvh)
+			return true;
+
+		const bvh& hierarchy = world.get_bvh();
+		if (hierarchy.nodes().size() != m_tree.nodes.size())
+			return false;
+
+		m_tree.nodes = hierarchy.nodes();
+		const std::vector<hittable*>& objects = hierarchy.primitives();
+		for (const bvh_node& node : m_tree.nodes)
+		{
+			if (!node.is_leaf())
+				continue;
+
+			for (uint32_t j = 0; j < node.batch_count; j++)
+			{
+				m_tree.batches.set(m_tree.batch_indices[node.offset + j], objects[node.offset + j]->to_batch_primitive());
+			}
+		}
+		return true;
+	}
+
+	template <typename Shape>
+	static void update(compiled_primitive<Shape>& primitive, const Shape& shape)
+	{
+		const hittable* object = primitive.object;
+		primitive.transform = object->transform;
+		primitive.inv_transform = object->inv_transform;
+		primitive.transform_type = object->transform_type;
+		primitive.shape = shape;
+	}
+
+	template <typename Shape>
+	static bool update(baked_primitive<Shape>& primitive, const Shape& shape)
+	{
+		const hittable* object = primitive.object;
+		if (object->transform_type > transform_kind::translation)
+			return false;
+
+		primitive.center = point3(object->transform[3]);
+		primitive.shape = shape;
+		return true;
+	}
+
+	/// <summary>
+	/// compile the materials again after their properties were edited: the primitives keep the indices
+	/// of their materials, the textures are compiled again from scratch
+	/// </summary>
+	void update_materials()
+	{
+		m_textures.clear();
+		for (size_t i = 0; i < m_materials.size(); i++)
+		{
+			m_materials[i] = make_material(m_material_sources[i]);
+		}
+		m_texture_indices.clear();
+	}
+
+	/// <summary>
+	/// gather the lights again, after they were moved or their materials edited
+	/// </summary>
+	void update_lights()
+	{
+		m_lights.clear();
+		clear_lights(m_spheres);
+		clear_lights(m_rectangles);
+		clear_lights(m_baked_spheres);
+		clear_lights(m_baked_rectangles);
+		compile_lights();
+	}
+
+	template <typename Primitive>
+	static void clear_lights(std::vector<Primitive>& primitives)
+	{
+		for (Primitive& primitive : primitives)
+		{
+			primitive.light = light_list::no_light;
+		}
+	}
+
+	void compile_tree(compiled_tree& tree, const std::vector<hittable*>& objects, const bvh* hierarchy)
+	{
+		// objects referenced several times (by spatial splits) are only compiled once
+		const bool has_duplicates = hierarchy != nullptr && hierarchy->has_duplicates();
+		tree.references.reserve(objects.size());
+		for (hittable* object : objects)
+		{
+			tree.references.push_back(has_duplicates ? compile_shared_primitive(object) : compile_primitive(object));
+		}
+
+		if (hierarchy == nullptr)
+			return;
+
+		// the batches of the leaves are described again, as bvh::finalize does
+		tree.nodes = hierarchy->nodes();
+		tree.batch_indices.assign(objects.size(), 0);
+		for (const bvh_node& node : tree.nodes)
+		{
+			if (!node.is_leaf() || node.batch_count == 0)
+				continue;
+
+			const uint32_t first = tree.batches.allocate(node.batch, node.batch_count);
+			for (uint32_t j = 0; j < node.batch_count; j++)
+			{
+				tree.batch_indices[node.offset + j] = first + j;
+				tree.batches.set(first + j, objects[node.offset + j]->to_batch_primitive());
+			}
+		}
+	}
+
+	primitive_reference compile_shared_primitive(hittable* object)
+	{
+		const auto it = m_primitive_references.find(object);
+		if (it != m_primitive_references.end())
+			return it->second;
+
+		const primitive_reference reference = compile_primitive(object);
+		m_primitive_references.emplace(object, reference);
+		return reference;
+	}
+
+	primitive_reference compile_primitive(hittable* object)
+	{
+		primitive_reference reference;
+		const bool is_baked = object->transform_type <= transform_kind::translation;
+		if (const auto* sphere_object = dynamic_cast<const sphere*>(object))
+		{
+			const sphere_shape shape{sphere_object->radius};
+			reference = is_baked
+				            ? add(m_baked_spheres, primitive_kind::baked_sphere, object, shape)
+				            : add(m_spheres, primitive_kind::sphere, object, shape);
+		}
+		else if (const auto* rectangle_object = dynamic_cast<const rectangle*>(object))
+		{
+			const rectangle_shape shape{rectangle_object->size};
+			reference = is_baked
+				            ? add(m_baked_rectangles, primitive_kind::baked_rectangle, object, shape)
+				            : add(m_rectangles, primitive_kind::rectangle, object, shape);
+		}
+		else if (const auto* box_object = dynamic_cast<const box*>(object))
+		{
+			reference = add(m_boxes, primitive_kind::box, object, box_shape{box_object->bounds()});
+		}
+		else if (const auto* instance_object = dynamic_cast<const instance*>(object))
+		{
+			const uint32_t group = compile_group(*instance_object->group());
+			reference = add(m_instances, primitive_kind::instance, object,
+			                instance_shape{group, object->material != nullptr});
+		}
+		else
+		{
+			reference = {primitive_kind::other, static_cast<uint32_t>(m_others.size())};
+			m_others.push_back({object, compile_material(object->material)});
+		}
+		return reference;
+	}
+
+	template <typename Shape>
+	primitive_reference add(std::vector<compiled_primitive<Shape>>& primitives, primitive_kind kind, hittable* object,
+	                        const Shape& shape)
+	{
+		const uint32_t material = object->material != nullptr ? compile_material(object->material) : 0;
+		primitives.push_back({
+			object->transform, object->inv_transform, object->transform_type, shape, material, object
+		});
+		return {kind, static_cast<uint32_t>(primitives.size() - 1)};
+	}
+
+	template <typename Shape>
+	primitive_reference add(std::vector<baked_primitive<Shape>>& primitives, primitive_kind kind, hittable* object,
+	                        const Shape& shape)
+	{
+		const uint32_t material = object->material != nullptr ? compile_material(object->material) : 0;
+		primitives.push_back({point3(object->transform[3]), shape, material, object});
+		return {kind, static_cast<uint32_t>(primitives.size() - 1)};
+	}
+
+	/// <summary>
+	/// returns the index in the light list of the primitive of the hit, or light_list::no_light if it is not a light
+	/// </summary>
+	[[nodiscard]] uint32_t light_index(const hit_info& hit) const
+	{
+		const primitive_reference reference = unpack(hit.object_index);
+		switch (reference.kind)
+		{
+		case primitive_kind::sphere:
+			return m_spheres[reference.index].light;
+		case primitive_kind::rectangle:
+			return m_rectangles[reference.index].light;
+		case primitive_kind::baked_sphere:
+			return m_baked_spheres[reference.index].light;
+		case primitive_kind::baked_rectangle:
+			return m_baked_rectangles[reference.index].light;
+		default:
+			return light_list::no_light;
+		}
+	}
+
+	/// <summary>
+	/// gather the emissive spheres and rectangles of the world in the light list
+	/// the primitives of the groups are not gathered: their instances may place them several times
+	/// </summary>
+	void compile_lights()
+	{
+		for (const primitive_reference& reference : m_tree.references)
+		{
+			switch (reference.kind)
+			{
+			case primitive_kind::sphere:
+				compile_light(m_spheres[reference.index], reference);
+				break;
+			case primitive_kind::rectangle:
+				compile_light(m_rectangles[reference.index], reference);
+				break;
+			case primitive_kind::baked_sphere:
+				compile_light(m_baked_spheres[reference.index], reference);
+				break;
+			case primitive_kind::baked_rectangle:
+				compile_light(m_baked_rectangles[reference.index], reference);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	template <typename Primitive>
+	void compile_light(Primitive& primitive, const primitive_reference& reference)
+	{
+		const float emission_strength = m_materials[primitive.material].emission_strength;
+		// the primitives referenced several times (by spatial splits) are only added once
+		if (emission_strength > 0.0f && primitive.light == light_list::no_light)
+			primitive.light = m_lights.add(primitive.object->to_batch_primitive(), emission_strength, pack(reference));
+	}
+
+	uint32_t compile_group(const geometry_group& group)
+	{
+		const auto it = m_group_indices.find(&group);
+		if (it != m_group_indices.end())
+			return it->second;
+
+		// the group is compiled on its own before being moved, since compiling it may add other groups
+		compiled_tree tree;
+		const bvh& hierarchy = group.get_bvh();
+		if (hierarchy.empty())
+			compile_tree(tree, group.hittables(), nullptr);
+		else
+			compile_tree(tree, hierarchy.primitives(), &hierarchy);
+
+		const auto index = static_cast<uint32_t>(m_groups.size());
+		m_groups.push_back(std::move(tree));
+		m_group_indices.emplace(&group, index);
+		return index;
+	}
+
+	uint32_t compile_material(material* source)
+	{
+		const auto it = m_material_indices.find(source);
+		if (it != m_material_indices.end())
+			return it->second;
+
+		const auto index = static_cast<uint32_t>(m_materials.size());
+		m_materials.push_back(make_material(source));
+		m_material_sources.push_back(source);
+		m_material_indices.emplace(source, index);
+		return index;
+	}
+
+	compiled_material make_material(material* source)
+	{
+		compiled_material compiled;
+		if (const auto* lambertian = dynamic_cast<const lambertian_material*>(source))
+			compiled.model = compiled_lambertian{compile_texture(lambertian->albedo)};
+		else if (const auto* metal = dynamic_cast<const metal_material*>(source))
+			compiled.model = compiled_metal{metal->albedo, metal->roughness};
+		else if (const auto* dielectric = dynamic_cast<const dielectric_material*>(source))
+			compiled.model = compiled_dielectric{dielectric->index_of_refraction(), 1.0f / dielectric->index_of_refraction()};
+		else
+			compiled.model = source;
+		compiled.emission = compile_texture(source->emission);
+		compiled.emission_strength = source->emission_strength;
+		return compiled;
+	}
+
+	uint32_t compile_texture(const texture* source)
+	{
+		const auto it = m_texture_indices.find(source);
+		if (it != m_texture_indices.end())
+			return it->second;
+
+		compiled_texture compiled = source;
+		if (const auto* solid = dynamic_cast<const solid_color*>(source))
+			compiled = compiled_solid_color{solid->color_value};
+		else if (const auto* checker = dynamic_cast<const checker_texture*>(source))
+			compiled = compiled_checker{compile_texture(checker->odd), compile_texture(checker->even)};
+		else if (const auto* image = dynamic_cast<const image_texture*>(source))
+			compiled = compiled_image{image->data, image->width, image->height};
+
+		const auto index = static_cast<uint32_t>(m_textures.size());
+		m_textures.push_back(compiled);
+		m_texture_indices.emplace(source, index);
+		return index;
+	}
+
+	/// <summary>
+	/// intersect the top of the world with its lazy bvh or the selected layout
+	/// </summary>
+	bool hit_world(const ray& ray, float t_min, float t_max, hit_info& info) const
+	{
+		if (m_lazy_bvh != nullptr)
+		{
+			return m_lazy_bvh->traverse(ray, t_min, t_max, info,
+			                            [this](hittable&, uint32_t object, const ::ray& leaf_ray, float leaf_t_min,
+			                                   hit_info& leaf_info)
+			                            {
+				                            return hit(m_tree.references[object], leaf_ray, leaf_t_min, leaf_info.distance,
+				                                       leaf_info);
+			                            });
+		}
+
+		switch (m_layout)
+		{
+		case bvh_layout::wide4:
+			return m_tree4.traverse(ray, t_min, info, leaf_function{this, &m_tree});
+		case bvh_layout::wide8:
+			return m_tree8.traverse(ray, t_min, info, leaf_function{this, &m_tree});
+		case bvh_layout::compressed4:
+			return m_compressed_tree.traverse(ray, t_min, info, leaf_function{this, &m_tree});
+		default:
+			return hit(m_tree, ray, t_min, t_max, info);
+		}
+	}
+
+	bool hit(const compiled_tree& tree, const ray& ray, float t_min, float t_max, hit_info& info) const
+	{
+		if (!tree.nodes.empty())
+			return bvh::traverse(tree.nodes, ray, t_min, t_max, info, leaf_function{this, &tree});
+
+		bool has_hit = false;
+		for (const primitive_reference& reference : tree.references)
+		{
+			has_hit |= hit(reference, ray, t_min, info.distance, info);
+		}
+		return has_hit;
+	}
+
+	bool occluded(const compiled_tree& tree, const ray& ray, float t_min, float t_max) const
+	{
+		if (!tree.nodes.empty())
+			return bvh::traverse_any(tree.nodes, ray, t_min, t_max, occluded_leaf_function{this, &tree});
+
+		for (const primitive_reference& reference : tree.references)
+		{
+			if (occluded(reference, ray, t_min, t_max))
+				return true;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// returns true if the ray hits the referenced primitive between t_min and t_max
+	/// the groups of the instances are traversed with bvh::traverse_any as well
+	/// </summary>
+	bool occluded(const primitive_reference& reference, const ray& base_ray, float t_min, float t_max) const
+	{
+		if (reference.kind == primitive_kind::instance)
+		{
+			const compiled_primitive<instance_shape>& primitive = m_instances[reference.index];
+			const ::ray transformed_ray = hittable::to_local_space(base_ray, primitive.transform_type,
+			                                                       primitive.transform, primitive.inv_transform);
+			return occluded(m_groups[primitive.shape.group], transformed_ray, t_min, t_max);
+		}
+
+		hit_info info{nullptr};
+		return hit(reference, base_ray, t_min, t_max, info);
+	}
+
+	/// <summary>
+	/// same as bvh::occluded_leaf, on compiled primitives
+	/// </summary>
+	bool occluded_leaf(const compiled_tree& tree, const bvh_node& node, const ray& ray, float t_min, float t_max) const
+	{
+		uint32_t i = node.offset;
+		if (node.batch_count > 0)
+		{
+			// as in hit_leaf, the hit found by the batch is confirmed on the primitive
+			const int closest = tree.batches.hit(node.batch, tree.batch_indices[i], node.batch_count, ray, t_min, t_max);
+			if (closest >= 0)
+			{
+				if (occluded(tree.references[i + closest], ray, t_min, t_max))
+					return true;
+
+				for (uint32_t j = i, end = i + node.batch_count; j < end; j++)
+				{
+					if (occluded(tree.references[j], ray, t_min, t_max))
+						return true;
+				}
+			}
+			i += node.batch_count;
+		}
+
+		for (const uint32_t end = node.offset + node.count; i < end; i++)
+		{
+			if (occluded(tree.references[i], ray, t_min, t_max))
+				return true;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// same as bvh::hit_leaf, on compiled primitives
+	/// </summary>
+	bool hit_leaf(const compiled_tree& tree, const bvh_node& node, const ray& ray, float t_min, hit_info& info) const
+	{
+		bool has_hit = false;
+		uint32_t i = node.offset;
+		if (node.batch_count > 0)
+		{
+			const int closest = tree.batches.hit(node.batch, tree.batch_indices[i], node.batch_count, ray, t_min,
+			                                     info.distance);
+			if (closest >= 0 && !hit(tree.references[i + closest], ray, t_min, info.distance, info))
+			{
+				for (uint32_t j = i, end = i + node.batch_count; j < end; j++)
+				{
+					has_hit |= hit(tree.references[j], ray, t_min, info.distance, info);
+				}
+			}
+			else
+			{
+				has_hit = closest >= 0;
+			}
+			i += node.batch_count;
+		}
+
+		for (const uint32_t end = node.offset + node.count; i < end; i++)
+		{
+			has_hit |= hit(tree.references[i], ray, t_min, info.distance, info);
+		}
+		return has_hit;
+	}
+
+	/// <summary>
+	/// same as hittable::base_hit: only the distance and the primitive of the hit are recorded (see evaluate)
+	/// </summary>
+	bool hit(const primitive_reference& reference, const ray& ray, float t_min, float t_max, hit_info& info) const
+	{
+		bool has_hit;
+		switch (reference.kind)
+		{
+		case primitive_kind::sphere:
+			has_hit = hit(m_spheres[reference.index], ray, t_min, t_max, info);
+			break;
+		case primitive_kind::rectangle:
+			has_hit = hit(m_rectangles[reference.index], ray, t_min, t_max, info);
+			break;
+		case primitive_kind::box:
+			has_hit = hit(m_boxes[reference.index], ray, t_min, t_max, info);
+			break;
+		case primitive_kind::instance:
+			return hit_instance(reference, ray, t_min, t_max, info);
+		case primitive_kind::baked_sphere:
+			has_hit = hit(m_baked_spheres[reference.index], ray, t_min, t_max, info);
+			break;
+		case primitive_kind::baked_rectangle:
+			has_hit = hit(m_baked_rectangles[reference.index], ray, t_min, t_max, info);
+			break;
+		default:
+			has_hit = m_others[reference.index].object->base_hit(ray, t_min, t_max, info);
+			break;
+		}
+
+		if (has_hit)
+		{
+			info.object_index = pack(reference);
+			info.primitive_index = info.object_index;
+		}
+		return has_hit;
+	}
+
+	/// <summary>
+	/// same as hittable::base_hit: the ray is transformed to the local space of the primitive
+	/// </summary>
+	template <typename Shape>
+	static bool hit(const compiled_primitive<Shape>& primitive, const ray& base_ray, float t_min, float t_max,
+	                hit_info& info)
+	{
+		const ::ray transformed_ray = hittable::to_local_space(base_ray, primitive.transform_type,
+		                                                       primitive.transform, primitive.inv_transform);
+		return intersect(primitive.shape, transformed_ray, t_min, t_max, info);
+	}
+
+	static bool hit(const baked_primitive<sphere_shape>& primitive, const ray& ray, float t_min, float t_max,
+	                hit_info& info)
+	{
+		return sphere::intersect(ray, primitive.center, primitive.shape.radius, t_min, t_max, info.distance);
+	}
+
+	static bool hit(const baked_primitive<rectangle_shape>& primitive, const ray& ray, float t_min, float t_max,
+	                hit_info& info)
+	{
+		return rectangle::intersect(ray, primitive.center, primitive.shape.size, t_min, t_max, info.distance);
+	}
+
+	static bool intersect(const sphere_shape& shape, const ray& ray, float t_min, float t_max, hit_info& info)
+	{
+		return sphere::intersect(ray, point3(0.0f), shape.radius, t_min, t_max, info.distance);
+	}
+
+	static bool intersect(const rectangle_shape& shape, const ray& ray, float t_min, float t_max, hit_info& info)
+	{
+		return rectangle::intersect(ray, point3(0.0f), shape.size, t_min, t_max, info.distance);
+	}
+
+	static bool intersect(const box_shape& shape, const ray& ray, float t_min, float t_max, hit_info& info)
+	{
+		const auto [has_hit, axis, distance] = shape.bounds.hit_with_info(ray, t_min, t_max);
+		if (!has_hit)
+			return false;
+
+		info.distance = distance;
+		info.local_data = static_cast<uint32_t>(axis);
+		return true;
+	}
+
+	/// <summary>
+	/// same as instance::hit, on the compiled tree of its group
+	/// </summary>
+	bool hit_instance(const primitive_reference& reference, const ray& base_ray, float t_min, float t_max,
+	                  hit_info& info) const
+	{
+		const compiled_primitive<instance_shape>& primitive = m_instances[reference.index];
+		const ::ray transformed_ray = hittable::to_local_space(base_ray, primitive.transform_type,
+		                                                       primitive.transform, primitive.inv_transform);
+		if (!hit(m_groups[primitive.shape.group], transformed_ray, t_min, t_max, info))
+			return false;
+
+		const uint32_t packed = pack(reference);
+		// the closest hit of the group is another instance: evaluated right away (see instance::hit)
+		if (info.object_index != info.primitive_index)
+		{
+			evaluate(unpack(info.object_index), transformed_ray, info);
+			info.primitive_index = packed;
+		}
+		info.object_index = packed;
+		return true;
+	}
+
+	/// <summary>
+	/// same as hittable::base_evaluate: fill the surface of the hit recorded for the referenced primitive
+	/// </summary>
+	void evaluate(const primitive_reference& reference, const ray& ray, hit_info& info) const
+	{
+		switch (reference.kind)
+		{
+		case primitive_kind::sphere:
+			evaluate(m_spheres[reference.index], ray, info);
+			break;
+		case primitive_kind::rectangle:
+			evaluate(m_rectangles[reference.index], ray, info);
+			break;
+		case primitive_kind::box:
+			evaluate(m_boxes[reference.index], ray, info);
+			break;
+		case primitive_kind::instance:
+			evaluate_instance(reference, ray, info);
+			break;
+		case primitive_kind::baked_sphere:
+			{
+				const baked_primitive<sphere_shape>& primitive = m_baked_spheres[reference.index];
+				sphere::surface(ray, primitive.center, primitive.shape.radius, info);
+				info.material_index = primitive.material;
+				info.object = primitive.object;
+				break;
+			}
+		case primitive_kind::baked_rectangle:
+			{
+				const baked_primitive<rectangle_shape>& primitive = m_baked_rectangles[reference.index];
+				rectangle::surface(ray, primitive.center, primitive.shape.size, info);
+				info.material_index = primitive.material;
+				info.object = primitive.object;
+				break;
+			}
+		default:
+			{
+				const other_primitive& other = m_others[reference.index];
+				other.object->base_evaluate(ray, info);
+				info.material_index = other.material;
+				break;
+			}
+		}
+	}
+
+	template <typename Shape>
+	static void evaluate(const compiled_primitive<Shape>& primitive, const ray& base_ray, hit_info& info)
+	{
+		const ::ray transformed_ray = hittable::to_local_space(base_ray, primitive.transform_type,
+		                                                       primitive.transform, primitive.inv_transform);
+		surface(primitive.shape, transformed_ray, info);
+		hittable::to_world_space(info, primitive.transform_type, primitive.transform);
+		info.material_index = primitive.material;
+		info.object = primitive.object;
+	}
+
+	static void surface(const sphere_shape& shape, const ray& ray, hit_info& info)
+	{
+		sphere::surface(ray, point3(0.0f), shape.radius, info);
+	}
+
+	static void surface(const rectangle_shape& shape, const ray& ray, hit_info& info)
+	{
+		rectangle::surface(ray, point3(0.0f), shape.size, info);
+	}
+
+	static void surface(const box_shape& shape, const ray& ray, hit_info& info)
+	{
+		box::surface(ray, shape.bounds, static_cast<int>(info.local_data), info);
+	}
+
+	/// <summary>
+	/// same as instance::evaluate
+	/// </summary>
+	void evaluate_instance(const primitive_reference& reference, const ray& base_ray, hit_info& info) const
+	{
+		const compiled_primitive<instance_shape>& primitive = m_instances[reference.index];
+		const ::ray transformed_ray = hittable::to_local_space(base_ray, primitive.transform_type,
+		                                                       primitive.transform, primitive.inv_transform);
+		// otherwise the surface has already been evaluated by hit_instance
+		if (info.primitive_index != pack(reference))
+			evaluate(unpack(info.primitive_index), transformed_ray, info);
+
+		hittable::to_world_space(info, primitive.transform_type, primitive.transform);
+		if (primitive.shape.has_material)
+			info.material_index = primitive.material;
+		info.object = primitive.object;
+	}
+
+	bool scatter(const compiled_lambertian& model, const ray&, const hit_info& hit, color& attenuation,
+	             ray& scattered, sampler& rng) const
+	{
+		scattered = lambertian_material::scattered_ray(hit, rng);
+		attenuation = value_at(model.albedo, hit.uv_coordinates, hit.point);
+		return true;
+	}
+
+	static bool scatter(const compiled_metal& model, const ray& raycast, const hit_info& hit, color& attenuation,
+	                    ray& scattered, sampler& rng)
+	{
+		return metal_material::scatter(raycast, hit, model.albedo, model.roughness, attenuation, scattered, rng);
+	}
+
+	static bool scatter(const compiled_dielectric& model, const ray& raycast, const hit_info& hit, color& attenuation,
+	                    ray& scattered, sampler& rng)
+	{
+		return dielectric_material::scatter(raycast, hit, model.index_of_refraction, model.inv_index_of_refraction,
+		                                    attenuation, scattered, rng);
+	}
+
+	static bool scatter(const material* model, const ray& raycast, const hit_info& hit, color& attenuation,
+	                    ray& scattered, sampler& rng)
+	{
+		return model->scatter(raycast, hit, attenuation, scattered, rng);
+	}
+
+	static bool is_specular(const compiled_lambertian&)
+	{
+		return false;
+	}
+
+	static bool is_specular(const compiled_metal& model)
+	{
+		return model.roughness <= 0.0f;
+	}
+
+	static bool is_specular(const compiled_dielectric&)
+	{
+		return true;
+	}
+
+	static bool is_specular(const material* model)
+	{
+		return model->is_specular();
+	}
+
+	static float pdf(const compiled_lambertian&, const ray&, const hit_info& hit, const direction3& direction)
+	{
+		return lambertian_material::pdf(hit, direction);
+	}
+
+	static float pdf(const compiled_metal& model, const ray& raycast, const hit_info& hit, const direction3& direction)
+	{
+		return metal_material::pdf(raycast, hit, model.roughness, direction);
+	}
+
+	static float pdf(const compiled_dielectric&, const ray&, const hit_info&, const direction3&)
+	{
+		return 0.0f;
+	}
+
+	static float pdf(const material* model, const ray& raycast, const hit_info& hit, const direction3& direction)
+	{
+		return model->pdf(raycast, hit, direction);
+	}
+
+	[[nodiscard]] color eval(const compiled_lambertian& model, const ray&, const hit_info& hit,
+	                         const direction3& direction) const
+	{
+		return color(value_at(model.albedo, hit.uv_coordinates, hit.point) * lambertian_material::pdf(hit, direction));
+	}
+
+	static color eval(const compiled_metal& model, const ray& raycast, const hit_info& hit, const direction3& direction)
+	{
+		return color(model.albedo * metal_material::pdf(raycast, hit, model.roughness, direction));
+	}
+
+	static color eval(const compiled_dielectric&, const ray&, const hit_info&, const direction3&)
+	{
+		return color::black();
+	}
+
+	static color eval(const material* model, const ray& raycast, const hit_info& hit, const direction3& direction)
+	{
+		return model->eval(raycast, hit, direction);
+	}
+
+	[[nodiscard]] color value_at(uint32_t texture, const vec2& uv_coordinates, const point3& p) const
+	{
+		return std::visit([this, &uv_coordinates, &p](const auto& model)
+		{
+			return value_at(model, uv_coordinates, p);
+		}, m_textures[texture]);
+	}
+
+	static color value_at(const compiled_solid_color& model, const vec2&, const point3&)
+	{
+		return model.value;
+	}
+
+	[[nodiscard]] color value_at(const compiled_checker& model, const vec2& uv_coordinates, const point3& p) const
+	{
+		return value_at(checker_texture::is_odd(p) ? model.odd : model.even, uv_coordinates, p);
+	}
+
+	static color value_at(const compiled_image& model, const vec2& uv_coordinates, const point3&)
+	{
+		return image_texture::value_at(model.data, model.width, model.height, uv_coordinates);
+	}
+
+	static color value_at(const texture* model, const vec2& uv_coordinates, const point3& p)
+	{
+		return model->value_at(uv_coordinates, p);
+	}
+
+	/// <summary>
+	/// object of a type unknown to compile_primitive, intersected through its virtual hittable::base_hit
+	/// </summary>
+	struct other_primitive
+	{
+		hittable* object;
+		uint32_t material;
+	};
+
+	// what the scene was compiled from, to tell whether it can be updated in place (see update)
+	const world* m_world = nullptr;
+	int m_rebuild_count = -1;
+	bool m_use_bvh = false;
+	// true if the nodes of m_tree are the ones of the world bvh (false if they were built for the compiled scene)
+	bool m_shares_bvh = false;
+	// lazy bvh of the world, traversed over the references of m_tree (see world::lazy_build)
+	const lazy_bvh* m_lazy_bvh = nullptr;
+
+	compiled_tree m_tree;
+	// copies of the wide bvh of the world for the selected layout, whose leaves are the ones of m_tree
+	bvh_layout m_layout{bvh_layout::binary};
+	wide_bvh<4> m_tree4;
+	wide_bvh<8> m_tree8;
+	compressed_bvh m_compressed_tree;
+	// compiled geometry_group of the instances
+	std::vector<compiled_tree> m_groups;
+
+	std::vector<compiled_primitive<sphere_shape>> m_spheres;
+	std::vector<compiled_primitive<rectangle_shape>> m_rectangles;
+	std::vector<compiled_primitive<box_shape>> m_boxes;
+	std::vector<compiled_primitive<instance_shape>> m_instances;
+	std::vector<baked_primitive<sphere_shape>> m_baked_spheres;
+	std::vector<baked_primitive<rectangle_shape>> m_baked_rectangles;
+	std::vector<other_primitive> m_others;
+
+	std::vector<compiled_material> m_materials;
+	// material each compiled material was compiled from (see update_materials)
+	std::vector<material*> m_material_sources;
+	std::vector<compiled_texture> m_textures;
+
+	light_list m_lights;
+
+	// used while compiling only
+	std::unordered_map<const hittable*, primitive_reference> m_primitive_references;
+	std::unordered_map<const material*, uint32_t> m_material_indices;
+	std::unordered_map<const texture*, uint32_t> m_texture_indices;
+	std::unordered_map<const geometry_group*, uint32_t> m_group_indices;
+};
@@ -0,0 +1,336 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "core/sampler.h"
+#include "core/sampling.h"
+#include "geometry/sphere.h"
+#include "geometry/abstract/primitive_batch.h"
+
+/// <summary>
+/// direction towards a point sampled on a light (see light_list::sample)
+/// </summary>
+struct light_sample
+{
+	direction3 direction{0.0f};
+	// distance from the origin to the sampled point along direction
+	float distance = 0.0f;
+	// probability density of the direction (per unit of solid angle), including the choice of the light
+	float pdf = 0.0f;
+	// hit_info::object_index of the light
+	uint32_t object_index = 0;
+};
+
+/// <summary>
+/// the emissive spheres and rectangles of a scene, so that the light they cast on a point can be sampled directly
+/// (next-event estimation, see compiled_scene::direct_light) instead of waiting for a bounce to hit them.
+/// The density of a direction that hits a light is given by pdf, to weight it against the scattering of the materials
+/// A light is chosen in proportion to its power (its emission strength times its area), then a point on it:
+/// - rectangle: uniformly over the solid angle it covers, seen from the point (see Urena et al. 2013),
+///   so that the points close to it do not get the spikes of the sampling of its area (still used for the parallelograms
+///   and for the rectangles too small or too far away for the solid angle to be computed accurately)
+/// - sphere: uniformly over the cone of the directions it covers, seen from the point (or over its area from inside)
+/// </summary>
+class light_list
+{
+public:
+	// index of a primitive that is not in the list
+	static constexpr uint32_t no_light = ~0u;
+
+	void clear()
+	{
+		m_lights.clear();
+		m_cumulated_powers.clear();
+	}
+
+	/// <summary>
+	/// add the light of the given shape (a sphere or a rectangle, in world space) and returns its index
+	/// or no_light if it cannot emit anything
+	/// </summary>
+	uint32_t add(const batch_primitive& shape, float emission_strength, uint32_t object_index)
+	{
+		float area;
+		if (shape.kind == batch_kind::sphere)
+			area = 4.0f * constants::pi * shape.radius * shape.radius;
+		else if (shape.kind == batch_kind::rectangle)
+			area = 4.0f * length(cross(shape.u, shape.v));
+		else
+			return no_light;
+
+		const float power = emission_strength * area;
+		if (!(power > 0.0f))
+			return no_light;
+
+		// only the rectangles that are not sheared by their transform are sampled by solid angle
+		const bool is_parallelogram = std::abs(dot(shape.u, shape.v)) > constants::epsilon * length(shape.u) * length(shape.v);
+		const direction3 normal = shape.kind == batch_kind::rectangle ? normalize(cross(shape.u, shape.v)) : direction3(0.0f);
+		m_lights.push_back({shape, normal, area, power, object_index, is_parallelogram});
+		m_cumulated_powers.push_back(power + (m_cumulated_powers.empty() ? 0.0f : m_cumulated_powers.back()));
+		return static_cast<uint32_t>(m_lights.size() - 1);
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return m_lights.empty();
+	}
+
+	[[nodiscard]] size_t size() const
+	{
+		return m_lights.size();
+	}
+
+	/// <summary>
+	/// returns the density with which sample draws the direction from the origin towards the given point
+	/// of the light of the given index (returned by add)
+	/// </summary>
+	[[nodiscard]] float pdf(uint32_t index, const point3& origin, const direction3& direction, const point3& point) const
+	{
+		const light& light = m_lights[index];
+		const float choice = light.power / m_cumulated_powers.back();
+		if (light.shape.kind == batch_kind::sphere)
+		{
+			const float square_distance = length2(light.shape.center - origin);
+			const float square_radius = light.shape.radius * light.shape.radius;
+			if (square_distance <= square_radius)
+				return choice * point_pdf(light, origin, direction, point, (point - light.shape.center) / light.shape.radius);
+			return choice / (2.0f * constants::pi * cone_height(square_radius, square_distance));
+		}
+
+		spherical_rectangle projection;
+		if (!light.is_parallelogram && project(light, origin, projection))
+			return choice / projection.solid_angle;
+		return choice * point_pdf(light, origin, direction, point, light.normal);
+	}
+
+	/// <summary>
+	/// sample a direction from the origin towards a point of a light, drawing 3 numbers from rng
+	/// returns false if no point could be sampled (the sample then carries no light)
+	/// </summary>
+	bool sample(const point3& origin, sampler& rng, light_sample& sample) const
+	{
+		const float u_light = rng.get();
+		const float u1 = rng.get();
+		const float u2 = rng.get();
+		if (m_lights.empty())
+			return false;
+
+		const float total_power = m_cumulated_powers.back();
+		const auto chosen = std::upper_bound(m_cumulated_powers.begin(), m_cumulated_powers.end(), u_light * total_power);
+		const light& light = m_lights[std::min(static_cast<size_t>(chosen - m_cumulated_powers.begin()),
+		                                       m_lights.size() - 1)];
+		sample.object_index = light.object_index;
+
+		const bool has_sample = light.shape.kind == batch_kind::sphere
+			                        ? sample_sphere(light, origin, u1, u2, sample)
+			                        : sample_rectangle(light, origin, u1, u2, sample);
+		sample.pdf *= light.power / total_power;
+		return has_sample;
+	}
+
+private:
+	struct light
+	{
+		batch_primitive shape;
+		// normal of the rectangles
+		direction3 normal;
+		float area;
+		float power;
+		uint32_t object_index;
+		bool is_parallelogram;
+	};
+
+	/// <summary>
+	/// a rectangle light seen from a point (see project)
+	/// </summary>
+	struct spherical_rectangle
+	{
+		// local frame of the rectangle: its edges along x and y, and z towards the point
+		direction3 x;
+		direction3 y;
+		direction3 z;
+		// coordinates of the corners of the rectangle in that frame, from the point
+		float x0;
+		float y0;
+		float z0;
+		float x1;
+		float y1;
+		// z of the normals of the planes through the point and the edges along x
+		float b0;
+		float b1;
+		// internal angles between the planes through the point and the edges, at the first two corners
+		// and at the last two ones
+		float first_angles;
+		float last_angles;
+		float solid_angle;
+	};
+
+	static bool sample_rectangle(const light& light, const point3& origin, float u1, float u2, light_sample& sample)
+	{
+		if (!light.is_parallelogram && sample_spherical_rectangle(light, origin, u1, u2, sample))
+			return true;
+
+		const point3 point = light.shape.center + (2.0f * u1 - 1.0f) * light.shape.u + (2.0f * u2 - 1.0f) * light.shape.v;
+		return sample_point(light, origin, point, light.normal, sample);
+	}
+
+	static bool sample_sphere(const light& light, const point3& origin, float u1, float u2, light_sample& sample)
+	{
+		const vec3 to_center = light.shape.center - origin;
+		const float square_distance = length2(to_center);
+		const float square_radius = light.shape.radius * light.shape.radius;
+		if (square_distance <= square_radius)
+		{
+			// from inside, the whole sphere is visible
+			const direction3 normal = sampling::uniform_sphere(u1, u2);
+			return sample_point(light, origin, light.shape.center + light.shape.radius * normal, normal, sample);
+		}
+
+		const float height = cone_height(square_radius, square_distance);
+		const float distance = std::sqrt(square_distance);
+		const sampling::frame frame(to_center / distance);
+		sample.direction = frame.to_world(sampling::uniform_cone(u1, u2, height));
+		sample.pdf = 1.0f / (2.0f * constants::pi * height);
+
+		// the directions that graze the sphere may miss it by rounding: they end at the point closest to the sphere
+		const ray raycast(origin, sample.direction);
+		if (!sphere::intersect(raycast, light.shape.center, light.shape.radius, 0.0f, constants::infinity,
+		                       sample.distance))
+			sample.distance = dot(to_center, sample.direction);
+		return true;
+	}
+
+	/// <summary>
+	/// returns the height of the cap of the unit sphere covered by the cone of a sphere seen from outside: 1 - cos(angle),
+	/// computed from sin(angle)^2 so that it keeps its precision for the small or distant spheres
+	/// </summary>
+	static float cone_height(float square_radius, float square_distance)
+	{
+		const float square_sine = square_radius / square_distance;
+		return square_sine / (1.0f + std::sqrt(1.0f - square_sine));
+	}
+
+	/// <summary>
+	/// sample a direction uniformly over the solid angle of the rectangle (the spherical rectangle, see Urena et al. 2013):
+	/// returns false if the solid angle is too small for it to pay off
+	/// </summary>
+	static bool sample_spherical_rectangle(const light& light, const point3& origin, float u1, float u2,
+	                                       light_sample& sample)
+	{
+		spherical_rectangle projection;
+		if (!project(light, origin, projection))
+			return false;
+
+		// the first number gives the x of the point: the solid angle of the part of the rectangle before it
+		// is proportional to the number
+		const float x0 = projection.x0;
+		const float z0 = projection.z0;
+		const float b0 = projection.b0;
+		const float partial_angle = u1 * (projection.first_angles - 2.0f * constants::pi)
+			+ (u1 - 1.0f) * projection.last_angles;
+		const float f = (std::cos(partial_angle) * b0 - projection.b1) / std::sin(partial_angle);
+		const float cu = clamp(std::copysign(1.0f / std::sqrt(f * f + b0 * b0), f), -0.999999f, 0.999999f);
+		const float xu = clamp(-cu * z0 / std::sqrt(1.0f - cu * cu), x0, projection.x1);
+
+		// the second number gives the y of the point, along the segment of the rectangle at xu
+		const float y0 = projection.y0;
+		const float y1 = projection.y1;
+		const float distance = std::sqrt(xu * xu + z0 * z0);
+		const float h0 = y0 / std::sqrt(distance * distance + y0 * y0);
+		const float h1 = y1 / std::sqrt(distance * distance + y1 * y1);
+		const float hv = h0 + u2 * (h1 - h0);
+		const float yv = hv * hv < 0.999999f ? hv * distance / std::sqrt(1.0f - hv * hv) : y1;
+
+		const vec3 offset = projection.x * xu + projection.y * yv + projection.z * z0;
+		sample.distance = length(offset);
+		sample.direction = offset / sample.distance;
+		sample.pdf = 1.0f / projection.solid_angle;
+		return true;
+	}
+
+	/// <summary>
+	/// compute the rectangle seen from the origin (see spherical_rectangle)
+	/// returns false if its solid angle is too small for its sampling to pay off
+	/// </summary>
+	static bool project(const light& light, const point3& origin, spherical_rectangle& projection)
+	{
+		// below this solid angle, the density of the sampling of the area hardly varies over the rectangle,
+		// which is then not worth the cost of the spherical rectangle (estimated from its center first)
+		constexpr float min_solid_angle = 0.3f;
+		const vec3 to_center = light.shape.center - origin;
+		const float square_distance = length2(to_center);
+		if (light.area * std::abs(dot(light.normal, to_center)) < min_solid_angle * square_distance * std::sqrt(square_distance))
+			return false;
+
+		// local frame of the rectangle: its edges along x and y, and z towards the origin
+		const float width = 2.0f * length(light.shape.u);
+		const float height = 2.0f * length(light.shape.v);
+		projection.x = light.shape.u / (0.5f * width);
+		projection.y = light.shape.v / (0.5f * height);
+		projection.z = cross(projection.x, projection.y);
+		const vec3 corner = light.shape.center - light.shape.u - light.shape.v - origin;
+		const float x0 = dot(corner, projection.x);
+		const float y0 = dot(corner, projection.y);
+		float z0 = dot(corner, projection.z);
+		if (z0 > 0.0f)
+		{
+			projection.z = -projection.z;
+			z0 = -z0;
+		}
+		const float x1 = x0 + width;
+		const float y1 = y0 + height;
+
+		// normals of the planes through the origin and the edges, and the internal angles between them
+		const direction3 n0 = normalize(cross(vec3(x0, y0, z0), vec3(x1, y0, z0)));
+		const direction3 n1 = normalize(cross(vec3(x1, y0, z0), vec3(x1, y1, z0)));
+		const direction3 n2 = normalize(cross(vec3(x1, y1, z0), vec3(x0, y1, z0)));
+		const direction3 n3 = normalize(cross(vec3(x0, y1, z0), vec3(x0, y0, z0)));
+		const auto angle = [](const direction3& a, const direction3& b)
+		{
+			return std::acos(clamp(-dot(a, b), -1.0f, 1.0f));
+		};
+		projection.first_angles = angle(n0, n1) + angle(n1, n2);
+		projection.last_angles = angle(n2, n3) + angle(n3, n0);
+		projection.solid_angle = projection.first_angles + projection.last_angles - 2.0f * constants::pi;
+		if (!(projection.solid_angle > min_solid_angle))
+			return false;
+
+		projection.x0 = x0;
+		projection.y0 = y0;
+		projection.z0 = z0;
+		projection.x1 = x1;
+		projection.y1 = y1;
+		projection.b0 = n0.z;
+		projection.b1 = n2.z;
+		return true;
+	}
+
+	/// <summary>
+	/// direction towards the given point of the light, sampled uniformly over the area of the light
+	/// </summary>
+	static bool sample_point(const light& light, const point3& origin, const point3& point, const direction3& normal,
+	                         light_sample& sample)
+	{
+		const vec3 offset = point - origin;
+		sample.distance = length(offset);
+		sample.direction = offset / sample.distance;
+		sample.pdf = point_pdf(light, origin, sample.direction, point, normal);
+		return sample.pdf < constants::infinity && sample.distance > 0.0f;
+	}
+
+	/// <summary>
+	/// returns the density of the direction towards the given point of the light when the points are sampled
+	/// uniformly over its area: the density over the area is converted to a density over the solid angle
+	/// </summary>
+	static float point_pdf(const light& light, const point3& origin, const direction3& direction, const point3& point,
+	                       const direction3& normal)
+	{
+		const float cosine = std::abs(dot(normal, direction));
+		return length2(point - origin) / (light.area * cosine);
+	}
+
+	std::vector<light> m_lights;
+	// sum of the powers of the lights up to each one (included), to choose a light in proportion to its power
+	std::vector<float> m_cumulated_powers;
+};
@@ -0,0 +1,715 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <execution>
+#include <type_traits>
+#include <vector>
+
+#include "camera.h"
+#include "ray_queries.h"
+#include "thread_pool.h"
+#include "world.h"
+#include "core/random.h"
+#include "core/sampler.h"
+#include "core/sampling.h"
+#include "materials/lambertian_material.h"
+#include "renderer/compiled_scene.h"
+#include "renderer/raytrace_renderer.h"
+#include "renderer/raytrace_settings.h"
+
+/// <summary>
+/// throughput of the SIMD kernels and of the code they replace, in millions of calls per second (see measure_kernels)
+/// </summary>
+struct kernel_throughput
+{
+	// the ray against two sibling boxes: aabb::entry_distance twice, or aabb::entry_distances once
+	float box_pair_scalar = 0.0f;
+	float box_pair_simd = 0.0f;
+	// a box against the rays of a packet (bvh::packet_mask), in bundles of 4 rays (float4) or 8 rays (float8)
+	float packet_box_4 = 0.0f;
+	float packet_box_8 = 0.0f;
+	// the average color of a pixel converted to 8 bits: with glm, or with float4 (raytrace_pixel::resolve)
+	float resolve_scalar = 0.0f;
+	float resolve_simd = 0.0f;
+	// a cosine-weighted direction around a normal: one at a time, or the directions of an array in batches
+	// of simd::lane_count (sampling::cosine_hemisphere)
+	float cosine_sample_scalar = 0.0f;
+	float cosine_sample_simd = 0.0f;
+};
+
+/// <summary>
+/// moments and histograms of the samples of a mapping of core/sampling.h, against the ones of its distribution
+/// (see ray_benchmark::measure_sampling)
+/// </summary>
+struct sampling_statistics
+{
+	const char* name = "";
+	// the batch version of the mapping, or the scalar one
+	bool is_batch = false;
+	// measured and expected means of z, of z^2 and of the squared distance to the origin (r^2)
+	float mean_z = 0.0f;
+	float mean_square_z = 0.0f;
+	float mean_square_radius = 0.0f;
+	float expected_z = 0.0f;
+	float expected_square_z = 0.0f;
+	float expected_square_radius = 0.0f;
+	// chi^2 of the histograms of the azimuth and of a radial quantity that the distribution makes uniform:
+	// it stays close to the degrees of freedom if the samples follow the distribution
+	float chi_square = 0.0f;
+	int degrees_of_freedom = 0;
+};
+
+/// <summary>
+/// throughput of ray_queries on the recorded rays, in millions of rays per second, and the number of rays
+/// whose result differs from the one of world::hit or world::occluded (see ray_benchmark::measure_queries)
+/// </summary>
+struct ray_query_throughput
+{
+	float hit = 0.0f;
+	float occluded = 0.0f;
+	size_t hit_mismatches = 0;
+	size_t occluded_mismatches = 0;
+};
+
+/// <summary>
+/// convergence of the renders of a sampler (see ray_benchmark::measure_convergence)
+/// </summary>
+struct sampler_convergence
+{
+	sampler_convergence() = default;
+
+	sampler_convergence(sampler_type sampler, raytrace_light_sampling lights)
+		: type(sampler), light_sampling(lights)
+	{
+	}
+
+	sampler_type type = sampler_type::independent;
+	// the way the light of the lights reached the hits (see raytrace_settings::light_sampling)
+	raytrace_light_sampling light_sampling = raytrace_light_sampling::none;
+	// after 1, 2, 4... samples per pixel: the root mean square error of the pixels against the reference,
+	// and the time spent rendering the samples so far (in milliseconds)
+	std::vector<float> errors;
+	std::vector<float> durations;
+};
+
+/// <summary>
+/// measure the throughput of world::hit on the rays of the current scene:
+/// the rays cast by one sample per pixel of a small path-traced image are recorded once (primary and bounced rays),
+/// then replayed on a single thread, so that different acceleration structures can be compared on the same rays
+/// </summary>
+class ray_benchmark
+{
+public:
+	/// <summary>
+	/// record the rays cast to render a width x height image of the scene seen from the camera
+	/// </summary>
+	void record(const camera& camera, const world& world, int width, int height, int bounce_depth)
+	{
+		m_rays.clear();
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				sampler rng(sampler_type::independent, static_cast<uint32_t>(x), static_cast<uint32_t>(y), 0);
+				ray raycast = camera.compute_ray_to((static_cast<float>(x) + 0.5f) / static_cast<float>(width),
+				                                    (static_cast<float>(y) + 0.5f) / static_cast<float>(height), rng);
+				for (int depth = 0; depth < bounce_depth; depth++)
+				{
+					m_rays.push_back(raycast);
+
+					hit_info hit{&lambertian_material::default_material()};
+					color attenuation;
+					ray scattered;
+					rng.start_bounce(depth);
+					if (!world.hit(raycast, 0.001f, constants::infinity, hit)
+						|| !hit.material->scatter(raycast, hit, attenuation, scattered, rng))
+						break;
+					raycast = scattered;
+				}
+			}
+		}
+	}
+
+	/// <summary>
+	/// returns the number of recorded rays intersected with the world per second (in millions)
+	/// the rays are replayed the given number of times and the best time is kept
+	/// </summary>
+	[[nodiscard]] float measure(const world& world, int repetitions = 3)
+	{
+		return measure([&world](const ray& raycast, hit_info& hit)
+		{
+			return world.hit(raycast, 0.001f, constants::infinity, hit);
+		}, repetitions);
+	}
+
+	/// <summary>
+	/// same as measure, testing the recorded rays for occlusion only (see world::occluded)
+	/// </summary>
+	[[nodiscard]] float measure_occluded(const world& world, int repetitions = 3)
+	{
+		return measure([&world](const ray& raycast, hit_info&)
+		{
+			return world.occluded(raycast, 0.001f, constants::infinity);
+		}, repetitions);
+	}
+
+	/// <summary>
+	/// same as measure, on the given bvh alone (e.g. to compare two node orders)
+	/// </summary>
+	[[nodiscard]] float measure(const bvh& bvh, int repetitions = 3)
+	{
+		return measure([&bvh](const ray& raycast, hit_info& hit)
+		{
+			hit.distance = constants::infinity;
+			return bvh.hit(raycast, 0.001f, constants::infinity, hit);
+		}, repetitions);
+	}
+
+	/// <summary>
+	/// trace the recorded rays as one batch with ray_queries (hit and occluded) on the threads of the pool,
+	/// and check their results against world::hit and world::occluded
+	/// the hits are allowed to differ by the object when they are at the same distance (e.g. overlapping boxes)
+	/// </summary>
+	[[nodiscard]] ray_query_throughput measure_queries(const world& world, thread_pool& pool, int repetitions = 3)
+	{
+		ray_query_throughput throughput;
+		if (m_rays.empty())
+			return throughput;
+
+		std::vector<point3> origins;
+		std::vector<direction3> directions;
+		for (const ray& raycast : m_rays)
+		{
+			origins.push_back(raycast.origin);
+			directions.push_back(raycast.direction);
+		}
+
+		ray_queries queries(pool);
+		std::vector<ray_query_hit> hits(m_rays.size());
+		std::vector<uint32_t> occluded_bits(ray_queries::occlusion_word_count(m_rays.size()));
+		const double ray_count = static_cast<double>(m_rays.size()) * 1e-6;
+		throughput.hit = static_cast<float>(ray_count / best_duration(repetitions, [&]
+		{
+			queries.hit(world, origins.data(), directions.data(), m_rays.size(), 0.001f, constants::infinity,
+			            hits.data());
+		}));
+		throughput.occluded = static_cast<float>(ray_count / best_duration(repetitions, [&]
+		{
+			queries.occluded(world, origins.data(), directions.data(), m_rays.size(), 0.001f, constants::infinity,
+			                 occluded_bits.data());
+		}));
+
+		for (size_t i = 0; i < m_rays.size(); i++)
+		{
+			hit_info hit{&lambertian_material::default_material()};
+			const bool is_hit = world.hit(m_rays[i], 0.001f, constants::infinity, hit);
+			if (is_hit != (hits[i].object != nullptr)
+				|| (is_hit && std::abs(hit.distance - hits[i].distance) > 1e-4f * std::max(hit.distance, 1.0f)))
+				throughput.hit_mismatches++;
+
+			const bool is_occluded = (occluded_bits[i / 32] >> (i % 32)) & 1u;
+			if (is_occluded != world.occluded(m_rays[i], 0.001f, constants::infinity))
+				throughput.occluded_mismatches++;
+		}
+		return throughput;
+	}
+
+	/// <summary>
+	/// returns the number of primary rays of a width x height image intersected with the world per second (in millions),
+	/// tile by tile, either one by one or as ray packets (see world::hit)
+	/// </summary>
+	[[nodiscard]] static float measure_primary(const camera& camera, const world& world, int width, int height,
+	                                           bool packets, int repetitions = 3)
+	{
+		constexpr int tile_size = static_cast<int>(ray_packet::tile_size);
+		std::vector<ray_packet> tiles;
+		for (int tile_y = 0; tile_y < height; tile_y += tile_size)
+		{
+			for (int tile_x = 0; tile_x < width; tile_x += tile_size)
+			{
+				ray_packet& packet = tiles.emplace_back();
+				for (int y = tile_y; y < std::min(tile_y + tile_size, height); y++)
+				{
+					for (int x = tile_x; x < std::min(tile_x + tile_size, width); x++)
+					{
+						sampler rng(sampler_type::independent, static_cast<uint32_t>(x), static_cast<uint32_t>(y), 0);
+						packet.add(camera.compute_ray_to((static_cast<float>(x) + 0.5f) / static_cast<float>(width),
+						                                 (static_cast<float>(y) + 0.5f) / static_cast<float>(height),
+						                                 rng));
+					}
+				}
+			}
+		}
+
+		std::vector<hit_info> hits(ray_packet::max_size, hit_info{&lambertian_material::default_material()});
+		double best_duration = constants::infinity;
+		for (int i = 0; i < repetitions; i++)
+		{
+			const auto chrono_start = std::chrono::high_resolution_clock::now();
+			for (const ray_packet& packet : tiles)
+			{
+				if (packets)
+				{
+					world.hit(packet, 0.001f, constants::infinity, hits.data());
+					continue;
+				}
+
+				for (uint32_t j = 0; j < packet.count; j++)
+				{
+					world.hit(packet.rays[j], 0.001f, constants::infinity, hits[j]);
+				}
+			}
+
+			const auto chrono_stop = std::chrono::high_resolution_clock::now();
+			best_duration = std::min(best_duration, std::chrono::duration<double>(chrono_stop - chrono_start).count());
+		}
+
+		return static_cast<float>(static_cast<double>(width) * height / best_duration * 1e-6);
+	}
+
+	/// <summary>
+	/// measure the SIMD kernels of the bvh traversal and of the renderer against their scalar version,
+	/// on the recorded rays and on the children of some inner nodes of the given bvh
+	/// </summary>
+	[[nodiscard]] kernel_throughput measure_kernels(const bvh& bvh, int repetitions = 3)
+	{
+		kernel_throughput throughput;
+		const std::vector<bvh_node>& nodes = bvh.nodes();
+		std::vector<uint32_t> inner_nodes;
+		for (uint32_t i = 0; i < nodes.size(); i++)
+		{
+			if (!nodes[i].is_leaf())
+				inner_nodes.push_back(i);
+		}
+		if (m_rays.empty() || inner_nodes.empty())
+			return throughput;
+
+		// the nodes are spread over the whole hierarchy, and the boxes of all of them fit in the cache
+		constexpr size_t node_count = 64;
+		std::vector<uint32_t> children;
+		for (size_t i = 0; i < node_count; i++)
+		{
+			children.push_back(nodes[inner_nodes[i * inner_nodes.size() / node_count]].offset);
+		}
+		const double box_pair_calls = static_cast<double>(m_rays.size()) * node_count * 1e-6;
+
+		// the results are accumulated so that the calls cannot be optimized away
+		int hit_count = 0;
+		throughput.box_pair_scalar = static_cast<float>(box_pair_calls / best_duration(repetitions, [&]
+		{
+			for (const ray& raycast : m_rays)
+			{
+				for (const uint32_t child : children)
+				{
+					hit_count += nodes[child].bbox.entry_distance(raycast, 0.001f, constants::infinity)
+						< nodes[child + 1].bbox.entry_distance(raycast, 0.001f, constants::infinity);
+				}
+			}
+		}));
+		throughput.box_pair_simd = static_cast<float>(box_pair_calls / best_duration(repetitions, [&]
+		{
+			for (const ray& raycast : m_rays)
+			{
+				const aabb::simd_ray box_ray(raycast);
+				for (const uint32_t child : children)
+				{
+					float left, right;
+					aabb::entry_distances(nodes[child].bbox, nodes[child + 1].bbox, box_ray, 0.001f, constants::infinity,
+					                      left, right);
+					hit_count += left < right;
+				}
+			}
+		}));
+
+		// consecutive recorded rays are grouped in packets
+		std::vector<ray_packet> packets((m_rays.size() + ray_packet::max_size - 1) / ray_packet::max_size);
+		for (size_t i = 0; i < m_rays.size(); i++)
+		{
+			packets[i / ray_packet::max_size].add(m_rays[i]);
+		}
+		alignas(32) float t_max[ray_packet::max_size];
+		std::fill_n(t_max, ray_packet::max_size, constants::infinity);
+		const double packet_box_calls = static_cast<double>(packets.size()) * node_count * 2 * 1e-6;
+		const auto measure_packet_boxes = [&](auto lanes)
+		{
+			constexpr uint32_t lane_count = decltype(lanes)::value;
+			return static_cast<float>(packet_box_calls / best_duration(repetitions, [&]
+			{
+				for (const ray_packet& packet : packets)
+				{
+					for (const uint32_t child : children)
+					{
+						float distance;
+						const uint32_t mask = packet.mask();
+						hit_count += bvh::packet_mask<lane_count>(nodes[child].bbox, packet, mask, 0.001f, t_max,
+						                                          distance) != 0;
+						hit_count += bvh::packet_mask<lane_count>(nodes[child + 1].bbox, packet, mask, 0.001f, t_max,
+						                                          distance) != 0;
+					}
+				}
+			}));
+		};
+		throughput.packet_box_4 = measure_packet_boxes(std::integral_constant<uint32_t, 4>{});
+		throughput.packet_box_8 = measure_packet_boxes(std::integral_constant<uint32_t, 8>{});
+
+		// one pixel per recorded ray, whose color is the direction of the ray
+		std::vector<raytrace_pixel> pixels;
+		for (size_t i = 0; i < m_rays.size(); i++)
+		{
+			raytrace_pixel& pixel = pixels.emplace_back(static_cast<int>(i * 3), 0.0f, 0.0f);
+			pixel.color = color(glm::abs(m_rays[i].direction) * 4.0f);
+		}
+		std::vector<unsigned char> colors(pixels.size() * 3);
+		const double resolve_calls = static_cast<double>(pixels.size()) * 1e-6;
+		throughput.resolve_scalar = static_cast<float>(resolve_calls / best_duration(repetitions, [&]
+		{
+			for (const raytrace_pixel& pixel : pixels)
+			{
+				const vec3 c = sqrt(0.25f * pixel.color) * 255.0f;
+				for (int i = 0; i < 3; i++)
+					colors[pixel.index + static_cast<long>(i)] = static_cast<unsigned char>(clamp(c[i], 0.0f, 255.0f));
+			}
+		}));
+		throughput.resolve_simd = static_cast<float>(resolve_calls / best_duration(repetitions, [&]
+		{
+			for (const raytrace_pixel& pixel : pixels)
+			{
+				pixel.resolve(0.25f, &colors[pixel.index]);
+			}
+		}));
+
+		// one pair of numbers per recorded ray, around whose direction the direction is sampled
+		std::vector<float> u1(m_rays.size()), u2(m_rays.size());
+		for (size_t i = 0; i < m_rays.size(); i++)
+		{
+			const uint64_t bits = random::hash(i);
+			u1[i] = static_cast<float>(bits >> 40) * 0x1p-24f;
+			u2[i] = static_cast<float>(bits & 0xFFFFFF) * 0x1p-24f;
+		}
+		std::vector<float> x(m_rays.size()), y(m_rays.size()), z(m_rays.size());
+		const double sample_calls = static_cast<double>(m_rays.size()) * 1e-6;
+		float direction_sum = 0.0f;
+		throughput.cosine_sample_scalar = static_cast<float>(sample_calls / best_duration(repetitions, [&]
+		{
+			for (size_t i = 0; i < m_rays.size(); i++)
+			{
+				const sampling::frame frame(m_rays[i].direction);
+				direction_sum += frame.to_world(sampling::cosine_hemisphere(u1[i], u2[i])).z;
+			}
+		}));
+		throughput.cosine_sample_simd = static_cast<float>(sample_calls / best_duration(repetitions, [&]
+		{
+			sampling::cosine_hemisphere(u1.data(), u2.data(), m_rays.size(), x.data(), y.data(), z.data());
+			for (size_t i = 0; i < m_rays.size(); i++)
+			{
+				const sampling::frame frame(m_rays[i].direction);
+				direction_sum += frame.tangent.z * x[i] + frame.bitangent.z * y[i] + frame.normal.z * z[i];
+			}
+		}));
+		hit_count += direction_sum > 0.0f;
+
+		last_hit_count = hit_count;
+		return throughput;
+	}
+
+	/// <summary>
+	/// check that the mappings of core/sampling.h (scalar and batch versions) follow their distribution,
+	/// on sample_count independent numbers: their moments, and the chi^2 of their histograms
+	/// </summary>
+	[[nodiscard]] static std::vector<sampling_statistics> measure_sampling(size_t sample_count = size_t{1} << 21)
+	{
+		std::vector<float> u1(sample_count), u2(sample_count), u3(sample_count);
+		for (size_t i = 0; i < sample_count; i++)
+		{
+			const uint64_t bits = random::hash(i);
+			u1[i] = static_cast<float>(bits >> 40) * 0x1p-24f;
+			u2[i] = static_cast<float>(bits & 0xFFFFFF) * 0x1p-24f;
+			u3[i] = static_cast<float>(random::hash(sample_count + i) >> 40) * 0x1p-24f;
+		}
+
+		std::vector<float> x(sample_count), y(sample_count), z(sample_count);
+		std::vector<sampling_statistics> statistics;
+		// add the statistics of the samples of x, y and z: radial_value maps a sample (and its r^2) to [0, 1],
+		// uniformly if the samples follow the distribution
+		const auto add = [&](const char* name, bool is_batch, float expected_z, float expected_square_z,
+		                     float expected_square_radius, const auto& radial_value)
+		{
+			constexpr int bin_count = 32;
+			const auto bin = [](float value)
+			{
+				return std::clamp(static_cast<int>(value * static_cast<float>(bin_count)), 0, bin_count - 1);
+			};
+
+			std::vector<size_t> radial_bins(bin_count), azimuth_bins(bin_count);
+			double sum_z = 0.0, sum_square_z = 0.0, sum_square_radius = 0.0;
+			for (size_t i = 0; i < sample_count; i++)
+			{
+				const float square_radius = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+				sum_z += z[i];
+				sum_square_z += static_cast<double>(z[i]) * z[i];
+				sum_square_radius += square_radius;
+				radial_bins[bin(radial_value(z[i], square_radius))]++;
+				azimuth_bins[bin(std::atan2(y[i], x[i]) / (2.0f * constants::pi) + 0.5f)]++;
+			}
+
+			sampling_statistics& result = statistics.emplace_back();
+			result.name = name;
+			result.is_batch = is_batch;
+			result.mean_z = static_cast<float>(sum_z / static_cast<double>(sample_count));
+			result.mean_square_z = static_cast<float>(sum_square_z / static_cast<double>(sample_count));
+			result.mean_square_radius = static_cast<float>(sum_square_radius / static_cast<double>(sample_count));
+			result.expected_z = expected_z;
+			result.expected_square_z = expected_square_z;
+			result.expected_square_radius = expected_square_radius;
+
+			const double expected_count = static_cast<double>(sample_count) / bin_count;
+			double chi_square = 0.0;
+			for (int i = 0; i < bin_count; i++)
+			{
+				const double radial_error = static_cast<double>(radial_bins[i]) - expected_count;
+				const double azimuth_error = static_cast<double>(azimuth_bins[i]) - expected_count;
+				chi_square += (radial_error * radial_error + azimuth_error * azimuth_error) / expected_count;
+			}
+			result.chi_square = static_cast<float>(chi_square);
+			result.degrees_of_freedom = 2 * (bin_count - 1);
+		};
+
+		for (const bool is_batch : {false, true})
+		{
+			// the cosine of a cosine-weighted direction has a density 2z: z^2 is uniform
+			if (is_batch)
+				sampling::cosine_hemisphere(u1.data(), u2.data(), sample_count, x.data(), y.data(), z.data());
+			else
+				for (size_t i = 0; i < sample_count; i++)
+					sampling::cosine_hemisphere(u1[i], u2[i], x[i], y[i], z[i]);
+			add("Cosine hemisphere", is_batch, 2.0f / 3.0f, 0.5f, 1.0f, [](float z_value, float)
+			{
+				return z_value * z_value;
+			});
+
+			// the height of a uniform direction of the sphere is uniform (Archimedes)
+			if (is_batch)
+				sampling::uniform_sphere(u1.data(), u2.data(), sample_count, x.data(), y.data(), z.data());
+			else
+				for (size_t i = 0; i < sample_count; i++)
+					sampling::uniform_sphere(u1[i], u2[i], x[i], y[i], z[i]);
+			add("Uniform sphere", is_batch, 0.0f, 1.0f / 3.0f, 1.0f, [](float z_value, float)
+			{
+				return 0.5f * (z_value + 1.0f);
+			});
+
+			// the area of the disk within a radius r is proportional to r^2
+			if (is_batch)
+				sampling::concentric_disk(u1.data(), u2.data(), sample_count, x.data(), y.data());
+			else
+				for (size_t i = 0; i < sample_count; i++)
+					sampling::concentric_disk(u1[i], u2[i], x[i], y[i]);
+			std::fill(z.begin(), z.end(), 0.0f);
+			add("Concentric disk", is_batch, 0.0f, 0.0f, 0.5f, [](float, float square_radius)
+			{
+				return square_radius;
+			});
+
+			// the volume of the ball within a radius r is proportional to r^3
+			if (is_batch)
+				sampling::uniform_ball(u1.data(), u2.data(), u3.data(), sample_count, x.data(), y.data(), z.data());
+			else
+				for (size_t i = 0; i < sample_count; i++)
+				{
+					const vec3 point = sampling::uniform_ball(u1[i], u2[i], u3[i]);
+					x[i] = point.x;
+					y[i] = point.y;
+					z[i] = point.z;
+				}
+			add("Uniform ball", is_batch, 0.0f, 0.2f, 0.6f, [](float, float square_radius)
+			{
+				return square_radius * std::sqrt(square_radius);
+			});
+		}
+		return statistics;
+	}
+
+	/// <summary>
+	/// measure how fast each sampler converges on the scene (see measure_convergences)
+	/// the stratified sampler divides its grid for max_samples samples
+	/// </summary>
+	[[nodiscard]] static std::vector<sampler_convergence> measure_convergence(
+		const camera& camera, const world& world, const raytrace_settings& settings, int stride = 8,
+		uint32_t max_samples = 32, uint32_t reference_samples = 1024)
+	{
+		std::vector<sampler_convergence> convergences;
+		for (const sampler_type type : {sampler_type::independent, sampler_type::stratified, sampler_type::sobol,
+		                                sampler_type::blue_noise})
+		{
+			convergences.push_back({type, settings.light_sampling});
+		}
+		measure_convergences(camera, world, settings, stride, max_samples, reference_samples, convergences);
+		return convergences;
+	}
+
+	/// <summary>
+	/// measure how fast the sampler of the settings converges on the scene with each way of sampling the lights
+	/// (see measure_convergences): as the lights cost a shadow ray per non-specular hit, they are compared
+	/// at equal time with their durations
+	/// </summary>
+	[[nodiscard]] static std::vector<sampler_convergence> measure_light_sampling(
+		const camera& camera, const world& world, const raytrace_settings& settings, int stride = 8,
+		uint32_t max_samples = 32, uint32_t reference_samples = 1024)
+	{
+		std::vector<sampler_convergence> convergences;
+		for (const raytrace_light_sampling light_sampling : {raytrace_light_sampling::none, raytrace_light_sampling::lights,
+		                                                     raytrace_light_sampling::mis_balance,
+		                                                     raytrace_light_sampling::mis_power})
+		{
+			convergences.push_back({settings.sampling, light_sampling});
+		}
+		measure_convergences(camera, world, settings, stride, max_samples, reference_samples, convergences);
+		return convergences;
+	}
+
+	/// <summary>
+	/// returns the work done by the given bvh to intersect the recorded rays
+	/// </summary>
+	[[nodiscard]] bvh_traversal_stats traversal_stats(const bvh& bvh) const
+	{
+		bvh_traversal_stats stats;
+		for (const ray& raycast : m_rays)
+		{
+			hit_info hit{&lambertian_material::default_material()};
+			hit.distance = constants::infinity;
+			bvh.hit(raycast, 0.001f, constants::infinity, hit, stats);
+		}
+		return stats;
+	}
+
+	[[nodiscard]] size_t ray_count() const
+	{
+		return m_rays.size();
+	}
+
+	// number of rays that hit an object during the last measure (can be used to check that structures agree)
+	int last_hit_count{0};
+
+private:
+	/// <summary>
+	/// measure how fast the given configurations (a sampler, and the way the lights are sampled) converge on the scene:
+	/// one pixel out of stride on each axis of the image is rendered with 1, 2, 4... up to max_samples samples,
+	/// and compared with a reference rendered with reference_samples independent samples, with multiple importance
+	/// sampling (whose indices do not overlap the ones of the measured samples)
+	/// </summary>
+	static void measure_convergences(const camera& camera, const world& world, const raytrace_settings& settings,
+	                                 int stride, uint32_t max_samples, uint32_t reference_samples,
+	                                 std::vector<sampler_convergence>& convergences)
+	{
+		compiled_scene scene;
+		scene.compile(world);
+
+		std::vector<raytrace_pixel> pixels;
+		for (int y = 0; y < settings.image_height; y += stride)
+		{
+			for (int x = 0; x < settings.image_width; x += stride)
+			{
+				pixels.emplace_back(static_cast<int>(pixels.size()), static_cast<float>(x), static_cast<float>(y));
+			}
+		}
+
+		// add the samples from first_sample to end_sample of the given sampler to the pixels
+		const auto render = [&camera, &scene, &settings, &pixels, max_samples](
+			sampler_type type, raytrace_light_sampling light_sampling, uint32_t first_sample, uint32_t end_sample)
+		{
+			raytrace_settings render_settings = settings;
+			render_settings.light_sampling = light_sampling;
+			std::for_each(std::execution::par, pixels.begin(), pixels.end(),
+			              [&camera, &scene, &render_settings, type, first_sample, end_sample, max_samples](
+			              raytrace_pixel& pixel)
+			              {
+				              for (uint32_t i = first_sample; i < end_sample; i++)
+				              {
+					              sampler rng(type, static_cast<uint32_t>(pixel.x), static_cast<uint32_t>(pixel.y), i,
+					                          max_samples);
+					              const float u = (pixel.x + rng.get()) * render_settings.inv_image_width;
+					              const float v = (pixel.y + rng.get()) * render_settings.inv_image_height;
+					              pixel.color = color(pixel.color
+						              + raytrace_render_thread::ray_color_with_gradient_sky_attenuated(
+							              camera.compute_ray_to(u, v, rng), scene, render_settings, color::white(),
+							              color::black(), rng));
+				              }
+			              });
+		};
+
+		constexpr uint32_t reference_first_sample = 1u << 24;
+		render(sampler_type::independent, raytrace_light_sampling::mis_power, reference_first_sample, reference_first_sample + reference_samples);
+		std::vector<color> reference;
+		for (const raytrace_pixel& pixel : pixels)
+		{
+			reference.emplace_back(pixel.color / static_cast<float>(reference_samples));
+		}
+
+		for (sampler_convergence& convergence : convergences)
+		{
+			convergence.errors.clear();
+			convergence.durations.clear();
+			for (raytrace_pixel& pixel : pixels)
+			{
+				pixel.color = color::black();
+			}
+
+			double duration = 0.0;
+			for (uint32_t samples = 1, rendered = 0; samples <= max_samples; samples *= 2)
+			{
+				duration += best_duration(1, [&render, &convergence, rendered, samples]
+				{
+					render(convergence.type, convergence.light_sampling, rendered, samples);
+				});
+				rendered = samples;
+
+				double squared_error = 0.0;
+				for (size_t i = 0; i < pixels.size(); i++)
+				{
+					const vec3 error = pixels[i].color / static_cast<float>(samples) - reference[i];
+					squared_error += static_cast<double>(dot(error, error)) / 3.0;
+				}
+				convergence.errors.push_back(static_cast<float>(std::sqrt(squared_error / static_cast<double>(pixels.size()))));
+				convergence.durations.push_back(static_cast<float>(duration * 1000.0));
+			}
+		}
+	}
+
+	template <typename HitFunction>
+	float measure(const HitFunction& hit_function, int repetitions)
+	{
+		const double duration = best_duration(repetitions, [this, &hit_function]
+		{
+			int hit_count = 0;
+			for (const ray& raycast : m_rays)
+			{
+				hit_info hit{&lambertian_material::default_material()};
+				hit_count += hit_function(raycast, hit);
+			}
+			last_hit_count = hit_count;
+		});
+
+		return static_cast<float>(static_cast<double>(m_rays.size()) / duration * 1e-6);
+	}
+
+	/// <summary>
+	/// returns the best duration of the given number of runs of the function (in seconds)
+	/// </summary>
+	template <typename Function>
+	static double best_duration(int repetitions, const Function& function)
+	{
+		double best = constants::infinity;
+		for (int i = 0; i < repetitions; i++)
+		{
+			const auto chrono_start = std::chrono::high_resolution_clock::now();
+			function();
+			const auto chrono_stop = std::chrono::high_resolution_clock::now();
+			best = std::min(best, std::chrono::duration<double>(chrono_stop - chrono_start).count());
+		}
+		return best;
+	}
+
+	std::vector<ray> m_rays;
+};
@@ -10,48 +10,9 @@
 #include "world.h"
 #include "core/color.h"
 #include "materials/lambertian_material.h"
-
-/// <summary>
-/// represent a raytraced pixel with its index, its coordinates in the image and its resulting color.
-/// These first three parameters are constant during the lifetime of an object
-/// </summary>
-struct raytrace_pixel
-{
-	const long index;
-	const float x;
-	const float y;
-	color color = color::black();
-
-	raytrace_pixel(int index, float x, float y) : index(index), x(x), y(y)
-	{
-	}
-};
-
-struct raytrace_settings
-{
-	raytrace_settings(int image_width, int image_height)
-		: image_width(image_width)
-	,		  image_height(image_height)
-	,		  inv_image_width(1.0f / static_cast<float>(image_width - 1))
-	,		  inv_image_height(1.0f / static_cast<float>(image_height - 1))
-	{
-	}
-
-	int bounce_depth = 12;
-	color bounce_depth_limit_color = color::black();
-
-	color background_bottom_color = color::white();
-	color background_top_color = color(0.5f, 0.7f, 1.0f);
-	float background_strength = 1.0f;
-
-	const int image_width;
-	const int image_height;
-
-	const float inv_image_width;
-	const float inv_image_height;
-
-	bool use_bvh = true;
-};
+#include "renderer/compiled_scene.h"
+#include "renderer/raytrace_settings.h"
+#include "renderer/wavefront_integrator.h"
 
 /// <summary>
 /// represent the result of a render
@@ -64,9 +25,13 @@ struct raytrace_render_data
 	{
 	}
 
-	void reset(const raytrace_render_data& empty_render)
+	/// <summary>
+	/// restart the render from scratch, after the given changes of the world (see compiled_scene::update)
+	/// </summary>
+	void reset(const raytrace_render_data& empty_render, const scene_changes& changes = scene_changes::all())
 	{
 		iteration = 1.0f;
+		pending_changes.merge(changes);
 		set_pixels_from(empty_render);
 	}
 
@@ -98,8 +63,15 @@ struct raytrace_render_data
 	// settings specific for this render: see raytrace_settings
 	raytrace_settings settings;
 
+	// the world as it is rendered: each render has its own, since they may render different worlds
+	compiled_scene scene;
+	// what changed in the world since the scene was last updated (see raytrace_render_thread::render)
+	scene_changes pending_changes = scene_changes::all();
+
 	// timing of the last render
 	long long last_render_duration = 0;
+	// timing of the stages of the last render, if it used the wavefront integrator
+	wavefront_timings last_wavefront_timings;
 };
 
 /// <summary>
@@ -126,6 +98,7 @@ struct raytrace_render_thread
 	bool is_alive{false};
 	std::thread thread;
 	std::deque<std::shared_ptr<raytrace_render_command>> commands;
+	wavefront_integrator wavefront;
 
 	explicit raytrace_render_thread()
 	{
@@ -210,6 +183,11 @@ struct raytrace_render_thread
 	{
 		auto chrono_start = std::chrono::high_resolution_clock::now();
 
+		// the render only goes through the compiled scene: the world is only read here
+		data.scene.update(world, data.pending_changes);
+		data.pending_changes = {};
+		const compiled_scene& scene = data.scene;
+
 		int it_by_frame = 1;
 		
 		// render settings
@@ -220,31 +198,123 @@ struct raytrace_render_thread
 		const size_t pixel_count = data.pixels.size();
 		int increment = 1;
 
-		const auto process_pixel = [&pixel_colors, &world, &camera, render_settings,
-				inv_samples_per_pixel,
+		// convert pixel.color into image-readable ascii pixel_colors
+		const auto write_pixel = [&pixel_colors, inv_samples_per_pixel](const raytrace_pixel& pixel)
+		{
+			pixel.resolve(inv_samples_per_pixel, &pixel_colors[pixel.index]);
+		};
+
+		const auto process_pixel = [write_pixel, &scene, &camera, render_settings,
 				inv_width{render_settings.inv_image_width}, inv_height{render_settings.inv_image_height},
-				it_by_frame, &pixels{data.pixels}](raytrace_pixel& pixel)
+				it_by_frame](raytrace_pixel& pixel)
 		{
 			for (int i = 0; i < it_by_frame; i++)
 			{
-				const float u = (pixel.x + random::static_float.get()) * inv_width;
-				const float v = (pixel.y + random::static_float.get()) * inv_height;
+				sampler rng = pixel.next_sample(render_settings);
+				const float u = (pixel.x + rng.get()) * inv_width;
+				const float v = (pixel.y + rng.get()) * inv_height;
 				pixel.color = color(pixel.color
-					+ ray_color_with_gradient_sky_attenuated(camera.compute_ray_to(u, v), world,
+					+ ray_color_with_gradient_sky_attenuated(camera.compute_ray_to(u, v, rng), scene,
 					                                         render_settings, color::white(),
-					                                         color::black()));
+					                                         color::black(), rng));
 			}
+			write_pixel(pixel);
+		};
+
+		// same as process_pixel for the pixels of a tile, whose primary rays are intersected together (see ray_packet)
+		const int tiles_x = (render_settings.image_width + ray_packet::tile_size - 1) / ray_packet::tile_size;
+		const int tiles_y = (render_settings.image_height + ray_packet::tile_size - 1) / ray_packet::tile_size;
+		const auto process_tiles = [write_pixel, &scene, &camera, render_settings,
+				inv_width{render_settings.inv_image_width}, inv_height{render_settings.inv_image_height},
+				it_by_frame, tiles_x, tile_count{static_cast<size_t>(tiles_x) * tiles_y}, &pixels{data.pixels},
+				&is_alive{is_alive}](size_t first_tile, size_t step)
+		{
+			constexpr int tile_size = static_cast<int>(ray_packet::tile_size);
+			ray_packet packet;
+			raytrace_pixel* tile_pixels[ray_packet::max_size];
+			std::vector<sampler> samplers;
+			samplers.reserve(ray_packet::max_size);
+			std::vector<hit_info> hits(ray_packet::max_size, hit_info{&lambertian_material::default_material()});
+			for (size_t tile = first_tile; tile < tile_count && is_alive; tile += step)
+			{
+				const int start_x = static_cast<int>(tile % tiles_x) * tile_size;
+				const int start_y = static_cast<int>(tile / tiles_x) * tile_size;
+				const int end_x = std::min(start_x + tile_size, render_settings.image_width);
+				const int end_y = std::min(start_y + tile_size, render_settings.image_height);
+				for (int i = 0; i < it_by_frame; i++)
+				{
+					packet.clear();
+					samplers.clear();
+					for (int y = start_y; y < end_y; y++)
+					{
+						for (int x = start_x; x < end_x; x++)
+						{
+							raytrace_pixel& pixel = pixels[static_cast<size_t>(y) * render_settings.image_width + x];
+							sampler& rng = samplers.emplace_back(pixel.next_sample(render_settings));
+							const float u = (pixel.x + rng.get()) * inv_width;
+							const float v = (pixel.y + rng.get()) * inv_height;
+							tile_pixels[packet.count] = &pixel;
+							hits[packet.count] = hit_info{&lambertian_material::default_material()};
+							packet.add(camera.compute_ray_to(u, v, rng));
+						}
+					}
+
+					// only the primary rays are traced as a packet: the bounced rays are not coherent anymore
+					const uint32_t hit_mask = scene.hit(packet, 0.001f, constants::infinity, hits.data());
+					for (uint32_t j = 0; j < packet.count; j++)
+					{
+						raytrace_pixel& pixel = *tile_pixels[j];
+						pixel.color = color(pixel.color
+							+ ray_color_from_hit(packet.rays[j], hits[j], (hit_mask >> j) & 1u, scene,
+							                     render_settings, color::white(), color::black(), samplers[j]));
+					}
+				}
 
-			// convert pixels[j].color into image-readable ascii pixel_colors
-			vec3 c = sqrt(inv_samples_per_pixel * pixel.color) * 255.0f;
-			for (int i = 0; i < 3; i++)
-				pixel_colors[pixel.index + static_cast<long>(i)] = static_cast<unsigned char>(clamp(
-					c[i], 0.0f, 255.0f));
+				for (uint32_t j = 0; j < packet.count; j++)
+				{
+					write_pixel(*tile_pixels[j]);
+				}
+			}
 		};
 		
 		if (!data.extra_progressive || (data.iteration - 10) > 0.2f)
 		{
-			std::for_each(std::execution::par, data.pixels.begin(), data.pixels.end(), process_pixel);
+			if (render_settings.integrator == raytrace_integrator::wavefront)
+			{
+				for (int i = 0; i < it_by_frame; i++)
+				{
+					data.last_wavefront_timings = wavefront.render(camera, scene, render_settings, data.pixels, is_alive);
+				}
+				std::for_each(std::execution::par, data.pixels.begin(), data.pixels.end(), write_pixel);
+			}
+			else if (render_settings.use_ray_packets && camera.is_pinhole())
+			{
+				// tiles are interleaved between the threads so that each of them gets a share of the costly parts
+				for (size_t i = 0; i < thread_count; i++)
+				{
+					pool.async(process_tiles, i, thread_count);
+				}
+				pool.wait();
+			}
+			else
+			{
+				std::for_each(std::execution::par, data.pixels.begin(), data.pixels.end(), process_pixel);
+			}
+		}
+		else if (render_settings.integrator == raytrace_integrator::wavefront)
+		{
+			// one pixel out of increment, as below, traced by the selected integrator
+			increment = 3;
+			const size_t offset = static_cast<size_t>(data.iteration) % increment;
+			for (int i = 0; i < it_by_frame; i++)
+			{
+				data.last_wavefront_timings = wavefront.render(camera, scene, render_settings, data.pixels, is_alive,
+				                                               offset, increment);
+			}
+			for (size_t j = offset; j < pixel_count; j += increment)
+			{
+				write_pixel(data.pixels[j]);
+			}
 		}
 		else
 		{
@@ -278,40 +348,71 @@ struct raytrace_render_thread
 
 	/// <summary>
 	/// return the color for the given raycast, using a blue-gradient sky (when the raycast returns no hit)
+	/// the random numbers of the bounces are drawn from rng, the sampler of the sample
 	/// </summary>
-	static color ray_color_with_gradient_sky_attenuated(ray raycast, const world& world,
+	static color ray_color_with_gradient_sky_attenuated(ray raycast, const compiled_scene& scene,
 	                                                    const raytrace_settings& settings,
-	                                                    color acc_attenuation, color acc_emitted)
+	                                                    color acc_attenuation, color acc_emitted, sampler& rng)
+	{
+		hit_info hit{&lambertian_material::default_material()};
+		const bool has_hit = scene.hit(raycast, 0.001f, constants::infinity, hit);
+		return ray_color_from_hit(raycast, hit, has_hit, scene, settings, acc_attenuation, acc_emitted, rng);
+	}
+
+	/// <summary>
+	/// same as ray_color_with_gradient_sky_attenuated, for a ray already intersected with the scene
+	/// (has_hit and hit are the result of compiled_scene::hit, e.g. for a ray of a ray_packet)
+	/// </summary>
+	static color ray_color_from_hit(ray raycast, hit_info hit, bool has_hit, const compiled_scene& scene,
+	                                const raytrace_settings& settings, color acc_attenuation, color acc_emitted,
+	                                sampler& rng)
 	{
 		int depth = settings.bounce_depth;
+		// density of the direction of the ray if the hit that scattered it sampled the lights, 0 otherwise:
+		// the light of the lights it hits is then weighted (see compiled_scene::scattered_light_weight)
+		float scatter_pdf = 0.0f;
 		while (true)
 		{
-			hit_info hit{&lambertian_material::default_material()};
-			if (!world.hit(raycast, 0.001f, constants::infinity, hit))
+			if (!has_hit)
 			{
-				const float t = 0.5f * (raycast.direction.y + 1.0f);
-				return color(acc_emitted + (acc_attenuation *
-				                               color(((1.0f - t) * settings.background_bottom_color + t * settings.
-					                               background_top_color) * settings.background_strength)));
+				return color(acc_emitted + (acc_attenuation * settings.background_color(raycast.direction)));
 			}
 
+			const float emitted_weight = scatter_pdf > 0.0f
+				                             ? scene.scattered_light_weight(raycast, hit, scatter_pdf, settings.light_sampling)
+				                             : 1.0f;
+			if (emitted_weight > 0.0f)
+				acc_emitted = color(acc_emitted + (acc_attenuation * scene.emitted(hit) * emitted_weight));
+
+			// the light of the lights is not sampled past the last bounce, whose scattered ray is not traced
+			color direct_light;
+			const int bounce = settings.bounce_depth - depth;
+			rng.start_light(bounce);
+			const bool has_sampled_lights = depth > 1
+				&& scene.direct_light(raycast, hit, settings.light_sampling, rng, direct_light);
+			if (has_sampled_lights)
+				acc_emitted = color(acc_emitted + (acc_attenuation * direct_light));
+
 			color attenuation;
 			ray scattered;
-			const color emitted = hit.material->emitted(hit.uv_coordinates, hit.point);
-			if (hit.material->scatter(raycast, hit, attenuation, scattered))
+			rng.start_bounce(bounce);
+			if (scene.scatter(raycast, hit, attenuation, scattered, rng))
 			{
+				scatter_pdf = has_sampled_lights ? scene.pdf(raycast, hit, scattered.direction) : 0.0f;
 				raycast = scattered;
 				acc_attenuation = color(acc_attenuation * attenuation);
-				acc_emitted = color(acc_emitted + (acc_attenuation * emitted));
 				depth = depth - 1;
 				if (depth < 1)
 				{
 					return color(acc_emitted + (acc_attenuation * settings.bounce_depth_limit_color));
 				}
+
+				hit = hit_info{&lambertian_material::default_material()};
+				has_hit = scene.hit(raycast, 0.001f, constants::infinity, hit);
 				continue;
 			}
 
-			return color(acc_emitted + (acc_attenuation * emitted));
+			return acc_emitted;
 		}
 	}
 };
@@ -358,11 +459,12 @@ public:
 
 	/// <summary>
 	/// signal the renderer that the scene has changed so that it resets its current render from scratch
+	/// the changes tell how much of the compiled scene has to be updated (see compiled_scene::update)
 	/// </summary>
-	void signal_scene_change()
+	void signal_scene_change(const scene_changes& changes = scene_changes::all())
 	{
 		thread.interrupt();
-		current_render.reset(empty_render);
+		current_render.reset(empty_render, changes);
 	}
 
 	/// <summary>
@@ -0,0 +1,125 @@
+﻿#pragma once
+
+#include "core/color.h"
+#include "core/sampler.h"
+#include "core/simd.h"
+
+struct raytrace_settings;
+
+/// <summary>
+/// represent a raytraced pixel with its index, its coordinates in the image and its resulting color.
+/// These first three parameters are constant during the lifetime of an object
+/// </summary>
+struct raytrace_pixel
+{
+	const long index;
+	const float x;
+	const float y;
+	color color = color::black();
+	// number of samples accumulated in color: it is also the index of the next sample (see sampler)
+	uint32_t sample_count = 0;
+
+	raytrace_pixel(int index, float x, float y) : index(index), x(x), y(y)
+	{
+	}
+
+	/// <summary>
+	/// returns the sampler of the next sample of the pixel, and counts the sample
+	/// </summary>
+	sampler next_sample(const raytrace_settings& settings);
+
+	/// <summary>
+	/// write the gamma-corrected (gamma 2) average of the samples accumulated in color to the 3 given channels
+	/// </summary>
+	void resolve(float inv_samples, unsigned char* channels) const
+	{
+		const float4 average = float4::from_vec3(color) * float4(inv_samples);
+		// max is given 0 as its second operand so that a NaN color is written black
+		const float4 value = min(max(sqrt(average) * float4(255.0f), float4(0.0f)), float4(255.0f));
+		alignas(16) float values[float4::width];
+		value.store(values);
+		for (int i = 0; i < 3; i++)
+			channels[i] = static_cast<unsigned char>(values[i]);
+	}
+};
+
+/// <summary>
+/// the way the paths of a render are traced
+/// </summary>
+enum class raytrace_integrator
+{
+	// each path is traced to completion, one after the other (see raytrace_render_thread::ray_color_from_hit)
+	path,
+	// all the paths are traced one bounce at a time (see wavefront_integrator)
+	wavefront
+};
+
+/// <summary>
+/// the way the light of the emissive spheres and rectangles reaches the hits (see compiled_scene::direct_light)
+/// </summary>
+enum class raytrace_light_sampling
+{
+	// only through the rays scattered by the materials
+	none,
+	// the non-specular hits sample the lights directly, and the lights their scattered rays hit are not counted
+	lights,
+	// both, each one weighted against the other with the balance heuristic (multiple importance sampling)
+	mis_balance,
+	// same with the power heuristic
+	mis_power
+};
+
+struct raytrace_settings
+{
+	raytrace_settings(int image_width, int image_height)
+		: image_width(image_width)
+	,		  image_height(image_height)
+	,		  inv_image_width(1.0f / static_cast<float>(image_width - 1))
+	,		  inv_image_height(1.0f / static_cast<float>(image_height - 1))
+	{
+	}
+
+	int bounce_depth = 12;
+	color bounce_depth_limit_color = color::black();
+
+	color background_bottom_color = color::white();
+	color background_top_color = color(0.5f, 0.7f, 1.0f);
+	float background_strength = 1.0f;
+
+	const int image_width;
+	const int image_height;
+
+	const float inv_image_width;
+	const float inv_image_height;
+
+	bool use_bvh = true;
+
+	// if true, the primary rays of pinhole cameras are intersected by packets of ray_packet::tile_size^2 pixels
+	bool use_ray_packets = true;
+
+	raytrace_integrator integrator = raytrace_integrator::path;
+
+	// sampling the lights suits the small lights and scattering the rays the glossy reflections of the large ones:
+	// multiple importance sampling combines both
+	raytrace_light_sampling light_sampling = raytrace_light_sampling::mis_power;
+
+	// the way the numbers of the samples are drawn (pixel jitter, lens and scattering: see sampler)
+	sampler_type sampling = sampler_type::sobol;
+	// number of samples per pixel the grid of the stratified sampler is divided for
+	int stratified_sample_count = 1024;
+
+	/// <summary>
+	/// returns the color of the gradient sky seen in the given direction (when a ray hits nothing)
+	/// </summary>
+	[[nodiscard]] color background_color(const direction3& direction) const
+	{
+		const float t = 0.5f * (direction.y + 1.0f);
+		return color(((1.0f - t) * background_bottom_color + t * background_top_color) * background_strength);
+	}
+};
+
+inline sampler raytrace_pixel::next_sample(const raytrace_settings& settings)
+{
+	return sampler(settings.sampling, static_cast<uint32_t>(x), static_cast<uint32_t>(y), sample_count++,
+	               static_cast<uint32_t>(settings.stratified_sample_count));
+}
@@ -0,0 +1,222 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <execution>
+#include <numeric>
+#include <vector>
+
+#include "camera.h"
+#include "core/color.h"
+#include "core/sampler.h"
+#include "materials/lambertian_material.h"
+#include "renderer/compiled_scene.h"
+#include "renderer/raytrace_settings.h"
+
+/// <summary>
+/// time spent in each stage of a wavefront_integrator render (in milliseconds)
+/// </summary>
+struct wavefront_timings
+{
+	double generate = 0.0;
+	double intersect = 0.0;
+	double sort = 0.0;
+	double shade = 0.0;
+	double compact = 0.0;
+
+	// number of bounces and of rays intersected during the render
+	int bounces = 0;
+	size_t rays = 0;
+
+	[[nodiscard]] double total() const
+	{
+		return generate + intersect + sort + shade + compact;
+	}
+};
+
+/// <summary>
+/// traces the paths of all the pixels one bounce at a time, instead of each path to completion one after the other.
+/// Each bounce goes through the following stages, each of them running in parallel over the live paths:
+/// - intersect: the rays of all the paths are intersected with the scene
+/// - sort: the paths are sorted by the type (then the instance) of the material they hit, and moved in that order
+/// - shade: the paths are shaded in that order, so that each material implementation runs over a whole batch of paths
+///			 instead of alternating with the others and with the traversal of unrelated parts of the bvh
+/// - compact: the terminated paths are removed so that the next bounce only processes the live ones
+/// It computes the same colors as raytrace_render_thread::ray_color_from_hit: a sample draws the same random numbers
+/// in both (see sampler), so both integrators render the same image
+/// </summary>
+class wavefront_integrator
+{
+public:
+	/// <summary>
+	/// add one sample to the color of each pixel and returns the time spent in each stage
+	/// only the pixels first_pixel, first_pixel + pixel_step... are rendered (see raytrace_render_data::extra_progressive)
+	/// the render stops between two bounces once is_alive is false (the paths left are dropped)
+	/// </summary>
+	wavefront_timings render(const camera& camera, const compiled_scene& scene, const raytrace_settings& settings,
+	                         std::vector<raytrace_pixel>& pixels, const bool& is_alive, size_t first_pixel = 0,
+	                         size_t pixel_step = 1)
+	{
+		using clock = std::chrono::high_resolution_clock;
+
+		wavefront_timings timings;
+		auto stage_start = clock::now();
+		const auto end_stage = [&stage_start](double& duration)
+		{
+			const auto now = clock::now();
+			duration += std::chrono::duration<double, std::milli>(now - stage_start).count();
+			stage_start = now;
+		};
+
+		// generate: one camera ray per pixel
+		const size_t path_count = first_pixel < pixels.size()
+			                          ? (pixels.size() - first_pixel + pixel_step - 1) / pixel_step
+			                          : 0;
+		m_paths.assign(path_count, wavefront_path{});
+		std::for_each(std::execution::par, m_paths.begin(), m_paths.end(),
+		              [this, &camera, &settings, &pixels, first_pixel, pixel_step](wavefront_path& path)
+		              {
+			              const size_t index = static_cast<size_t>(&path - m_paths.data());
+			              path.pixel = static_cast<uint32_t>(first_pixel + index * pixel_step);
+			              raytrace_pixel& pixel = pixels[path.pixel];
+			              path.rng = pixel.next_sample(settings);
+			              const float u = (pixel.x + path.rng.get()) * settings.inv_image_width;
+			              const float v = (pixel.y + path.rng.get()) * settings.inv_image_height;
+			              path.raycast = camera.compute_ray_to(u, v, path.rng);
+			              path.depth = settings.bounce_depth;
+		              });
+		end_stage(timings.generate);
+
+		while (!m_paths.empty() && is_alive)
+		{
+			timings.bounces++;
+			timings.rays += m_paths.size();
+
+			std::for_each(std::execution::par, m_paths.begin(), m_paths.end(), [&scene](wavefront_path& path)
+			{
+				path.hit = hit_info{&lambertian_material::default_material()};
+				path.has_hit = scene.hit(path.raycast, 0.001f, constants::infinity, path.hit);
+				// the paths that hit nothing come first
+				path.material_type = path.has_hit ? scene.material_type(path.hit) + 1 : 0;
+			});
+			end_stage(timings.intersect);
+
+			m_order.resize(m_paths.size());
+			std::iota(m_order.begin(), m_order.end(), 0u);
+			std::sort(std::execution::par, m_order.begin(), m_order.end(), [this](uint32_t a, uint32_t b)
+			{
+				const wavefront_path& left = m_paths[a];
+				const wavefront_path& right = m_paths[b];
+				if (left.material_type != right.material_type)
+					return left.material_type < right.material_type;
+				return left.hit.material_index < right.hit.material_index;
+			});
+			// the paths themselves are moved in that order, so that the paths of a material are contiguous in memory
+			// (compact keeps them in order for the next bounce, where the sort has little left to do)
+			m_sorted_paths.resize(m_paths.size());
+			std::transform(std::execution::par, m_order.begin(), m_order.end(), m_sorted_paths.begin(),
+			               [this](uint32_t index) { return m_paths[index]; });
+			m_paths.swap(m_sorted_paths);
+			end_stage(timings.sort);
+
+			std::for_each(std::execution::par, m_paths.begin(), m_paths.end(),
+			              [&scene, &settings, &pixels](wavefront_path& path)
+			              {
+				              shade(path, scene, settings, pixels);
+			              });
+			end_stage(timings.shade);
+
+			m_paths.erase(std::remove_if(std::execution::par, m_paths.begin(), m_paths.end(),
+			                             [](const wavefront_path& path) { return !path.is_alive; }),
+			              m_paths.end());
+			end_stage(timings.compact);
+		}
+
+		return timings;
+	}
+
+private:
+	/// <summary>
+	/// state of the path of a pixel between two bounces
+	/// </summary>
+	struct wavefront_path
+	{
+		ray raycast;
+		hit_info hit{&lambertian_material::default_material()};
+		// accumulated attenuation and emitted light along the path
+		color attenuation = color::white();
+		color emitted = color::black();
+		// random numbers of the sample, drawn in the same order as by ray_color_from_hit
+		sampler rng{sampler_type::independent, 0, 0, 0};
+		// sort key of the hit material (0 if the ray hit nothing)
+		size_t material_type = 0;
+		uint32_t pixel = 0;
+		// remaining number of bounces
+		int depth = 0;
+		bool has_hit = false;
+		// density of the direction of the ray if the hit that scattered it sampled the lights, 0 otherwise
+		// (see raytrace_render_thread::ray_color_from_hit)
+		float scatter_pdf = 0.0f;
+		bool is_alive = true;
+	};
+
+	/// <summary>
+	/// shade the hit of the path: either scatter its ray for the next bounce or terminate it
+	/// (same steps as raytrace_render_thread::ray_color_from_hit)
+	/// </summary>
+	static void shade(wavefront_path& path, const compiled_scene& scene, const raytrace_settings& settings,
+	                  std::vector<raytrace_pixel>& pixels)
+	{
+		if (!path.has_hit)
+		{
+			terminate(path, color(path.emitted + path.attenuation * settings.background_color(path.raycast.direction)),
+			          pixels);
+			return;
+		}
+
+		const float emitted_weight = path.scatter_pdf > 0.0f
+			                             ? scene.scattered_light_weight(path.raycast, path.hit, path.scatter_pdf,
+			                                                            settings.light_sampling)
+			                             : 1.0f;
+		if (emitted_weight > 0.0f)
+			path.emitted = color(path.emitted + path.attenuation * scene.emitted(path.hit) * emitted_weight);
+
+		color direct_light;
+		const int bounce = settings.bounce_depth - path.depth;
+		path.rng.start_light(bounce);
+		const bool has_sampled_lights = path.depth > 1
+			&& scene.direct_light(path.raycast, path.hit, settings.light_sampling, path.rng, direct_light);
+		if (has_sampled_lights)
+			path.emitted = color(path.emitted + path.attenuation * direct_light);
+
+		color attenuation;
+		ray scattered;
+		path.rng.start_bounce(bounce);
+		if (scene.scatter(path.raycast, path.hit, attenuation, scattered, path.rng))
+		{
+			path.scatter_pdf = has_sampled_lights ? scene.pdf(path.raycast, path.hit, scattered.direction) : 0.0f;
+			path.raycast = scattered;
+			path.attenuation = color(path.attenuation * attenuation);
+			path.depth--;
+			if (path.depth < 1)
+			{
+				terminate(path, color(path.emitted + path.attenuation * settings.bounce_depth_limit_color), pixels);
+			}
+			return;
+		}
+
+		terminate(path, path.emitted, pixels);
+	}
+
+	static void terminate(wavefront_path& path, const color& value, std::vector<raytrace_pixel>& pixels)
+	{
+		raytrace_pixel& pixel = pixels[path.pixel];
+		pixel.color = color(pixel.color + value);
+		path.is_alive = false;
+	}
+
+	std::vector<wavefront_path> m_paths;
+	// indices of m_paths sorted by material, and the paths gathered in that order (see render)
+	std::vector<uint32_t> m_order;
+	std::vector<wavefront_path> m_sorted_paths;
+};
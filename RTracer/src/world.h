@@ -1,10 +1,32 @@
 ﻿#pragma once
 
+#include <chrono>
+#include <string>
 #include <vector>
 
 
 #include "geometry/abstract/bvh.h"
+#include "geometry/abstract/bvh_builder.h"
+#include "geometry/abstract/bvh_cache.h"
+#include "geometry/abstract/compressed_bvh.h"
 #include "geometry/abstract/hittable.h"
+#include "geometry/abstract/lazy_bvh.h"
+#include "geometry/abstract/wide_bvh.h"
+
+/// <summary>
+/// memory layout of the bvh traversed by world::hit
+/// </summary>
+enum class bvh_layout
+{
+	// two children per node (see bvh)
+	binary,
+	// four children per node, tested with SSE (see wide_bvh)
+	wide4,
+	// eight children per node, tested with AVX when available (see wide_bvh)
+	wide8,
+	// four children per node with bounds quantized to 8 bits (see compressed_bvh)
+	compressed4
+};
 
 class world
 {
@@ -64,13 +86,44 @@ public:
 		m_list.clear();
 	}
 
+	/// <summary>
+	/// returns true if the given ray hits one of the objects at a distance comprised between t_min and t_max
+	/// info is filled with the closest hit: the surface is only evaluated for that one
+	/// </summary>
 	bool hit(const ray& ray, float t_min, float t_max, hit_info& info) const
+	{
+		if (!find_closest_hit(ray, t_min, t_max, info))
+			return false;
+
+		info.object->base_evaluate(ray, info);
+		return true;
+	}
+
+	/// <summary>
+	/// returns true if the given ray hits one of the objects at a distance comprised between t_min and t_max
+	/// only the distance, the object and the primitive of the closest hit are recorded in info (see hittable::evaluate)
+	/// </summary>
+	bool find_closest_hit(const ray& ray, float t_min, float t_max, hit_info& info) const
 	{
 		info.distance = t_max;
 
-		if (use_bvh)
+		if (use_bvh && lazy_build && !m_lazy_bvh.empty())
 		{
-			return m_bvh->base_hit(ray, t_min, t_max, info);
+			return m_lazy_bvh.hit(ray, t_min, t_max, info);
+		}
+		if (use_bvh && !m_bvh.empty())
+		{
+			switch (m_layout)
+			{
+			case bvh_layout::wide4:
+				return m_bvh4.hit(ray, t_min, t_max, info);
+			case bvh_layout::wide8:
+				return m_bvh8.hit(ray, t_min, t_max, info);
+			case bvh_layout::compressed4:
+				return m_compressed_bvh.hit(ray, t_min, t_max, info);
+			default:
+				return m_bvh.hit(ray, t_min, t_max, info);
+			}
 		}
 		else
 		{
@@ -84,20 +137,290 @@ public:
 		}
 	}
 
+	/// <summary>
+	/// intersect all the rays of the packet: infos[i] is filled with the closest hit of packet.rays[i]
+	/// returns the mask of the rays that hit an object (bit i for packet.rays[i])
+	/// only the binary layout traverses the bvh once for the whole packet (see bvh::hit),
+	/// otherwise the rays are intersected one by one
+	/// </summary>
+	uint32_t hit(const ray_packet& packet, float t_min, float t_max, hit_info* infos) const
+	{
+		if (use_bvh && !lazy_build && !m_bvh.empty() && m_layout == bvh_layout::binary)
+		{
+			for (uint32_t i = 0; i < packet.count; i++)
+			{
+				infos[i].distance = t_max;
+			}
+
+			const uint32_t hit_mask = m_bvh.hit(packet, t_min, infos);
+			for (uint32_t i = 0; i < packet.count; i++)
+			{
+				if ((hit_mask >> i) & 1u)
+					infos[i].object->base_evaluate(packet.rays[i], infos[i]);
+			}
+			return hit_mask;
+		}
+
+		uint32_t hit_mask = 0;
+		for (uint32_t i = 0; i < packet.count; i++)
+		{
+			hit_mask |= static_cast<uint32_t>(hit(packet.rays[i], t_min, t_max, infos[i])) << i;
+		}
+		return hit_mask;
+	}
+
+	/// <summary>
+	/// returns true if the given ray hits any object at a distance comprised between t_min and t_max
+	/// (e.g. to test the visibility between two points with a shadow ray)
+	/// stops at the first hit found and records nothing about it, which makes it cheaper than hit.
+	/// the binary bvh is used whatever the selected layout, since the other layouts are built from it
+	/// </summary>
+	bool occluded(const ray& ray, float t_min, float t_max) const
+	{
+		if (use_bvh && !m_bvh.empty())
+			return m_bvh.occluded(ray, t_min, t_max);
+
+		if (use_bvh && lazy_build && !m_lazy_bvh.empty())
+			return m_lazy_bvh.occluded(ray, t_min, t_max);
+
+		hit_info info{nullptr};
+		info.distance = t_max;
+		for (const auto& hittable : m_list)
+		{
+			if (hittable->base_hit(ray, t_min, t_max, info))
+				return true;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// same as occluded for all the rays of a packet, traversing the bvh once for the whole packet
+	/// returns the mask of the occluded rays (bit i for packet.rays[i])
+	/// </summary>
+	uint32_t occluded(const ray_packet& packet, float t_min, float t_max) const
+	{
+		if (use_bvh && !m_bvh.empty())
+			return m_bvh.occluded(packet, t_min, t_max);
+
+		uint32_t occluded_mask = 0;
+		for (uint32_t i = 0; i < packet.count; i++)
+		{
+			occluded_mask |= static_cast<uint32_t>(occluded(packet.rays[i], t_min, t_max)) << i;
+		}
+		return occluded_mask;
+	}
+
 	const std::vector<hittable*>& hittables() const
 	{
 		return m_list;
 	}
 
-	void signal_scene_change()
+	/// <summary>
+	/// rebuild the bvh from scratch
+	/// if a pool is given, up to build_thread_count of its threads are used to build it (see bvh_builder::build)
+	/// with lazy_build, only the top of the bvh is built: the rest is built by hit when rays reach it (see lazy_bvh)
+	/// with reorder_nodes, the nodes are then reordered in treelets (see bvh::reorder_treelets)
+	/// </summary>
+	void signal_scene_change(thread_pool* pool = nullptr)
+	{
+		rebuild(pool, {});
+	}
+
+	/// <summary>
+	/// build the bvh of a scene that was just loaded, as signal_scene_change
+	/// the bvh is loaded from cache_path when it was saved there for the same objects, otherwise the built bvh is saved
+	/// to it, so that loading the same scene again skips the build. Edits go through signal_scene_change instead:
+	/// hashing the scene and writing the file on each of them would only slow them down
+	/// </summary>
+	void signal_scene_load(const std::string& cache_path, thread_pool* pool = nullptr)
+	{
+		rebuild(pool, cache_path);
+	}
+
+	/// <summary>
+	/// save the current bvh to the given file, for a later signal_scene_load of the same objects
+	/// returns false if there is no complete bvh to save (e.g. with lazy_build) or if the file could not be written
+	/// </summary>
+	bool save_bvh_cache(const std::string& path) const
+	{
+		if (lazy_build || m_bvh.empty())
+			return false;
+
+		return bvh_cache::save(path, bvh_cache::hash(m_list, build_method), m_bvh, m_list);
+	}
+
+	/// <summary>
+	/// update the bvh after the bbox of the given object changed (e.g. it was moved, rotated or scaled)
+	/// the bvh is refitted when possible, and rebuilt if the refit degraded its quality too much
+	/// (i.e. its estimated traversal cost grew above refit_threshold times its cost when it was built)
+	/// with lazy_build, the nodes built so far are refitted (see lazy_bvh::refit): there is no cost to compare,
+	/// and the nodes not built yet are still split with the new bounds
+	/// </summary>
+	void signal_object_change(const hittable* object, thread_pool* pool = nullptr)
+	{
+		const auto chrono_start = std::chrono::high_resolution_clock::now();
+
+		if (lazy_build)
+		{
+			if (!use_refit || !m_lazy_bvh.refit(object))
+			{
+				signal_scene_change(pool);
+				return;
+			}
+		}
+		else if (!use_refit || !m_bvh.refit(object) || m_bvh.sah_cost() > m_bvh.built_sah_cost() * refit_threshold)
+		{
+			signal_scene_change(pool);
+			return;
+		}
+		build_wide_bvh();
+		refit_count++;
+
+		const auto chrono_stop = std::chrono::high_resolution_clock::now();
+		last_build_duration = std::chrono::duration<float, std::milli>(chrono_stop - chrono_start).count();
+	}
+
+	/// <summary>
+	/// select the layout of the bvh used by hit. wide layouts are collapsed from the binary bvh when selected
+	/// </summary>
+	void set_bvh_layout(bvh_layout layout)
+	{
+		m_layout = layout;
+		build_wide_bvh();
+	}
+
+	[[nodiscard]] bvh_layout get_bvh_layout() const
+	{
+		return m_layout;
+	}
+
+	/// <summary>
+	/// returns the number of bytes used by the nodes of the bvh of the selected layout
+	/// </summary>
+	[[nodiscard]] size_t bvh_memory_usage() const
+	{
+		switch (m_layout)
+		{
+		case bvh_layout::wide4:
+			return m_bvh4.memory_usage();
+		case bvh_layout::wide8:
+			return m_bvh8.memory_usage();
+		case bvh_layout::compressed4:
+			return m_compressed_bvh.memory_usage();
+		default:
+			return m_bvh.memory_usage();
+		}
+	}
+
+	[[nodiscard]] const bvh& get_bvh() const
+	{
+		return m_bvh;
+	}
+
+	[[nodiscard]] const lazy_bvh& get_lazy_bvh() const
+	{
+		return m_lazy_bvh;
+	}
+
+	// the wide bvhs are empty unless their layout is selected (see set_bvh_layout)
+
+	[[nodiscard]] const wide_bvh<4>& get_wide_bvh4() const
 	{
-		delete m_bvh;
-		m_bvh = new bvh_node(m_list, 0, m_list.size());
+		return m_bvh4;
+	}
+
+	[[nodiscard]] const wide_bvh<8>& get_wide_bvh8() const
+	{
+		return m_bvh8;
+	}
+
+	[[nodiscard]] const compressed_bvh& get_compressed_bvh() const
+	{
+		return m_compressed_bvh;
 	}
 
 	bool use_bvh{true};
+	// method used to build the bvh on the next signal_scene_change
+	bvh_build_method build_method{bvh_build_method::sah};
+	// maximum number of threads used to build the bvh when signal_scene_change is given a thread pool
+	int build_thread_count{8};
+	// if true, signal_scene_change only builds the top of the bvh and the rest is built as rays reach it
+	// (the selected layout is ignored)
+	bool lazy_build{false};
+	// if true, signal_scene_change stores the nodes of the bvh in treelets (see bvh::reorder_treelets)
+	bool reorder_nodes{false};
+	// if false, signal_object_change always rebuilds the bvh
+	bool use_refit{true};
+	// maximum growth of the bvh estimated cost allowed by signal_object_change before rebuilding it
+	float refit_threshold{1.5f};
+	// true if the last build loaded the bvh from a cache file (see signal_scene_load)
+	bool last_build_cached{false};
+	// duration of the last bvh build or refit (in milliseconds)
+	float last_build_duration{0.0f};
+	// number of bvh rebuilds and refits since the world was created
+	int rebuild_count{0};
+	int refit_count{0};
 
 private:
-	hittable* m_bvh{nullptr};
+	/// <summary>
+	/// rebuild the bvh from scratch (see signal_scene_change), loading it from and saving it to cache_path if not empty
+	/// </summary>
+	void rebuild(thread_pool* pool, const std::string& cache_path)
+	{
+		const auto chrono_start = std::chrono::high_resolution_clock::now();
+
+		last_build_cached = false;
+		m_lazy_bvh.clear();
+		if (lazy_build)
+		{
+			m_bvh.clear();
+			m_lazy_bvh.build(m_list);
+		}
+		else
+		{
+			const bool use_cache = !cache_path.empty() && !m_list.empty();
+			const uint64_t hash = use_cache ? bvh_cache::hash(m_list, build_method) : 0;
+			last_build_cached = use_cache && bvh_cache::load(cache_path, hash, m_list, m_bvh);
+			if (!last_build_cached)
+			{
+				bvh_builder::build(m_list, build_method, m_bvh, pool,
+				                   static_cast<size_t>(std::max(build_thread_count, 1)));
+			}
+
+			// reordering a bvh loaded in treelet order does not change it
+			if (reorder_nodes)
+				m_bvh.reorder_treelets();
+
+			if (use_cache && !last_build_cached)
+				bvh_cache::save(cache_path, hash, m_bvh, m_list);
+		}
+		build_wide_bvh();
+		rebuild_count++;
+
+		const auto chrono_stop = std::chrono::high_resolution_clock::now();
+		last_build_duration = std::chrono::duration<float, std::milli>(chrono_stop - chrono_start).count();
+	}
+
+	/// <summary>
+	/// build the wide bvh of the selected layout from the binary one (the other ones are released)
+	/// </summary>
+	void build_wide_bvh()
+	{
+		if (m_layout == bvh_layout::wide4) m_bvh4.build(m_bvh);
+		else m_bvh4.clear();
+
+		if (m_layout == bvh_layout::wide8) m_bvh8.build(m_bvh);
+		else m_bvh8.clear();
+
+		if (m_layout == bvh_layout::compressed4) m_compressed_bvh.build(m_bvh);
+		else m_compressed_bvh.clear();
+	}
+
+	bvh m_bvh;
+	bvh_layout m_layout{bvh_layout::binary};
+	wide_bvh<4> m_bvh4;
+	wide_bvh<8> m_bvh8;
+	compressed_bvh m_compressed_bvh;
+	lazy_bvh m_lazy_bvh;
 	std::vector<hittable*> m_list;
 };